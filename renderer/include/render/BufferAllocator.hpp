@@ -1,84 +1,155 @@
 /// \brief C++ declaration of the temporary buffer abstraction's class
 #pragma once
 #include <volk.h>
+#include <vk_mem_alloc.h>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <vector>
+#include "render/Constants.hpp"
+#include "render/DescriptorSlab.hpp"
+#include "render/PagePool.hpp"
 #include "render/Structs.h"
 
 namespace MVRender {
     struct BufferAllocatorCreateInfo {
         VmaAllocator allocator;
         VkDevice logical_device;
-        VkDeviceSize page_size;
-        uint32_t queue_family_index;
+        PagePool *page_pool;
         VkPhysicalDeviceProperties device_properties;
         uint32_t frame_in_flight_index;
     };
 
-    // MVR_Buffer is a pointer to one of these structs. Permanent buffers do not care about anything except buffer.
-    struct BufferDescriptor {
-        VkBuffer buffer; // the device-local buffer
-        VmaAllocation allocation; // allocation for permanent buffers -- NOT FOR TEMPORARY
-        VkDeviceSize offset; // offset in that buffer for this virtual buffer
-        VkDeviceSize size; // amount of bytes pertaining to this buffer
-        void *data; // memory-mapped host-visible pointer to the start of the range
+    // Temp buffer handles have the top bit set, then the low 31 bits of the allocator epoch they
+    // were made in, then their descriptor slot. Permanent buffer handles come from the renderer's
+    // HandleTable, which never sets the top bit.
+    constexpr uint64_t TEMP_HANDLE_BIT = 1ull << 63;
+    constexpr uint64_t TEMP_HANDLE_EPOCH_MASK = 0x7FFFFFFF;
+
+    inline bool is_temp_handle(MVR_Buffer buffer) {
+        return buffer != MVR_INVALID_HANDLE && (buffer & TEMP_HANDLE_BIT) != 0;
+    }
+
+    // A chunk of a page owned by one thread, that thread bump-allocates out of it with no
+    // synchronization. The epoch ties it to a single frame of a single allocator.
+    struct TempArena {
+        uint64_t epoch = 0;
+        BufferPage *page = nullptr;
+        VkDeviceSize offset = 0; // next free byte in the page
+        VkDeviceSize end = 0; // one past the last byte of the chunk
     };
 
-    // For internal use in BufferAllocator
-    struct BufferPage {
-        VkBuffer vram_buffer; // actual vulkan device memory
-        VmaAllocation vram_allocation;
-        VkBuffer staging_buffer; // staging buffer that will be copied to vram
-        VmaAllocation staging_allocation;
-        VkDeviceSize offset; // current offset for new writes
-        VkDeviceSize size; // size of this page
-        void *data; // data for the staging buffer
+    // Where record_copy_commands puts its commands. With a dedicated transfer queue the copies go
+    // into the transfer queue's command buffer and ownership of the pages is handed to the graphics
+    // queue, otherwise both command buffers are the same.
+    struct CopyCommandsInfo {
+        VkCommandBuffer transfer_commands; // copies go in here, may be null to only flush
+        VkCommandBuffer graphics_commands; // barriers making the copies visible to the frame go in here
+        uint32_t transfer_queue_family;
+        uint32_t graphics_queue_family;
+    };
+
+    // Part of a buffer that was copied into, ownership transfers only cover this range so the
+    // rest of a shared buffer keeps its contents
+    struct CopiedRange {
+        VkBuffer buffer;
+        VkDeviceSize offset;
+        VkDeviceSize size;
+    };
+
+    // Makes copies recorded into info.transfer_commands visible to info.graphics_commands, handing
+    // ownership of the copied ranges over to the graphics queue family if needed
+    void record_transfer_barriers(const CopyCommandsInfo &info, const std::vector<CopiedRange> &copied_ranges);
+
+    // Shared pages for one buffer usage, every usage gets its own so each can use its own alignment
+    struct TempStream {
+        // Pages of memory borrowed from the pool, only touched while holding m_page_mutex
+        std::vector<std::unique_ptr<BufferPage>> pages;
+        size_t cursor = 0; // the current page, everything before it is full and everything after is empty
+
+        // Page threads are currently claiming chunks from
+        std::atomic<BufferPage *> current_page = nullptr;
+
+        MVR_BufferUsage usage = MVR_BUFFER_USAGE_GENERAL;
+        VkDeviceSize alignment = 1; // smallest offset alignment that is legal for this usage
     };
 
     // A paging temporary buffer allocator. There should be one of these
     // per frame in flight to allow users to allocate arbitrary temporary
-    // buffers in vram.
+    // buffers in vram. Any number of threads may allocate from it at once,
+    // each thread claims TEMP_CHUNK_SIZE chunks from the current page of
+    // the stream for the buffer's usage and carves its buffers out of those.
+    // Buffers over TEMP_DEDICATED_THRESHOLD get a page to themselves.
     class BufferAllocator {
-        // List of temporary buffers
-        std::vector<BufferDescriptor> m_buffers;
+        // This frame's temporary buffers, a handle's slot indexes into this
+        DescriptorSlab m_descriptors;
 
-        // Pages of memory, both the staging and device memory
-        std::vector<BufferPage> m_buffer_pages;
+        // One stream of shared pages per usage
+        std::array<TempStream, MVR_BUFFER_USAGE_COUNT> m_streams;
+        std::mutex m_page_mutex;
 
-        // Size of each page by default
-        VkDeviceSize m_page_size = 0;
+        // Pages holding a single large buffer each, all of them go back to the pool every frame
+        std::vector<std::unique_ptr<BufferPage>> m_dedicated_pages;
+
+        // Changes every frame so threads know their arena is stale
+        std::atomic<uint64_t> m_epoch = 0;
+
+        // Where pages come from and go back to
+        PagePool *m_page_pool = nullptr;
 
         // Internal Vulkan handles
         VmaAllocator m_vma;
         VkDevice m_logical_device;
-        uint32_t m_queue_family_index;
         uint32_t m_index; // frame in flight index for debug purposes
 
-        // Minimum required alignment for memory to be placed in pages
-        VkDeviceSize m_minimum_alignment = 0;
+        // Borrows a page from the pool and appends it to the stream, can fail
+        void append_page(TempStream &stream, VkDeviceSize size);
+
+        // Moves the stream on to its next page, borrowing one if there are none left, can fail. Must hold m_page_mutex.
+        BufferPage *find_page(TempStream &stream, VkDeviceSize size);
 
-        // Allocates and appends a new page to the allocator, can fail
-        void append_page(VkDeviceSize size);
+        // Borrows a page just for one buffer of size bytes, can fail
+        BufferPage *claim_dedicated_page(MVR_BufferUsage usage, VkDeviceSize size);
 
-        // Finds/creates a page with at least size size, can fail
-        BufferPage *find_page(VkDeviceSize size);
+        // Flushes a page and records its copy if it has one, returns true if a copy was needed
+        bool record_page_copy(BufferPage &page, VkCommandBuffer command_buffer);
+
+        // Claims size bytes from the stream's current page, moving on to a new page if it's full, can fail
+        void claim_range(TempStream &stream, VkDeviceSize size, BufferPage **page, VkDeviceSize *offset);
 
         // Attempts to get a buffer out of the allocator, can fail
-        BufferDescriptor *get_buffer_descriptor(VkDeviceSize size);
+        BufferDescriptor *get_buffer_descriptor(MVR_BufferUsage usage, VkDeviceSize size, uint32_t *slot);
     public:
         BufferAllocator() = default;
         explicit BufferAllocator(BufferAllocatorCreateInfo &create_info);
         ~BufferAllocator();
 
+        BufferAllocator(BufferAllocator const&) = delete;
+        void operator=(BufferAllocator const&)  = delete;
+
         // Returns a handle to a temporary buffer of size size and returns a pointer to its first byte of data
-        MVR_Buffer allocate_temp_buffer(VkDeviceSize size, void **data);
+        MVR_Buffer allocate_temp_buffer(VkDeviceSize size, void **data, MVR_BufferUsage usage = MVR_BUFFER_USAGE_GENERAL);
+
+        // Returns the descriptor behind a temp buffer handle from this frame, can fail if the handle is stale
+        BufferDescriptor *resolve_temp_buffer(MVR_Buffer buffer);
 
         // Returns a handle to a permanent buffer of size size, requires a pointer to a buffer descriptor to fill
         MVR_Buffer allocate_permanent_buffer(VkDeviceSize size, void *data);
 
-        // Records necessary copy commands into the copy command buffer
-        void record_copy_commands(VkCommandBuffer command_buffer);
+        // Records necessary copy commands and the barriers that go with them
+        void record_copy_commands(const CopyCommandsInfo &info);
 
-        // Performs start of frame tasks.
+        // Performs start of frame tasks, pages that went unused last frame go back to the pool.
         void begin_frame();
+
+        // Number of pages currently owned by the allocator
+        [[nodiscard]] size_t page_count() const;
+
+        // Offset alignment temp buffers of a given usage get
+        [[nodiscard]] VkDeviceSize alignment(MVR_BufferUsage usage) const { return m_streams[usage].alignment; }
+
+        // True if pages are written directly instead of going through a staging buffer
+        [[nodiscard]] bool writes_directly() const { return m_page_pool->writes_directly(); }
     };
-}
\ No newline at end of file
+}
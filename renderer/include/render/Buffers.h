@@ -7,6 +7,14 @@
 /// mvr_PresentFrame), they are for things like temporary shapes or
 /// uniform buffers or things like that. Permanent buffers need to be
 /// manually managed by the user.
+///
+/// Temporary buffers may be created from any number of threads at the same
+/// time, as long as none of them are still creating buffers when
+/// mvr_PresentFrame is called. Handles to temporary buffers from a previous
+/// frame are detected and rejected with MVR_RESULT_INVALID_HANDLE, and so
+/// are handles to permanent buffers that have been destroyed. A frame can have
+/// 262144 temporary buffers, past that creating one fails with
+/// MVR_RESULT_OUT_OF_MEMORY until the next frame.
 #pragma once
 #include "render/Structs.h"
 
@@ -27,6 +35,22 @@ MVR_API MVR_Result mvr_CreateTempBuffer(uint64_t size, void *data, MVR_Buffer *b
 /// this function, then you fill in your desired data later with the data pointer.
 MVR_API MVR_Result mvr_AllocateTempBuffer(uint64_t size, void **data, MVR_Buffer *buffer);
 
+/// \brief Creates a temporary buffer for a specific usage with the given data
+/// \param params Size, data and usage of the buffer
+/// \param buffer Pointer to a buffer handle where the new buffer will be placed
+/// \return Returns an MVR_Result status code
+///
+/// This is the same as mvr_CreateTempBuffer except the buffer can be used as something other
+/// than a vertex or storage buffer, like a uniform buffer, index buffer or indirect buffer.
+MVR_API MVR_Result mvr_CreateTempBufferWithUsage(MVR_CreateTempBufferWithUsageParams *params, MVR_Buffer *buffer);
+
+/// \brief Allocates a temporary buffer for a specific usage, returning the buffer and a memory handle
+/// \param params Size and usage of the buffer
+/// \param data Handle that will be given a pointer to the start of the buffer's memory
+/// \param buffer Pointer to a buffer handle where the new buffer will be placed
+/// \return Returns an MVR_Result status code
+MVR_API MVR_Result mvr_AllocateTempBufferWithUsage(MVR_AllocateTempBufferWithUsageParams *params, void **data, MVR_Buffer *buffer);
+
 /// \brief Creates a permanent buffer of given size and given data
 /// \param size Size of the buffer in bytes
 /// \param data Binary data of at least size size to copy into the MVR_Buffer
@@ -34,6 +58,27 @@ MVR_API MVR_Result mvr_AllocateTempBuffer(uint64_t size, void **data, MVR_Buffer
 /// \return Returns an MVR_Result status code
 MVR_API MVR_Result mvr_CreateBuffer(uint64_t size, void *data, MVR_Buffer *buffer);
 
+/// \brief Checks if a buffer's data has made it to the GPU
+/// \param buffer Buffer to check
+/// \return Returns true if the buffer is ready, false if it is still uploading or is invalid
+///
+/// Permanent buffers don't block when they are created, their data is copied to the GPU as part
+/// of the frame they were created in. Temporary buffers are always ready.
+MVR_API bool mvr_IsBufferReady(MVR_Buffer buffer);
+
+/// \brief Overwrites part of a permanent buffer
+/// \param params Buffer, range and data to write
+/// \return Returns an MVR_Result status code, MVR_RESULT_INVALID_ARGUMENT if the range doesn't fit in the buffer
+///
+/// Only the given bytes are staged, and they are copied to the GPU as part of the current frame
+/// just like a new buffer's data. Updates to overlapping or touching ranges of the same buffer
+/// in one frame are merged, the latest data wins. mvr_IsBufferReady returns false until the
+/// update has landed. Temporary buffers can't be updated, write through their data pointer instead.
+MVR_API MVR_Result mvr_UpdateBuffer(MVR_UpdateBufferParams *params);
+
 /// \brief Destroys a permanent MVR_Buffer
 /// \param buffer Buffer to destroy
+///
+/// Destroying a buffer that was already destroyed does nothing, mvr_GetError will say so.
+/// Temporary buffers and MVR_INVALID_HANDLE are ignored.
 MVR_API void mvr_DestroyBuffer(MVR_Buffer buffer);
\ No newline at end of file
@@ -0,0 +1,92 @@
+/// \brief Per-frame command pools and the secondary command buffers worker threads record into
+#pragma once
+#include <volk.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace MVRender {
+    struct CommandRecorderCreateInfo {
+        VkDevice logical_device;
+        uint32_t graphics_queue_family;
+        uint32_t transfer_queue_family; // only used with a dedicated transfer queue
+        uint32_t compute_queue_family; // only used with async compute
+        bool dedicated_transfer;
+        bool async_compute;
+        uint32_t frame_in_flight_index; // for debug names
+    };
+
+    // A secondary command buffer waiting to be executed, sorted by key at the end of the frame
+    struct SecondaryCommands {
+        uint64_t key; // requested order in the top 32 bits, then the order it was handed out in
+        VkCommandBuffer buffer;
+    };
+
+    // One worker thread's pool for one frame. Only that thread touches it until the end of the
+    // frame, so nothing in here needs a lock.
+    struct ThreadCommands {
+        VkCommandPool pool;
+        std::vector<VkCommandBuffer> buffers; // every buffer the pool has made, reused each frame
+        size_t used = 0;
+        std::vector<SecondaryCommands> recorded; // buffers handed out this frame
+    };
+
+    // Owns every command pool one frame in flight records into. The frame's primary command buffers
+    // come from their own pools, and each thread that asks for a secondary command buffer gets a pool
+    // of its own so threads never fight over one. Every pool is reset in one go at the start of the
+    // frame rather than buffer by buffer, and buffers are kept around to be reused next time.
+    class CommandRecorder {
+        VkDevice m_logical_device;
+        uint32_t m_graphics_queue_family;
+        uint32_t m_index;
+
+        // Pools for the primaries, the compute and transfer ones are null without their own queue
+        VkCommandPool m_graphics_pool;
+        VkCommandPool m_compute_pool = VK_NULL_HANDLE;
+        VkCommandPool m_transfer_pool = VK_NULL_HANDLE;
+        VkCommandBuffer m_copy_commands;
+        VkCommandBuffer m_compute_commands;
+        VkCommandBuffer m_draw_commands;
+        VkCommandBuffer m_transfer_commands; // same as m_copy_commands without a dedicated transfer queue
+
+        // Worker thread pools, the first m_claimed_threads are in use this frame
+        std::vector<std::unique_ptr<ThreadCommands>> m_threads;
+        size_t m_claimed_threads = 0;
+        std::mutex m_thread_mutex;
+
+        // Changes every frame so threads know their pool is from an old frame
+        std::atomic<uint64_t> m_epoch = 0;
+        std::atomic<uint32_t> m_sequence = 0; // ties in order are broken by this
+
+        // Makes a pool for queue_family, can fail
+        VkCommandPool create_pool(uint32_t queue_family, const char *name);
+
+        // Gets the calling thread's pool for this frame, claiming one if it doesn't have one yet, can fail
+        ThreadCommands &thread_commands();
+    public:
+        explicit CommandRecorder(CommandRecorderCreateInfo &create_info);
+        ~CommandRecorder();
+
+        CommandRecorder(CommandRecorder const&) = delete;
+        void operator=(CommandRecorder const&)  = delete;
+
+        // Resets every pool, the GPU must be done with the frame's last submission
+        void begin_frame();
+
+        // Hands the calling thread a secondary command buffer that is ready to record, thread-safe and can fail.
+        // Secondaries are sorted by end_secondaries lowest order first, equal orders in the order they
+        // were handed out.
+        VkCommandBuffer begin_secondary(uint32_t order);
+
+        // Ends every secondary handed out this frame and gives them back in the order they should be executed
+        // in. Every thread has to be done recording.
+        std::vector<SecondaryCommands> end_secondaries();
+
+        [[nodiscard]] VkCommandBuffer copy_commands() const { return m_copy_commands; }
+        [[nodiscard]] VkCommandBuffer compute_commands() const { return m_compute_commands; }
+        [[nodiscard]] VkCommandBuffer draw_commands() const { return m_draw_commands; }
+        [[nodiscard]] VkCommandBuffer transfer_commands() const { return m_transfer_commands; }
+        [[nodiscard]] size_t thread_pool_count() const { return m_threads.size(); }
+    };
+}
@@ -3,6 +3,46 @@
 #include <cinttypes>
 
 namespace MVRender {
+    // Default frames the CPU can get ahead of the GPU, and the most it can be set to
     constexpr uint32_t FRAMES_IN_FLIGHT = 2;
+    constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 3;
+
+    // Longest time in seconds the frame rate limiter can be asked to space frames out by
+    constexpr double MAX_FRAME_PERIOD = 3600.0;
+
+    // Number of frames per-frame timings are kept for
+    constexpr uint32_t FRAME_TIMING_HISTORY = 128;
+
+    // Trace zones each thread keeps, older ones are overwritten
+    constexpr uint64_t TRACE_BUFFER_EVENTS = 16384;
+
+    // Size of the device pages temp buffers are allocated out of
     constexpr uint64_t VRAM_PAGE_SIZE = 256 * 1024;
+
+    // Size of the piece of a page a thread claims at a time for its temp buffers
+    constexpr uint64_t TEMP_CHUNK_SIZE = 16 * 1024;
+
+    // Temp buffers bigger than this get a page of their own instead of sharing one
+    constexpr uint64_t TEMP_DEDICATED_THRESHOLD = VRAM_PAGE_SIZE / 4;
+
+    // Temp buffer descriptors are stored in chunks of this many, with a hard cap on chunks per frame
+    constexpr uint32_t TEMP_DESCRIPTOR_CHUNK_SIZE = 256;
+    constexpr uint32_t MAX_TEMP_DESCRIPTOR_CHUNKS = 1024;
+
+    // Temp pages nobody has borrowed for this many frames are freed
+    constexpr uint32_t TEMP_PAGE_TRIM_FRAMES = 120;
+
+    // Default size of the staging ring permanent buffer uploads go through, and the alignment of each upload in it
+    constexpr uint64_t STAGING_RING_SIZE = 8 * 1024 * 1024;
+    constexpr uint64_t STAGING_RING_ALIGNMENT = 16;
+
+    // Smallest staging ring that still fits an aligned piece of an upload, pieces are a quarter of the ring
+    constexpr uint64_t MIN_STAGING_RING_SIZE = 4 * STAGING_RING_ALIGNMENT;
+
+    // Default size of the ring buffer readbacks are copied into
+    constexpr uint64_t READBACK_RING_SIZE = 4 * 1024 * 1024;
+
+    // Permanent buffers this size or smaller are packed into shared blocks of the size below
+    constexpr uint64_t SHARED_BUFFER_THRESHOLD = 64 * 1024;
+    constexpr uint64_t SHARED_BUFFER_BLOCK_SIZE = 4 * 1024 * 1024;
 }
\ No newline at end of file
@@ -11,6 +11,32 @@ MVR_API MVR_Result mvr_Initialize(MVR_InitializeParams *params);
 /// \return Returns an MVR_Result, if its not MVR_RESULT_SUCCESS something went wrong.
 MVR_API MVR_Result mvr_PresentFrame();
 
+/// \brief Changes the present mode after initialization
+/// \param present_mode New present mode, falls back to vsync the same way mvr_Initialize does
+/// \return Returns MVR_RESULT_INVALID_ARGUMENT if present_mode isn't a valid mode, MVR_RESULT_SUCCESS otherwise
+///
+/// The swapchain is rebuilt at the start of the next frame the same way it is when the window is
+/// resized, frames already in flight finish on the old swapchain so there is no stall.
+MVR_API MVR_Result mvr_SetPresentMode(MVR_PresentMode present_mode);
+
+/// \brief Caps how many frames per second mvr_PresentFrame lets through
+/// \param frames_per_second Frame rate to cap at, 0 removes the limit
+/// \return Returns MVR_RESULT_INVALID_ARGUMENT if frames_per_second is negative, NaN, infinite or under one
+/// frame an hour, MVR_RESULT_SUCCESS otherwise
+///
+/// The limiter sleeps at the start of the frame, before waiting on the GPU, so input sampled right
+/// after mvr_PresentFrame returns is as fresh as possible. It sleeps most of the way and only yields
+/// the last fraction of a millisecond, so it doesn't burn a core.
+MVR_API MVR_Result mvr_SetFrameRateLimit(double frames_per_second);
+
+/// \brief Changes how many frames the CPU can record ahead of the GPU
+/// \param count Frames in flight from 1 to 3, 1 has the lowest input latency and 3 the most throughput
+/// \return Returns MVR_RESULT_INVALID_ARGUMENT if count is out of range, MVR_RESULT_SUCCESS otherwise
+///
+/// The change happens at the start of the next frame, which waits for the GPU to finish every
+/// frame in flight first so expect a one-off hitch. Use mvr_GetFrameStats to compare settings.
+MVR_API MVR_Result mvr_SetFramesInFlight(uint32_t count);
+
 /// \brief Frees all renderer resources
 MVR_API void mvr_Quit();
 
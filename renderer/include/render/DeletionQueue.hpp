@@ -0,0 +1,50 @@
+/// \brief Destroys GPU resources once the frames that might still use them have finished
+#pragma once
+#include <cinttypes>
+#include <deque>
+#include <functional>
+
+namespace MVRender {
+    // Something to destroy and the timeline value the GPU has to reach before it is safe to
+    struct PendingDeletion {
+        uint64_t timeline_value;
+        std::function<void()> destroy;
+    };
+
+    // Resources are queued with the timeline value of the last frame that could use them and get
+    // destroyed once the timeline passes that value, so freeing something never waits on the GPU.
+    // Values only ever go up, so the queue is always sorted and draining it stops at the first
+    // deletion that isn't ready. Whatever the deletions use has to outlive the queue, so call
+    // flush_all before tearing it down. Not thread-safe.
+    class DeletionQueue {
+        std::deque<PendingDeletion> m_deletions;
+    public:
+        DeletionQueue() = default;
+
+        DeletionQueue(DeletionQueue const&)    = delete;
+        void operator=(DeletionQueue const&)  = delete;
+
+        // Queues destroy to run once the timeline reaches timeline_value
+        void push(uint64_t timeline_value, std::function<void()> destroy) {
+            m_deletions.push_back({timeline_value, std::move(destroy)});
+        }
+
+        // Runs every deletion the GPU is done with
+        void flush(uint64_t completed_value) {
+            while (!m_deletions.empty() && m_deletions.front().timeline_value <= completed_value) {
+                m_deletions.front().destroy();
+                m_deletions.pop_front();
+            }
+        }
+
+        // Runs every deletion no matter what, the GPU must be idle
+        void flush_all() {
+            while (!m_deletions.empty()) {
+                m_deletions.front().destroy();
+                m_deletions.pop_front();
+            }
+        }
+
+        [[nodiscard]] size_t size() const { return m_deletions.size(); }
+    };
+}
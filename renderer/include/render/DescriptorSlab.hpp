@@ -0,0 +1,49 @@
+/// \brief Address-stable storage for a frame's temporary buffer descriptors
+#pragma once
+#include <volk.h>
+#include <vk_mem_alloc.h>
+#include <array>
+#include <atomic>
+#include "render/Constants.hpp"
+
+namespace MVRender {
+    // Everything the renderer needs to know about a buffer. Permanent buffers do not care about anything except buffer.
+    struct BufferDescriptor {
+        VkBuffer buffer; // the device-local buffer
+        VmaAllocation allocation; // allocation for permanent buffers -- NOT FOR TEMPORARY
+        VmaVirtualAllocation virtual_allocation; // permanent buffers packed into a shared block, null otherwise
+        VkDeviceSize offset; // offset in that buffer for this virtual buffer
+        VkDeviceSize size; // amount of bytes pertaining to this buffer
+        void *data; // memory-mapped host-visible pointer to the start of the range
+        uint64_t ready_value; // permanent buffers only, timeline value at which the contents are uploaded
+    };
+
+    // Descriptors are stored in fixed-size chunks that are never moved or freed until the slab
+    // is destroyed, so a pointer to a descriptor stays good for as long as its slot does. Chunks
+    // are kept between frames, so resetting is just setting the count back to zero. Any number of
+    // threads may claim slots at once.
+    class DescriptorSlab {
+        std::array<std::atomic<BufferDescriptor *>, MAX_TEMP_DESCRIPTOR_CHUNKS> m_chunks;
+        std::atomic<uint32_t> m_count = 0;
+    public:
+        DescriptorSlab();
+        ~DescriptorSlab();
+
+        DescriptorSlab(DescriptorSlab const&)  = delete;
+        void operator=(DescriptorSlab const&)  = delete;
+
+        // Claims an empty slot, can fail if the slab is full
+        BufferDescriptor *claim(uint32_t *slot);
+
+        // Returns the descriptor in a slot claimed since the last reset, or nullptr if there isn't one
+        [[nodiscard]] BufferDescriptor *get(uint32_t slot) const;
+
+        // Forgets every claimed slot
+        void reset() { m_count.store(0, std::memory_order_relaxed); }
+
+        [[nodiscard]] uint32_t size() const;
+
+        // Sum of the size of every buffer claimed since the last reset
+        [[nodiscard]] VkDeviceSize total_buffer_bytes() const;
+    };
+}
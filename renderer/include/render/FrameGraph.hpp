@@ -0,0 +1,208 @@
+/// \brief Per-frame graph of passes that works out the barriers between them
+#pragma once
+#include <volk.h>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "render/TransientImagePool.hpp"
+
+namespace MVRender {
+    // Which of the frame's command buffers a pass records into, also the order they are submitted in
+    enum FramePassQueue {
+        FRAME_PASS_COPY = 0,
+        FRAME_PASS_COMPUTE = 1,
+        FRAME_PASS_GRAPHICS = 2,
+        FRAME_PASS_QUEUE_COUNT = 3,
+    };
+
+    // Index of a buffer or image in the graph, only good until the graph is reset
+    typedef uint32_t FrameGraphResource;
+
+    // Index of a pass in the graph, in the order passes were added
+    typedef uint32_t FramePass;
+
+    // An image the graph tracks the layout of. Initial state is what the image is in before the frame,
+    // and if final_layout isn't undefined the image is moved to it at the end of the graphics commands.
+    struct FrameGraphImageInfo {
+        VkImage image;
+        VkImageSubresourceRange range;
+        VkImageLayout initial_layout;
+        VkPipelineStageFlags2 initial_stage; // the first barrier on the image waits on this, like the stage a semaphore it comes with is waited at
+        VkImageLayout final_layout;
+        bool output; // written contents are needed after the frame, passes that write it are never culled
+        const char *name;
+    };
+
+    // An image that only lives for part of the frame. The graph makes it when the frame is compiled and
+    // its memory can be reused by other transient images once its last pass is done, so it starts every
+    // pass that uses it first with undefined contents and nothing it holds outlives the frame.
+    struct FrameGraphTransientImageInfo {
+        VkFormat format;
+        uint32_t width;
+        uint32_t height;
+        uint32_t mip_levels; // 0 is the same as 1
+        uint32_t array_layers; // 0 is the same as 1
+        VkSampleCountFlagBits samples;
+        VkImageUsageFlags usage; // only attachment usages lets it be lazily allocated
+        VkImageAspectFlags aspect;
+        const char *name;
+    };
+
+    // One pass using one resource
+    struct FrameGraphAccess {
+        FrameGraphResource resource;
+        VkPipelineStageFlags2 stage;
+        VkAccessFlags2 access;
+        VkImageLayout layout; // only for images
+        bool write;
+    };
+
+    struct FrameGraphPass {
+        std::string name;
+        FramePassQueue queue;
+        std::function<void(VkCommandBuffer)> record;
+        std::vector<FrameGraphAccess> accesses;
+        bool side_effects; // never culled, for passes that do something the graph can't see
+    };
+
+    struct FrameGraphResourceInfo {
+        VkBuffer buffer; // null for images
+        VkImage image; // null for transient images until the graph is compiled
+        VkImageView view; // only for transient images
+        VkImageSubresourceRange range;
+        VkImageLayout initial_layout;
+        VkPipelineStageFlags2 initial_stage; // only for imported images
+        VkImageLayout final_layout;
+        bool output;
+        bool transient;
+        TransientImageDescription description; // only for transient images
+        const char *name;
+
+        [[nodiscard]] bool is_image() const { return buffer == VK_NULL_HANDLE; }
+    };
+
+    // Everything a batch of passes needs to wait on, merged into one vkCmdPipelineBarrier2
+    struct FrameGraphBarrier {
+        VkMemoryBarrier2 memory; // stage masks are zero if there is no buffer or same-layout hazard
+        std::vector<VkImageMemoryBarrier2> images;
+        std::vector<FrameGraphResource> image_resources; // which resource each of images is for
+        std::vector<VkBufferMemoryBarrier2> buffers; // only for queue family ownership transfers
+        std::vector<FrameGraphResource> buffer_resources; // which resource each of buffers is for
+
+        [[nodiscard]] bool empty() const { return memory.srcStageMask == 0 && memory.dstStageMask == 0 && images.empty() && buffers.empty(); }
+    };
+
+    // Passes in one command buffer that don't depend on each other, recorded back to back after one barrier
+    struct FrameGraphBatch {
+        FramePassQueue queue;
+        FrameGraphBarrier barrier;
+        std::vector<FramePass> passes;
+    };
+
+    // Where a resource is at as compile walks through the passes
+    struct FrameGraphResourceState;
+
+    // The frame's command buffers, with async compute the compute one goes to a different queue
+    struct FrameGraphCommands {
+        VkCommandBuffer copy_commands;
+        VkCommandBuffer compute_commands;
+        VkCommandBuffer draw_commands;
+    };
+
+    // Passes declare what they read and write as they're added, in the order they should logically
+    // happen. compile() culls passes nothing needs, then gives each pass a level one past the passes
+    // it depends on in the same command buffer. Passes on the same level can overlap so they're
+    // recorded together, behind one barrier that covers all of them. Dependencies on passes in an
+    // earlier command buffer are covered by that batch's barrier too, or by the semaphores between
+    // queues with async compute, where only layout transitions are left to do. A pass can't depend
+    // on a pass in a command buffer that's submitted after its own.
+    //
+    // When the async compute queue is in a different queue family, resources that move between it and
+    // the graphics queue get their ownership transferred. The release goes at the end of the command
+    // buffer that had the resource, the acquire into the barrier before its first use on the other queue.
+    // Resources compute still owns at the end of the frame are handed back to graphics in the final
+    // barrier, so every frame starts with graphics owning everything.
+    //
+    // Imported buffers start out as written by the frame's uploads, which are recorded at the top
+    // of the copy commands, so anything reading one waits for them. Not thread-safe.
+    class FrameGraph {
+        std::vector<FrameGraphPass> m_passes;
+        std::vector<FrameGraphResourceInfo> m_resources;
+        std::unordered_map<VkBuffer, FrameGraphResource> m_buffer_resources;
+        std::unordered_map<VkImage, FrameGraphResource> m_image_resources;
+        std::vector<FrameGraphResource> m_transient_images;
+
+        // Filled in by compile
+        std::vector<bool> m_culled;
+        std::vector<FrameGraphBatch> m_batches;
+        FrameGraphBarrier m_final_barrier; // moves images to their final layouts at the end of the graphics commands
+        FrameGraphBarrier m_release_barriers[FRAME_PASS_QUEUE_COUNT]; // ownership releases at the end of each command buffer
+        bool m_compiled = false;
+
+        // Families of the queues the command buffers are submitted to, set once by the renderer
+        uint32_t m_graphics_family = VK_QUEUE_FAMILY_IGNORED;
+        uint32_t m_compute_family = VK_QUEUE_FAMILY_IGNORED;
+
+        void add_access(FramePass pass, FrameGraphResource resource, VkPipelineStageFlags2 stage, VkAccessFlags2 access, VkImageLayout layout, bool write);
+
+        [[nodiscard]] uint32_t queue_family(FramePassQueue queue) const { return queue == FRAME_PASS_COMPUTE ? m_compute_family : m_graphics_family; }
+
+        // Adds a release to from's command buffer and the matching acquire to acquire, the release's stages
+        // are filled in at the end of compile once everything from's queue did with the resource is known
+        void transfer_ownership(FrameGraphBarrier &acquire, FrameGraphResource resource, FramePassQueue from, FramePassQueue to, VkImageLayout old_layout, VkImageLayout new_layout,
+                                VkPipelineStageFlags2 src_stage, VkAccessFlags2 src_access, VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access);
+
+        // Marks every pass whose results aren't needed, working backwards from passes that are
+        void cull_passes();
+
+        // Gets memory for every transient image a batch uses and points the barriers at the images
+        void place_transient_images(TransientImagePool &transient_pool, bool async_compute, const std::vector<FrameGraphResourceState> &states);
+    public:
+        // Starts the graph over, handles from before are no good after this
+        void reset();
+
+        // Queue families ownership moves between with async compute, the graph doesn't transfer anything
+        // if they're the same
+        void set_queue_families(uint32_t graphics_family, uint32_t compute_family);
+
+        // Adds a buffer to the graph, importing the same buffer twice gives the same resource. Passes
+        // that write a buffer that's an output are never culled.
+        FrameGraphResource import_buffer(VkBuffer buffer, const char *name, bool output = true);
+
+        // Adds an image to the graph, importing the same image twice gives the same resource. Re-imports can
+        // give an image a final layout if it doesn't have one yet, but fail if they ask for a different one.
+        FrameGraphResource import_image(const FrameGraphImageInfo &info);
+
+        // Adds an image that's made for this frame, it only has a handle once the graph is compiled. Fails if
+        // the image has no width, height or usage.
+        FrameGraphResource create_image(const FrameGraphTransientImageInfo &info);
+
+        // Adds a pass that records into queue's command buffer with record
+        FramePass add_pass(const char *name, FramePassQueue queue, std::function<void(VkCommandBuffer)> record);
+
+        // Declares what a pass does with a resource, layout is ignored for buffers
+        void read(FramePass pass, FrameGraphResource resource, VkPipelineStageFlags2 stage, VkAccessFlags2 access, VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED);
+        void write(FramePass pass, FrameGraphResource resource, VkPipelineStageFlags2 stage, VkAccessFlags2 access, VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED);
+
+        // Keeps a pass from ever being culled
+        void set_side_effects(FramePass pass);
+
+        // Culls, orders and works out barriers, can fail if a pass depends on a later command buffer. Graphs
+        // with transient images need a pool that the GPU is done with to put them in.
+        void compile(bool async_compute, TransientImagePool *transient_pool = nullptr);
+
+        // Records every batch into the command buffers, compile has to have been called
+        void execute(const FrameGraphCommands &commands);
+
+        [[nodiscard]] const std::vector<FrameGraphBatch> &batches() const { return m_batches; }
+        [[nodiscard]] const FrameGraphBarrier &final_barrier() const { return m_final_barrier; }
+        [[nodiscard]] const FrameGraphBarrier &release_barrier(FramePassQueue queue) const { return m_release_barriers[queue]; }
+        [[nodiscard]] bool is_culled(FramePass pass) const { return m_culled.at(pass); }
+        [[nodiscard]] size_t pass_count() const { return m_passes.size(); }
+
+        // Handles of an image, for transient images these are only good from compile until the graph is reset
+        [[nodiscard]] VkImage image(FrameGraphResource resource) const { return m_resources.at(resource).image; }
+        [[nodiscard]] VkImageView image_view(FrameGraphResource resource) const { return m_resources.at(resource).view; }
+    };
+}
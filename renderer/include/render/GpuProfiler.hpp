@@ -0,0 +1,105 @@
+/// \brief Timestamp queries around a frame's command buffers and the user's GPU zones
+#pragma once
+#include <volk.h>
+#include <vector>
+#include "render/Structs.h"
+
+namespace MVRender {
+    struct GpuProfilerCreateInfo {
+        VkDevice logical_device;
+        uint32_t graphics_valid_bits; // timestampValidBits of the graphics family, 0 turns the profiler off
+        uint32_t compute_valid_bits; // same for the family compute_commands is submitted on
+        float timestamp_period; // nanoseconds per tick
+        uint32_t frame_in_flight_index; // for debug names
+    };
+
+    // A user zone, its begin stamp is at query and its end stamp right after
+    struct GpuZoneQueries {
+        char name[MVR_GPU_ZONE_NAME_LENGTH];
+        uint32_t depth; // worked out as the stamps are written
+        uint32_t query;
+    };
+
+    // A zone's begin or end stamp waiting for the secondaries around it to be executed
+    struct GpuZoneStamp {
+        uint64_t position; // see GpuProfiler::secondary_position
+        uint32_t zone; // index into the zones
+        bool begin;
+    };
+
+    // A zone pushed in the order of pushes and pops, which may not be the order its stamps end up in
+    struct GpuOpenZone {
+        uint32_t zone; // UINT32_MAX for zones that didn't fit
+        uint32_t order;
+    };
+
+    // One frame in flight's timestamp query pool. The first six queries are begin and end stamps of the
+    // copy, compute and draw command buffers, user zones take two each after that. The pool is reset at
+    // the start of the frame's copy commands, and the stamps are read back without waiting when the
+    // frame comes back around, by which point the timeline says the GPU is done with them.
+    //
+    // User work only goes into the draw commands when the secondaries are executed at the end of the
+    // frame, so zones are pushed and popped at a secondary order instead of at a point in a command
+    // buffer. A zone pushed at order a and popped at order b is stamped around every secondary from a to b.
+    class GpuProfiler {
+        VkDevice m_logical_device;
+        VkQueryPool m_pool = VK_NULL_HANDLE; // null if the graphics queue can't write timestamps
+        uint64_t m_graphics_mask;
+        uint64_t m_compute_mask; // 0 if the compute queue can't write timestamps
+        double m_period; // milliseconds per tick
+
+        // What the pool holds, m_frame is 0 if nothing has been recorded since the last resolve
+        uint64_t m_frame = 0;
+        bool m_taking_zones = false; // from begin_frame until close_zones
+        std::vector<GpuZoneQueries> m_zones;
+        std::vector<GpuOpenZone> m_open_zones;
+        uint32_t m_dropped_zones = 0;
+
+        // Stamps not written yet, sorted by position once close_zones is called
+        std::vector<GpuZoneStamp> m_stamps;
+        size_t m_next_stamp = 0;
+        uint32_t m_stamp_depth = 0; // zones whose begin stamp is written and end stamp isn't
+
+        // Ticks between two stamps, stamps wrap around at the queue's valid bits
+        [[nodiscard]] double elapsed(uint64_t begin, uint64_t end, uint64_t mask) const;
+    public:
+        explicit GpuProfiler(GpuProfilerCreateInfo &create_info);
+        ~GpuProfiler();
+
+        GpuProfiler(GpuProfiler const&)     = delete;
+        void operator=(GpuProfiler const&)  = delete;
+
+        // Reads the stamps of the last frame recorded into stats without waiting. Returns false if there was
+        // nothing to read or the GPU isn't done with it, stats is left alone then.
+        bool resolve(MVR_GpuFrameStats *stats);
+
+        // Resets the pool and writes the begin stamps, the command buffers must have just begun
+        void begin_frame(uint64_t frame, VkCommandBuffer copy_commands, VkCommandBuffer compute_commands, VkCommandBuffer draw_commands);
+
+        // Writes the end stamps, right before the command buffers end
+        void end_frame(VkCommandBuffer copy_commands, VkCommandBuffer compute_commands, VkCommandBuffer draw_commands);
+
+        // Opens a zone that starts before the secondaries of order, nested in whatever zone is open. Zones
+        // past MVR_MAX_GPU_ZONES are counted as dropped but still have to be popped. Can fail if the frame
+        // isn't taking zones.
+        void push_zone(const char *name, uint32_t order);
+
+        // Closes the last zone opened after the secondaries of order. Can fail if there isn't a zone open, or
+        // order is lower than the one the zone was pushed at.
+        void pop_zone(uint32_t order);
+
+        // Closes zones that were left open after every secondary, no more can be pushed until the next frame
+        void close_zones();
+
+        // Where stamps go relative to the secondaries of order, begin stamps go before them and end stamps after
+        static uint64_t secondary_position(uint32_t order) { return (static_cast<uint64_t>(order) << 2) | 1; }
+
+        // Whether any stamps are left to write before position, close_zones has to have been called
+        [[nodiscard]] bool has_stamps_before(uint64_t position) const;
+
+        // Writes every stamp left before position into commands
+        void write_stamps(VkCommandBuffer commands, uint64_t position);
+
+        [[nodiscard]] bool supported() const { return m_pool != VK_NULL_HANDLE; }
+    };
+}
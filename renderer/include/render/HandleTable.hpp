@@ -0,0 +1,88 @@
+/// \brief Generational slot map that hands out 64-bit handles to stored values
+#pragma once
+#include <cinttypes>
+#include <deque>
+#include <vector>
+
+namespace MVRender {
+    // Handles are the slot's generation in bits 32-62 and the slot index in the low 32 bits, bit 63
+    // is always clear so they can't be mistaken for temp buffer handles. Generations start at 1 so
+    // a zeroed handle is never valid.
+    constexpr uint64_t HANDLE_GENERATION_MASK = 0x7FFFFFFF;
+
+    // Stores values in slots that are reused through a free list, create, destroy and lookup are
+    // all O(1). Every time a slot is freed its generation goes up, so handles to whatever used to
+    // be there stop resolving instead of pointing at something else. Slots live in a deque so a
+    // pointer to a value stays good until that value is removed. Not thread-safe.
+    template <typename T>
+    class HandleTable {
+        struct Slot {
+            T value;
+            uint32_t generation;
+            bool occupied;
+        };
+        std::deque<Slot> m_slots;
+        std::vector<uint32_t> m_free_slots;
+        size_t m_count = 0;
+
+        static uint64_t make_handle(uint32_t index, uint32_t generation) {
+            return (static_cast<uint64_t>(generation) << 32) | index;
+        }
+    public:
+        // Puts a default value in a free slot and returns its handle, value is pointed at it
+        uint64_t insert(T **value) {
+            uint32_t index;
+            if (!m_free_slots.empty()) {
+                index = m_free_slots.back();
+                m_free_slots.pop_back();
+            } else {
+                index = static_cast<uint32_t>(m_slots.size());
+                m_slots.push_back({.value = T(), .generation = 1, .occupied = false});
+            }
+            Slot &slot = m_slots[index];
+            slot.value = T();
+            slot.occupied = true;
+            m_count += 1;
+            *value = &slot.value;
+            return make_handle(index, slot.generation);
+        }
+
+        // Returns the value behind a handle, or nullptr if the handle was never valid or its value was removed
+        T *get(uint64_t handle) {
+            const uint64_t index = handle & 0xFFFFFFFF;
+            if (index >= m_slots.size()) {
+                return nullptr;
+            }
+            Slot &slot = m_slots[index];
+            if (!slot.occupied || slot.generation != (handle >> 32)) {
+                return nullptr;
+            }
+            return &slot.value;
+        }
+
+        // Frees a handle's slot, returns false if the handle was already stale
+        bool remove(uint64_t handle) {
+            if (get(handle) == nullptr) {
+                return false;
+            }
+            const auto index = static_cast<uint32_t>(handle & 0xFFFFFFFF);
+            Slot &slot = m_slots[index];
+            slot.occupied = false;
+            slot.generation = slot.generation == HANDLE_GENERATION_MASK ? 1 : slot.generation + 1;
+            m_free_slots.push_back(index);
+            m_count -= 1;
+            return true;
+        }
+
+        // Removes every value, handles to them stay stale
+        void clear() {
+            for (uint32_t i = 0; i < m_slots.size(); i++) {
+                if (m_slots[i].occupied) {
+                    remove(make_handle(i, m_slots[i].generation));
+                }
+            }
+        }
+
+        [[nodiscard]] size_t size() const { return m_count; }
+    };
+}
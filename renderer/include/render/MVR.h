@@ -3,3 +3,5 @@
 
 #include "render/Core.h"
 #include "render/Buffers.h"
+#include "render/Readback.h"
+#include "render/Stats.h"
@@ -0,0 +1,114 @@
+/// \brief Pool of temporary buffer pages shared by every frame in flight
+#pragma once
+#include <volk.h>
+#include <vk_mem_alloc.h>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "render/Structs.h"
+
+namespace MVRender {
+    struct PagePoolCreateInfo {
+        VmaAllocator allocator;
+        VkDeviceSize page_size;
+        uint32_t queue_family_index;
+        uint32_t trim_frames; // pages that sit unused in the pool for this many frames are freed
+    };
+
+    // Pages that temporary buffers are allocated out of
+    struct BufferPage {
+        VkBuffer vram_buffer; // actual vulkan device memory
+        VmaAllocation vram_allocation;
+        VkBuffer staging_buffer; // staging buffer that will be copied to vram, null for direct pages
+        VmaAllocation staging_allocation;
+        std::atomic<VkDeviceSize> offset; // current offset for new writes, threads bump this to claim chunks
+        VkDeviceSize size; // size of this page
+        void *data; // persistently mapped data for the staging buffer, or the vram buffer itself for direct pages
+        bool direct; // vram buffer is host-visible and persistently mapped, so there is nothing to copy
+        bool coherent; // host writes are visible without a flush
+        uint64_t last_used_frame; // frame this page was given back to the pool
+        uint32_t size_class; // page is page_size << size_class bytes
+        MVR_BufferUsage usage; // what the page's buffers can be used for
+    };
+
+    // Snapshot of the pool's bookkeeping
+    struct PagePoolStats {
+        size_t page_count; // every page, borrowed or idle
+        VkDeviceSize page_bytes;
+        VkDeviceSize high_water_mark; // most bytes a single frame has used
+        VkDeviceSize last_frame_bytes; // bytes the last finished frame used
+        VkDeviceSize last_frame_waste; // bytes the last finished frame used for padding and chunk slack
+    };
+
+    // Owns every temporary page. Each frame's BufferAllocator borrows pages from here when
+    // it runs out and gives back the ones it stopped using, so a spike in one frame can be
+    // served by pages another frame no longer needs. Pages that stay unused for trim_frames
+    // are handed back to VMA. Pages come in power-of-two multiples of the base page size and
+    // idle pages are binned by usage and size class, so finding one is O(1).
+    class PagePool {
+        // Pages not currently owned by any allocator, indexed by usage then size class
+        std::array<std::vector<std::vector<std::unique_ptr<BufferPage>>>, MVR_BUFFER_USAGE_COUNT> m_free_bins;
+        std::mutex m_mutex;
+
+        VmaAllocator m_vma;
+        VkDeviceSize m_page_size;
+        uint32_t m_queue_family_index;
+        uint32_t m_trim_frames;
+
+        // Whether the device has memory that is both device-local and host-visible (UMA/ReBAR)
+        bool m_direct_write = false;
+
+        // Last frame the pool was told about
+        uint64_t m_frame = 0;
+
+        // Bookkeeping for every page in existence, borrowed or not
+        uint32_t m_created_pages = 0;
+        size_t m_page_count = 0;
+        VkDeviceSize m_page_bytes = 0;
+
+        // Most bytes a single frame has used
+        VkDeviceSize m_high_water_mark = 0;
+
+        // What the last finished frame did with its pages
+        VkDeviceSize m_last_frame_bytes = 0;
+        VkDeviceSize m_last_frame_waste = 0;
+
+        // Smallest size class that fits size bytes
+        [[nodiscard]] uint32_t size_class(VkDeviceSize size) const;
+
+        // Creates a page that is written straight into vram, can fail
+        std::unique_ptr<BufferPage> create_direct_page(MVR_BufferUsage usage, VkDeviceSize size);
+
+        // Creates a page with a staging buffer and a device buffer, can fail
+        std::unique_ptr<BufferPage> create_staged_page(MVR_BufferUsage usage, VkDeviceSize size);
+
+        void destroy_page(BufferPage &page);
+    public:
+        explicit PagePool(PagePoolCreateInfo &create_info);
+        ~PagePool();
+
+        PagePool(PagePool const&)        = delete;
+        void operator=(PagePool const&)  = delete;
+
+        // Borrows an idle page for usage of at least size bytes from its size class, or creates one if none are idle, can fail
+        std::unique_ptr<BufferPage> acquire(MVR_BufferUsage usage, VkDeviceSize size);
+
+        // Gives a page back to the pool, the GPU must be done with it
+        void release(std::unique_ptr<BufferPage> page);
+
+        // Records how many bytes of pages a frame used and how many of those were actually asked for
+        void record_frame_usage(VkDeviceSize used_bytes, VkDeviceSize requested_bytes);
+
+        // Frees pages that have been idle for too long, call once per frame
+        void trim(uint64_t frame);
+
+        [[nodiscard]] bool writes_directly() const { return m_direct_write; }
+        [[nodiscard]] VkDeviceSize base_page_size() const { return m_page_size; }
+        [[nodiscard]] size_t page_count();
+        [[nodiscard]] VkDeviceSize page_bytes();
+        [[nodiscard]] VkDeviceSize high_water_mark();
+        [[nodiscard]] PagePoolStats stats();
+    };
+}
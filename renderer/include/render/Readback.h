@@ -0,0 +1,30 @@
+/// \brief Reading buffer contents back from the GPU
+///
+/// Readbacks never stall. mvr_ReadBufferAsync records a copy at the very end of the current
+/// frame, after everything else the frame does, into host memory owned by the renderer. Once
+/// the GPU finishes that frame the data can be read straight out of that memory until the
+/// readback is released. Unreleased readbacks hold on to their memory, so release them as soon
+/// as you're done or new readbacks will fail with MVR_RESULT_OUT_OF_MEMORY.
+#pragma once
+#include "render/Structs.h"
+
+/// \brief Starts copying part of a buffer back to the CPU at the end of the frame
+/// \param params Buffer and range to read
+/// \param readback Pointer to a readback handle where the new readback will be placed
+/// \return Returns an MVR_Result status code, MVR_RESULT_OUT_OF_MEMORY if there are too many unreleased readbacks
+MVR_API MVR_Result mvr_ReadBufferAsync(MVR_ReadBufferAsyncParams *params, MVR_Readback *readback);
+
+/// \brief Checks if a readback's data has arrived
+/// \param readback Readback to check
+/// \return Returns true if the data can be read, false if it is still in flight or the handle is invalid
+MVR_API bool mvr_IsReadbackReady(MVR_Readback readback);
+
+/// \brief Gets a pointer to a finished readback's data
+/// \param readback Readback to get the data of
+/// \param data Will be given a pointer to the data, it stays valid until the readback is released
+/// \return Returns an MVR_Result status code, MVR_RESULT_NOT_READY if the GPU isn't done with the copy yet
+MVR_API MVR_Result mvr_GetReadbackData(MVR_Readback readback, const void **data);
+
+/// \brief Gives a readback's memory back to the renderer, the data pointer is no longer valid after this
+/// \param readback Readback to release, it is fine to release one that isn't ready yet
+MVR_API void mvr_ReleaseReadback(MVR_Readback readback);
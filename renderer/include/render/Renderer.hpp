@@ -4,9 +4,25 @@
 #include <volk.h>
 #include <VkBootstrap.h>
 #include <vk_mem_alloc.h>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cinttypes>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 #include "render/BufferAllocator.hpp"
+#include "render/CommandRecorder.hpp"
+#include "render/Constants.hpp"
+#include "render/DeletionQueue.hpp"
+#include "render/FrameGraph.hpp"
+#include "render/GpuProfiler.hpp"
+#include "render/HandleTable.hpp"
+#include "render/SharedBufferPool.hpp"
+#include "render/StagingRing.hpp"
 #include "render/Structs.h"
+#include "render/TransientImagePool.hpp"
 #include "render/VulkanFunctionPointers.hpp"
 
 namespace MVRender {
@@ -20,12 +36,48 @@ namespace MVRender {
         VkSemaphore submit_ready_semaphore;
     };
 
-    // Resources that are per frame-in-flight
+    // A piece of a permanent buffer upload or update sitting in the staging ring waiting to be recorded
+    struct PendingUpload {
+        VkDeviceSize staging_offset; // where the data is in the staging ring
+        VkBuffer buffer;
+        VkDeviceSize offset; // where the data goes in buffer
+        VkDeviceSize size;
+    };
+
+    // A copy out of a buffer into the readback ring, the data is the user's until they release it
+    struct Readback {
+        uint64_t region; // held region of the readback ring
+        VkDeviceSize offset; // where the data lands in the readback ring
+        VkDeviceSize size;
+        uint64_t ready_value; // timeline value the copy is done at
+    };
+
+    // A readback copy waiting to be recorded at the end of the frame
+    struct PendingReadback {
+        VkBuffer buffer;
+        VkDeviceSize buffer_offset;
+        VkDeviceSize readback_offset;
+        VkDeviceSize size;
+    };
+
+    // Resources that are per frame-in-flight, the command buffers all come from command_recorder
     struct FrameResources {
         VkCommandBuffer copy_commands;
-        VkCommandBuffer compute_commands;
+        VkCommandBuffer compute_commands; // from the compute queue's pool with async compute, buffers are still owned by the graphics family
         VkCommandBuffer draw_commands;
-        BufferAllocator buffer_allocator;
+        VkCommandBuffer transfer_commands; // same as copy_commands when there is no dedicated transfer queue
+        std::unique_ptr<CommandRecorder> command_recorder;
+        std::unique_ptr<BufferAllocator> buffer_allocator;
+        std::unique_ptr<GpuProfiler> gpu_profiler;
+        std::unique_ptr<TransientImagePool> transient_images; // the frame graph's transient images for this frame
+    };
+
+    // A frame's timings in the making, the timing is only handed out once the GPU is done with the frame
+    struct FrameTimingRecord {
+        MVR_FrameTiming timing; // timing.frame is the timeline value the frame signals, 0 for unused slots
+        std::chrono::steady_clock::time_point record_start; // end of begin_frame
+        std::chrono::steady_clock::time_point submit_time;
+        bool complete;
     };
 
     // Information about the surface
@@ -48,7 +100,9 @@ namespace MVRender {
 
         // Top-level things
         MVR_InitializeParams m_initialize_params;
+        bool m_headless = false; // no surface or swapchain, frames only run the copy/compute/draw submission
         bool m_debug_names_enabled;
+        std::atomic<uint32_t> m_validation_errors = 0; // counted by the debug messenger, can come from any thread
         VulkanFunctionPointers m_fp;
 
         // Internal vulkan state
@@ -59,17 +113,67 @@ namespace MVRender {
         VkPhysicalDeviceProperties m_vk_physical_device_properties;
         VkDevice m_vk_logical_device;
         VkQueue m_vk_queue; // this is a graphics/compute queue
+        VkQueue m_vk_transfer_queue; // dedicated transfer queue if the device has one, otherwise m_vk_queue
+        VkQueue m_vk_compute_queue; // async compute queue if the device has one, otherwise m_vk_queue
         VkSwapchainKHR m_vk_swapchain;
-        VkCommandPool m_command_pool;
+        VkCommandPool m_command_pool; // single-use command buffers, each frame has its own pools
+        VkCommandPool m_transfer_command_pool; // null without a dedicated transfer queue
         uint32_t m_queue_family_index;
+        uint32_t m_transfer_queue_family_index;
+        uint32_t m_compute_queue_family_index;
+        bool m_dedicated_transfer = false;
+        bool m_async_compute = false;
         uint32_t m_current_sc_image;
+        bool m_image_acquired = false; // false for frames that have nothing to present, like while minimized
+        bool m_swapchain_dirty = false; // the swapchain gets rebuilt at the start of the next frame
 
         // Synchronization
         uint32_t m_swapchain_image_count;
         uint64_t m_frame_count = 5; // for timeline semaphores
+        uint32_t m_frames_in_flight = FRAMES_IN_FLIGHT; // size of m_frame_res
+        uint32_t m_requested_frames_in_flight = FRAMES_IN_FLIGHT; // applied at the start of the next frame
         std::vector<SwapchainResources> m_swapchain_res;
         std::vector<FrameResources> m_frame_res;
         VkSemaphore m_timeline_semaphore;
+        VkSemaphore m_transfer_semaphore; // timeline, signaled by the transfer queue with the frame's value
+        VkSemaphore m_copy_semaphore; // timeline, signaled once the frame's graphics queue copies are done, only used with async compute
+        VkSemaphore m_compute_semaphore; // timeline, signaled by the compute queue with the frame's value
+        VkFence m_single_use_fence; // single-use command buffers wait on this instead of the whole queue
+
+        // Permanent buffer uploads that get recorded at the end of the current frame
+        std::vector<PendingUpload> m_pending_uploads;
+        uint64_t m_upload_flush_count = 0; // goes up whenever the pending uploads are flushed mid-frame
+
+        // Updates to existing permanent buffers, by handle then offset. Ranges of one handle never overlap.
+        std::unordered_map<MVR_Buffer, std::map<VkDeviceSize, PendingUpload>> m_pending_updates;
+
+        // Passes for the current frame, compiled and recorded in end_frame
+        FrameGraph m_frame_graph;
+        FrameGraphResource m_swapchain_resource = 0; // imported right after it's acquired, only good if m_image_acquired
+
+        // Buffer readbacks, the copies get recorded at the very end of the frame
+        HandleTable<Readback> m_readbacks;
+        std::vector<PendingReadback> m_pending_readbacks;
+
+        // Frame pacing since frames in flight last changed, times are in milliseconds
+        std::chrono::steady_clock::time_point m_last_frame_start; // zeroed until a frame has started
+        uint64_t m_timed_frames = 0;
+        double m_total_frame_time = 0;
+        double m_total_wait_time = 0;
+        double m_last_frame_time = 0;
+        double m_last_wait_time = 0;
+
+        // Per-frame timings by timeline value, and the oldest frame the GPU hasn't been seen finishing yet
+        std::array<FrameTimingRecord, FRAME_TIMING_HISTORY> m_frame_timings = {};
+        uint64_t m_unfinished_timing = 0;
+        std::chrono::steady_clock::time_point m_last_present_time; // zeroed if the last frame didn't present
+
+        // Timestamps of the newest frame the GPU has finished
+        MVR_GpuFrameStats m_gpu_frame_stats = {};
+
+        // Frame rate limiter, a zero period means no limit
+        std::chrono::steady_clock::duration m_frame_period = {};
+        std::chrono::steady_clock::time_point m_next_frame_time;
 
         // vk-bootstrap state
         vkb::Instance m_vkb_instance;
@@ -77,33 +181,94 @@ namespace MVRender {
 
         // Memory
         VmaAllocator m_vma;
+        bool m_memory_budget_enabled = false;
+        std::unique_ptr<PagePool> m_page_pool; // temp pages shared by every frame in flight
+        std::unique_ptr<StagingRing> m_staging_ring; // permanent buffer uploads are copied out of this
+        std::unique_ptr<StagingRing> m_readback_ring; // readbacks are copied into this
+        std::unique_ptr<SharedBufferPool> m_shared_buffers; // small permanent buffers live in here
+        DeletionQueue m_deletion_queue; // resources wait here until no frame in flight can be using them
 
         // Permanent buffers
-        std::vector<BufferDescriptor> m_permanent_buffers;
-        std::vector<bool> m_permanent_buffer_occupied;
+        HandleTable<BufferDescriptor> m_permanent_buffers;
+        uint64_t m_permanent_buffer_bytes = 0;
 
         // Internal subsystems
         void build_surface_format();
 
-        void initialize_swapchain();
+        void initialize_swapchain(VkSwapchainKHR old_swapchain = VK_NULL_HANDLE);
         void quit_swapchain();
 
+        // Builds a new swapchain from the old one without waiting on the GPU, the old one and its resources
+        // are destroyed once the frames using them are done. Returns false if the window has no area right now.
+        bool recreate_swapchain();
+
+        // Acquires the next swapchain image, rebuilding the swapchain first if it has to be
+        void acquire_swapchain_image();
+
         void initialize_sync();
         void quit_sync();
 
+        // Throws on params that can't work, before anything is created so nothing is left half made
+        static void validate_initialize_params(const MVR_InitializeParams &params);
+
         void initialize_frame_resources();
         void quit_frame_resources();
+        void create_frame_resources(uint32_t index); // appends to m_frame_res
+        void destroy_frame_resources(FrameResources &frame);
+
+        // Resizes m_frame_res to the requested frames in flight, waits for the GPU to finish everything first
+        void apply_frames_in_flight();
+
+        // Executes the frame's secondaries into its draw commands in order, with the GPU zone stamps between them
+        void execute_secondaries(FrameResources &frame);
+
+        // Adds a frame to the pacing stats, called once per frame around the timeline wait
+        void record_frame_timing(std::chrono::steady_clock::time_point wait_start, std::chrono::steady_clock::time_point wait_end);
+        void reset_frame_timing();
+
+        // Fills in how long the GPU took for frames the timeline says are done
+        void finish_frame_timings(uint64_t completed_value, std::chrono::steady_clock::time_point now);
+
+        // Sleeps until the frame rate limit allows another frame, returns how long it slept
+        std::chrono::steady_clock::duration limit_frame_rate();
 
         void initialize_vma();
         void quit_vma();
 
         void initialize_function_pointers();
 
-        // Returns an empty buffer descriptor stored permanently in the renderer
-        BufferDescriptor *get_buffer_descriptor();
+        // Records every pending upload, the staging ring gets its space back once the commands are done
+        void record_pending_uploads(const CopyCommandsInfo &info);
 
-        // Invalidates the descriptor, does not free the contents
-        void remove_buffer_descriptor(BufferDescriptor *descriptor);
+        // Records every pending update into commands, which must be on the graphics queue
+        void record_pending_updates(VkCommandBuffer commands);
+
+        // Records every pending readback into commands, which must be on the graphics queue after the rest of the frame
+        void record_pending_readbacks(VkCommandBuffer commands);
+
+        // Blocks until the frame timeline reaches value
+        void wait_for_timeline(uint64_t value);
+
+        // Submits the frame's graphics queue copies then its compute work on the async compute queue
+        void submit_async_compute(FrameResources *frame);
+
+        // Submits every pending upload and update right away and waits for it, for when the staging ring fills up mid-frame
+        void flush_pending_uploads();
+
+        // Largest piece of an upload or update that goes through the staging ring at once
+        [[nodiscard]] VkDeviceSize staging_piece_size() const;
+
+        // Claims size bytes of the staging ring, waiting on the GPU if it is full, can fail if it would never fit
+        VkDeviceSize claim_staging_space(VkDeviceSize size);
+
+        // Copies data into the staging ring and queues the copies into buffer at offset, in pieces if it is big, can fail
+        void stage_upload(VkBuffer buffer, VkDeviceSize offset, const void *data, VkDeviceSize size);
+
+        // Forgets unrecorded uploads into a range of a buffer, their staging space comes back with the rest of the frame's
+        void drop_pending_uploads(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size);
+
+        // Stages an update of at most staging_piece_size bytes, merging it with the handle's other pending updates it overlaps or touches
+        void queue_update(MVR_Buffer handle, const BufferDescriptor &descriptor, VkDeviceSize offset, const void *data, VkDeviceSize size);
 
     public:
         // Singleton pattern - the class is destroyed at program end
@@ -121,13 +286,21 @@ namespace MVRender {
         // Top-level destruction method
         void quit_vulkan();
 
-        // This is the same as above but for debug purposes, so uses sensible defaults
+        // This is the same as above but for debug purposes, so uses sensible defaults. Quitting fails if the
+        // validation layers reported any errors, so tests can't pass with them.
         void initialize_vulkan_headless();
         void quit_vulkan_headless();
 
         // Util
         [[nodiscard]] VkPresentModeKHR get_present_mode(MVR_PresentMode present_mode) const; // accounts for available present modes
+        [[nodiscard]] bool has_async_compute() const { return m_async_compute; }
         BufferAllocator &get_buffer_allocator(); // for current frame
+        PagePool &get_page_pool();
+        StagingRing &get_staging_ring();
+        SharedBufferPool &get_shared_buffer_pool();
+        DeletionQueue &get_deletion_queue();
+        FrameGraph &get_frame_graph(); // for current frame
+        FrameGraphResource get_swapchain_resource(); // the acquired swapchain image in the current frame's graph, can fail
 
         // Internal
         void initialize_instance(bool headless = false); // also creates the device and surface
@@ -136,15 +309,65 @@ namespace MVRender {
         void begin_frame();
         void end_frame();
 
-        // Gets a new single-use command buffer
-        VkCommandBuffer get_single_use_command_buffer();
+        // Gets a secondary command buffer for the calling thread that's ready to record into, thread-safe and can
+        // fail. Every secondary is executed at the start of the frame's draw commands in end_frame, lowest order
+        // first, and must not be touched after that.
+        VkCommandBuffer begin_secondary_commands(uint32_t order);
+
+        // Gets a new single-use command buffer, for the transfer queue if transfer is true
+        VkCommandBuffer get_single_use_command_buffer(bool transfer = false);
 
         // Submits and waits for a single-use command buffer to finish
-        void submit_single_use_command_buffer(VkCommandBuffer buffer);
+        void submit_single_use_command_buffer(VkCommandBuffer buffer, bool transfer = false);
+
+        // Turns any buffer handle into its descriptor, can fail if the handle is invalid
+        BufferDescriptor *resolve_buffer(MVR_Buffer buffer);
+
+        // Fills out memory stats for the C api
+        void get_memory_stats(MVR_MemoryStats *stats);
+
+        // Fills out frame pacing stats for the C api
+        void get_frame_stats(MVR_FrameStats *stats);
+
+        // Changes the present mode at the start of the next frame, can fail if present_mode isn't valid
+        void set_present_mode(MVR_PresentMode present_mode);
+
+        // Copies up to max_count of the newest finished frame timings into timings, oldest first
+        uint32_t get_frame_timings(MVR_FrameTiming *timings, uint32_t max_count);
+
+        // GPU timestamp zones around the current frame's secondaries from one order to another, see GpuProfiler
+        void push_gpu_zone(const char *name, uint32_t order); // can fail if name is null or no frame is open
+        void pop_gpu_zone(uint32_t order); // can fail if no zone is open or order is before the push
+
+        // Copies out the timestamps of the newest frame the GPU has finished
+        void get_gpu_frame_stats(MVR_GpuFrameStats *stats);
+
+        // Caps the frame rate, 0 turns the limit off, can fail if frames_per_second is negative, not finite or
+        // slower than one frame per MAX_FRAME_PERIOD
+        void set_frame_rate_limit(double frames_per_second);
+
+        // Changes frames in flight at the start of the next frame, can fail if count is out of range
+        void set_frames_in_flight(uint32_t count);
+        [[nodiscard]] uint32_t get_frames_in_flight() const { return m_frames_in_flight; }
+
+        // True once the GPU can use a buffer, temp buffers are always ready
+        bool is_buffer_ready(MVR_Buffer buffer);
 
         // Create and free permanent buffers
-        BufferDescriptor *load_permanent_buffer(uint64_t size, void *data);
-        void free_permanent_buffer(BufferDescriptor *buffer);
+        MVR_Buffer load_permanent_buffer(uint64_t size, void *data);
+        void free_permanent_buffer(MVR_Buffer buffer); // can fail if the handle is stale, the memory is freed once the GPU is done with it
+
+        // Writes data over part of a permanent buffer at the end of the frame, can fail
+        void update_permanent_buffer(MVR_Buffer buffer, VkDeviceSize offset, VkDeviceSize size, const void *data);
+
+        // Number of separate update ranges waiting for the end of the frame, after merging
+        [[nodiscard]] size_t pending_update_count() const;
+
+        // Buffer readbacks, see Readback.h
+        MVR_Readback read_buffer_async(MVR_Buffer buffer, VkDeviceSize offset, VkDeviceSize size); // can fail
+        bool is_readback_ready(MVR_Readback readback);
+        const void *get_readback_data(MVR_Readback readback); // can fail if the readback isn't ready
+        void release_readback(MVR_Readback readback); // can fail if the handle is stale
 
         // Give resources names, this does nothing if debug is disabled or the extension is not
         // present on the host machine.
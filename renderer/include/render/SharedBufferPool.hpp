@@ -0,0 +1,71 @@
+/// \brief Large device buffers that small permanent buffers are packed into
+#pragma once
+#include <volk.h>
+#include <vk_mem_alloc.h>
+#include <vector>
+
+namespace MVRender {
+    struct SharedBufferPoolCreateInfo {
+        VmaAllocator allocator;
+        VkDeviceSize block_size;
+        VkDeviceSize threshold; // buffers this size or smaller go in a block
+        VkPhysicalDeviceProperties device_properties;
+        uint32_t queue_family_index;
+    };
+
+    // One big device buffer with a VMA virtual block keeping track of what parts are taken
+    struct SharedBufferBlock {
+        VkBuffer buffer;
+        VmaAllocation allocation;
+        VmaVirtualBlock virtual_block;
+        VkDeviceSize size;
+        uint32_t allocation_count;
+    };
+
+    // Where a small permanent buffer ended up
+    struct SharedBufferRange {
+        VkBuffer buffer;
+        VkDeviceSize offset;
+        VmaVirtualAllocation virtual_allocation;
+    };
+
+    // Packs small permanent buffers into shared device buffers so ten thousand meshes don't
+    // need ten thousand VkBuffers and allocations, and so draws can batch across meshes in the
+    // same block. Blocks are kept until the pool is destroyed, even when empty, so loading and
+    // unloading assets doesn't churn allocations. Not thread-safe, like the rest of permanent buffers.
+    class SharedBufferPool {
+        std::vector<SharedBufferBlock> m_blocks;
+
+        VmaAllocator m_vma;
+        VkDeviceSize m_block_size;
+        VkDeviceSize m_threshold;
+        VkDeviceSize m_alignment; // offsets are legal for every usage permanent buffers have
+        uint32_t m_queue_family_index;
+
+        // Creates a new empty block, can fail
+        SharedBufferBlock &create_block();
+
+        void destroy_block(SharedBufferBlock &block);
+    public:
+        explicit SharedBufferPool(SharedBufferPoolCreateInfo &create_info);
+        ~SharedBufferPool();
+
+        SharedBufferPool(SharedBufferPool const&)  = delete;
+        void operator=(SharedBufferPool const&)    = delete;
+
+        // True if a buffer of size bytes should be packed into a block
+        [[nodiscard]] bool fits(VkDeviceSize size) const { return size <= m_threshold; }
+
+        // Finds size bytes in a block, creating a new block if they are all full, can fail
+        SharedBufferRange allocate(VkDeviceSize size);
+
+        // Gives a range back to its block, the GPU must be done with it
+        void free(const SharedBufferRange &range);
+
+        // Changes the size cutoff, 0 turns packing off
+        void set_threshold(VkDeviceSize threshold) { m_threshold = threshold; }
+
+        [[nodiscard]] size_t block_count() const { return m_blocks.size(); }
+        [[nodiscard]] VkDeviceSize block_bytes() const;
+    };
+}
@@ -0,0 +1,77 @@
+/// \brief Persistent staging memory that uploads are streamed through and readbacks land in
+#pragma once
+#include <volk.h>
+#include <vk_mem_alloc.h>
+#include <deque>
+
+namespace MVRender {
+    struct StagingRingCreateInfo {
+        VmaAllocator allocator;
+        VkDeviceSize size;
+        uint32_t queue_family_index;
+        bool readback; // the GPU copies into the ring and the host reads it, so it wants host-cached memory
+    };
+
+    // A piece of the ring handed out to an upload or readback. Regions are kept in the order they were
+    // handed out, which is also the order the GPU finishes with them.
+    struct StagingRegion {
+        VkDeviceSize end; // one past the last byte of the region
+        VkDeviceSize size; // bytes the region takes up, including padding skipped at the end of the ring
+        uint64_t timeline_value; // value the copies using this region finish at, 0 until submitted
+        bool held; // readback regions stay put until released, even after the GPU is done
+    };
+
+    // One persistently mapped host-visible buffer that uploads or readbacks sub-allocate out of in
+    // FIFO order. Regions get the timeline value of the submission their copies went out with, and
+    // once the timeline passes that value the space is reused. Held regions also have to be released
+    // first, and block everything behind them until they are. Nothing is allocated after creation.
+    class StagingRing {
+        std::deque<StagingRegion> m_regions;
+        size_t m_unsubmitted = 0; // regions at the back that have no timeline value yet
+        uint64_t m_first_region = 0; // id of the region at the front, ids count up from there
+
+        VkDeviceSize m_size;
+        VkDeviceSize m_head = 0; // next byte to hand out
+        VkDeviceSize m_tail = 0; // first byte still in use
+        VkDeviceSize m_used = 0;
+
+        VmaAllocator m_vma;
+        VkBuffer m_buffer;
+        VmaAllocation m_allocation;
+        void *m_data;
+        bool m_coherent;
+    public:
+        explicit StagingRing(StagingRingCreateInfo &create_info);
+        ~StagingRing();
+
+        StagingRing(StagingRing const&)     = delete;
+        void operator=(StagingRing const&)  = delete;
+
+        // Claims size bytes, returns false instead of blocking if the ring is too full right now. If
+        // region is given the space is held until it is passed to release.
+        bool try_allocate(VkDeviceSize size, VkDeviceSize *offset, uint64_t *region = nullptr);
+
+        // Lets a held region be reclaimed once the GPU is done with it
+        void release(uint64_t region);
+
+        // Makes host writes to a range visible to the device, does nothing on coherent memory
+        void flush(VkDeviceSize offset, VkDeviceSize size);
+
+        // Makes device writes to a range visible to the host, does nothing on coherent memory
+        void invalidate(VkDeviceSize offset, VkDeviceSize size);
+
+        // Tags every region handed out since the last submit with the value their copies finish at
+        void submit(uint64_t timeline_value);
+
+        // Frees regions the GPU is done with
+        void reclaim(uint64_t completed_value);
+
+        // Timeline value the oldest region is waiting on, 0 if the ring is empty or the oldest region is unsubmitted or held
+        [[nodiscard]] uint64_t oldest_value() const;
+
+        [[nodiscard]] VkBuffer buffer() const { return m_buffer; }
+        [[nodiscard]] void *data(VkDeviceSize offset) const { return static_cast<char *>(m_data) + offset; }
+        [[nodiscard]] VkDeviceSize capacity() const { return m_size; }
+        [[nodiscard]] VkDeviceSize used() const { return m_used; }
+    };
+}
@@ -0,0 +1,70 @@
+/// \brief Instrumentation for keeping an eye on what the renderer is doing
+#pragma once
+#include "render/Structs.h"
+
+/// \brief Fills out a snapshot of the GPU memory the renderer holds
+/// \param stats Pointer to the struct to fill
+/// \return Returns an MVR_Result status code
+///
+/// This is cheap enough to call every frame. Temporary buffer frame stats are updated when a
+/// frame in flight comes back around, so they lag behind by a frame or two.
+MVR_API MVR_Result mvr_GetMemoryStats(MVR_MemoryStats *stats);
+
+/// \brief Fills out how long frames are taking and how much of that the CPU spends waiting on the GPU
+/// \param stats Pointer to the struct to fill
+/// \return Returns an MVR_Result status code
+///
+/// Averages restart whenever frames in flight changes, so run each setting for a while and compare.
+/// A wait time close to the frame time means the GPU is the bottleneck and more frames in flight
+/// may help, a wait time near zero means the CPU is and fewer frames in flight only cut latency.
+MVR_API MVR_Result mvr_GetFrameStats(MVR_FrameStats *stats);
+
+/// \brief Copies out timings of the most recent frames the GPU has finished, oldest first
+/// \param timings Array of at least max_count timings to fill
+/// \param max_count Most timings to copy, up to the last 128 frames are kept
+/// \param count Set to the number of timings copied
+/// \return Returns an MVR_Result status code
+///
+/// Each timing splits a frame into time spent in the frame rate limiter, waiting on the GPU,
+/// acquiring the swapchain image and recording, then how long the GPU took and how far apart
+/// presents were. A frame shows up here once the start of a later frame sees the GPU is done with it.
+MVR_API MVR_Result mvr_GetFrameTimings(MVR_FrameTiming *timings, uint32_t max_count, uint32_t *count);
+
+/// \brief Starts a GPU timestamp zone before the frame's secondary command buffers of an order
+/// \param name Name to show the zone under, only the first 31 characters are kept
+/// \param order Secondary command buffer order the zone starts at, it covers that order's secondaries
+/// \return Returns MVR_RESULT_INVALID_ARGUMENT if name is null or no frame is being recorded,
+/// MVR_RESULT_SUCCESS otherwise
+///
+/// Recorded work only reaches the GPU's queue when the secondaries are executed as the frame is
+/// presented, so zones are placed by secondary order rather than by when they are pushed. Zones nest
+/// and must be closed with mvr_PopGpuZone in the same frame, any left open are closed after the last
+/// secondary. Only the first MVR_MAX_GPU_ZONES zones of a frame are measured, the rest are counted in
+/// MVR_GpuFrameStats::dropped_zones. Not thread-safe.
+MVR_API MVR_Result mvr_PushGpuZone(const char *name, uint32_t order);
+
+/// \brief Ends the GPU timestamp zone pushed last after the frame's secondary command buffers of an order
+/// \param order Secondary command buffer order the zone ends at, it covers that order's secondaries
+/// \return Returns MVR_RESULT_INVALID_ARGUMENT if no zone is open, no frame is being recorded or order is
+/// lower than the zone was pushed at, MVR_RESULT_SUCCESS otherwise
+MVR_API MVR_Result mvr_PopGpuZone(uint32_t order);
+
+/// \brief Fills out GPU timestamps of the newest frame the GPU has finished
+/// \param stats Pointer to the struct to fill
+/// \return Returns an MVR_Result status code
+///
+/// The renderer stamps the start and end of each frame's copy, compute and draw commands on
+/// its own. Timestamps are read when a frame in flight comes back around and never wait on the
+/// GPU, so they lag behind by a frame or two like the temp buffer memory stats. Headless
+/// renderers are measured the same way.
+MVR_API MVR_Result mvr_GetGpuFrameStats(MVR_GpuFrameStats *stats);
+
+/// \brief Writes the renderer's recent CPU trace zones to a file in Chrome trace JSON
+/// \param path File to write, it is overwritten if it exists
+/// \return Returns MVR_RESULT_INVALID_ARGUMENT if path is null or can't be written, MVR_RESULT_SUCCESS otherwise
+///
+/// Open the file in ui.perfetto.dev or chrome://tracing. Each thread keeps its newest 16384 zones,
+/// covering things like beginning and ending frames, temp buffer pages and permanent buffer uploads.
+/// Zones are only compiled into non-release builds with the ENABLE_TRACING CMake option, otherwise
+/// the trace is written with no events in it.
+MVR_API MVR_Result mvr_DumpTrace(const char *path);
\ No newline at end of file
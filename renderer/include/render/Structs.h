@@ -18,6 +18,10 @@ typedef enum {
     MVR_RESULT_CRITICAL_VULKAN_ERROR = -3, ///< General error from Vulkan that cannot be recovered
     MVR_RESULT_SDL_ERROR = 1,              ///< General SDL error
     MVR_RESULT_VULKAN_ERROR = 2,           ///< General Vulkan error
+    MVR_RESULT_INVALID_HANDLE = 3,         ///< A handle was invalid or no longer valid, like a temp buffer from a previous frame
+    MVR_RESULT_OUT_OF_MEMORY = 4,          ///< A fixed-size pool the renderer uses is full, free something and try again
+    MVR_RESULT_INVALID_ARGUMENT = 5,       ///< A parameter had a value the function doesn't accept
+    MVR_RESULT_NOT_READY = 6,              ///< The GPU hasn't finished with something yet, try again later
     MVR_RESULT_SUCCESS = 0,                ///< Everything worked fine
 } MVR_Result;
 
@@ -36,8 +40,122 @@ typedef struct MVR_InitializeParams_s {
                                   ///< each resource so you can more easily identify them in a program
                                   ///< like RenderDoc (when available).
     MVR_PresentMode present_mode; ///< Initial present mode
+    uint64_t staging_ring_size;   ///< Bytes of staging memory permanent buffer uploads are streamed through,
+                                  ///< 0 uses a sensible default, otherwise at least 64. Bigger uploads
+                                  ///< still work, they just get split into pieces.
+    uint64_t readback_ring_size;  ///< Bytes of host memory buffer readbacks land in, 0 uses a sensible
+                                  ///< default. Readbacks that haven't been released take up space here.
+    uint32_t frames_in_flight;    ///< How many frames the CPU can record ahead of the GPU, from 1 to 3. 0 uses
+                                  ///< the default of 2. 1 has the lowest input latency, 3 keeps the GPU
+                                  ///< busiest on heavy scenes. See mvr_SetFramesInFlight.
+    double frame_rate_limit;      ///< Most frames per second to run at, 0 for no limit. See mvr_SetFrameRateLimit.
 } MVR_InitializeParams;
 
+/// \brief What a temporary buffer will be used for. Each usage has its own pages with the
+/// smallest alignment that usage allows, so picking the right one wastes less memory.
+typedef enum {
+    MVR_BUFFER_USAGE_GENERAL = 0,  ///< Vertex, storage and texel buffer usage, aligned for all of them
+    MVR_BUFFER_USAGE_VERTEX = 1,   ///< Vertex buffer
+    MVR_BUFFER_USAGE_INDEX = 2,    ///< Index buffer
+    MVR_BUFFER_USAGE_UNIFORM = 3,  ///< Uniform buffer
+    MVR_BUFFER_USAGE_STORAGE = 4,  ///< Storage buffer
+    MVR_BUFFER_USAGE_INDIRECT = 5, ///< Indirect draw/dispatch commands
+    MVR_BUFFER_USAGE_COUNT = 6,    ///< Number of buffer usages, not a valid usage
+} MVR_BufferUsage;
+
+/// \brief Parameters for mvr_CreateTempBufferWithUsage
+typedef struct MVR_CreateTempBufferWithUsageParams_s {
+    uint64_t size;         ///< Size of the buffer in bytes
+    void *data;            ///< Binary data of at least size size to copy into the buffer
+    MVR_BufferUsage usage; ///< What the buffer will be used for
+} MVR_CreateTempBufferWithUsageParams;
+
+/// \brief Parameters for mvr_AllocateTempBufferWithUsage
+typedef struct MVR_AllocateTempBufferWithUsageParams_s {
+    uint64_t size;         ///< Size of the buffer in bytes
+    MVR_BufferUsage usage; ///< What the buffer will be used for
+} MVR_AllocateTempBufferWithUsageParams;
+
+/// \brief Most memory heaps a device can report, matches VK_MAX_MEMORY_HEAPS
+#define MVR_MAX_MEMORY_HEAPS 16
+
+/// \brief Usage of a single GPU memory heap
+typedef struct MVR_MemoryHeapStats_s {
+    uint64_t budget;   ///< Bytes the renderer can use from this heap before things start to go wrong
+    uint64_t usage;    ///< Bytes currently in use from this heap, including by other programs if the
+                       ///< driver supports VK_EXT_memory_budget
+    bool device_local; ///< This heap lives on the GPU
+} MVR_MemoryHeapStats;
+
+/// \brief Snapshot of the memory the renderer holds, see mvr_GetMemoryStats
+typedef struct MVR_MemoryStats_s {
+    bool budget_supported;                            ///< If false, heap budgets and usage are estimates
+    uint32_t heap_count;                              ///< Number of valid entries in heaps
+    MVR_MemoryHeapStats heaps[MVR_MAX_MEMORY_HEAPS];  ///< Budget and usage of every heap
+    uint64_t temp_page_count;                         ///< Temporary buffer pages across every frame in flight
+    uint64_t temp_page_bytes;                         ///< Bytes of temporary buffer pages across every frame in flight
+    uint64_t temp_high_water_mark;                    ///< Most temporary buffer bytes a single frame has used
+    uint64_t temp_bytes_last_frame;                   ///< Temporary buffer bytes the last finished frame used
+    uint64_t temp_alignment_waste;                    ///< Bytes of the above lost to alignment padding and chunk slack
+    uint64_t permanent_buffer_count;                  ///< Number of live permanent buffers
+    uint64_t permanent_buffer_bytes;                  ///< Bytes requested for live permanent buffers
+    uint64_t transient_image_bytes;                   ///< Memory held for frame graph transient images across every frame in flight
+    uint64_t transient_image_peak_bytes;              ///< Most transient image memory a single frame has needed, with aliasing
+    uint64_t transient_image_unaliased_bytes;         ///< Most a single frame would have needed if no transient images shared memory
+    uint64_t transient_image_lazy_bytes;              ///< Bytes of transient_image_bytes that are lazily allocated and may never be committed
+} MVR_MemoryStats;
+
+/// \brief Frame pacing measurements, see mvr_GetFrameStats. Averages only cover frames since
+/// frames in flight was last changed so different settings can be compared.
+typedef struct MVR_FrameStats_s {
+    uint32_t frames_in_flight;  ///< Frames in flight currently in use
+    uint64_t frame_count;       ///< Number of frames the averages cover
+    double average_frame_time;  ///< Average milliseconds from the start of one frame to the start of the next
+    double average_wait_time;   ///< Average milliseconds the CPU spent waiting on the GPU at the start of a frame
+    double last_frame_time;     ///< Milliseconds the last finished frame took
+    double last_wait_time;      ///< Milliseconds the CPU waited on the GPU at the start of the current frame
+} MVR_FrameStats;
+
+/// \brief Where the time of a single frame went, see mvr_GetFrameTimings. Times are in milliseconds.
+typedef struct MVR_FrameTiming_s {
+    uint64_t frame;          ///< Frame number, goes up by one every frame
+    double limiter_time;     ///< Time the frame rate limiter slept before the frame started
+    double wait_time;        ///< Time the CPU waited on the GPU to finish an older frame
+    double acquire_time;     ///< Time spent acquiring the swapchain image, includes waiting on the present engine
+    double record_time;      ///< CPU time from the end of mvr_PresentFrame's begin to the frame's submit
+    double gpu_latency;      ///< Time from submitting the frame to seeing the GPU finish it. This is only checked
+                             ///< at the start of each frame, so it's exact when the CPU had to wait and an upper
+                             ///< bound otherwise.
+    double present_interval; ///< Time between this frame's present and the last one, 0 if either didn't present
+} MVR_FrameTiming;
+
+/// \brief Most user zones measured in one frame, see mvr_PushGpuZone
+#define MVR_MAX_GPU_ZONES 64
+
+/// \brief Longest GPU zone name kept, including the null terminator
+#define MVR_GPU_ZONE_NAME_LENGTH 32
+
+/// \brief GPU time of a single zone pushed with mvr_PushGpuZone
+typedef struct MVR_GpuZone_s {
+    char name[MVR_GPU_ZONE_NAME_LENGTH]; ///< Name the zone was pushed with, cut short if it was too long
+    uint32_t depth;                      ///< Number of user zones this one was nested in
+    double start;                        ///< Milliseconds from the start of the frame's copy commands to the zone
+    double duration;                     ///< Milliseconds the GPU spent in the zone
+} MVR_GpuZone;
+
+/// \brief GPU timestamps of a single frame, see mvr_GetGpuFrameStats. Times are in milliseconds.
+typedef struct MVR_GpuFrameStats_s {
+    bool supported;                       ///< False if the device can't write timestamps on the graphics queue
+    uint64_t frame;                       ///< Frame the times are from, same numbering as MVR_FrameTiming, 0 until one is measured
+    double copy_time;                     ///< GPU time spent on the frame's temp buffer copies and uploads
+    double compute_time;                  ///< GPU time spent on the frame's compute work, 0 if the compute queue can't write timestamps
+    double draw_time;                     ///< GPU time spent drawing, including the readbacks at the end
+    double total_time;                    ///< From the start of the copies to the end of drawing, gaps between submissions included
+    uint32_t zone_count;                  ///< Number of valid entries in zones
+    uint32_t dropped_zones;               ///< Zones past MVR_MAX_GPU_ZONES that weren't measured
+    MVR_GpuZone zones[MVR_MAX_GPU_ZONES]; ///< User zones in the order they were pushed
+} MVR_GpuFrameStats;
+
 /// \brief An invalid handle
 #define MVR_INVALID_HANDLE UINT64_MAX
 
@@ -45,6 +163,24 @@ typedef struct MVR_InitializeParams_s {
 /// to the end user.
 typedef uint64_t MVR_Buffer;
 
+/// \brief Parameters for mvr_UpdateBuffer
+typedef struct MVR_UpdateBufferParams_s {
+    MVR_Buffer buffer; ///< Permanent buffer to write to
+    uint64_t offset;   ///< Offset in bytes into the buffer where the new data goes
+    uint64_t size;     ///< Number of bytes to write
+    void *data;        ///< Binary data of at least size size to copy into the buffer
+} MVR_UpdateBufferParams;
+
+/// \brief Handle for a buffer readback, see mvr_ReadBufferAsync
+typedef uint64_t MVR_Readback;
+
+/// \brief Parameters for mvr_ReadBufferAsync
+typedef struct MVR_ReadBufferAsyncParams_s {
+    MVR_Buffer buffer; ///< Permanent or temporary buffer to read from
+    uint64_t offset;   ///< Offset in bytes into the buffer to start reading at
+    uint64_t size;     ///< Number of bytes to read
+} MVR_ReadBufferAsyncParams;
+
 #ifdef __cplusplus
 };
 #endif
\ No newline at end of file
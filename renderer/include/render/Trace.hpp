@@ -0,0 +1,57 @@
+/// \brief Scoped CPU trace zones that can be dumped to a Chrome trace, see mvr_DumpTrace
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <string>
+#include "render/Constants.hpp"
+
+// Trace zones are only compiled in with MVR_TRACING, which CMake defines for non-release builds
+// when ENABLE_TRACING is on. Without it MVR_TRACE_ZONE is nothing at all.
+#ifdef MVR_TRACING
+#define MVR_TRACE_CONCAT_INNER(a, b) a##b
+#define MVR_TRACE_CONCAT(a, b) MVR_TRACE_CONCAT_INNER(a, b)
+
+// Times the rest of the enclosing scope, name has to be a string literal or otherwise outlive the trace
+#define MVR_TRACE_ZONE(name) MVRender::TraceZone MVR_TRACE_CONCAT(mvr_trace_zone_, __LINE__)(name)
+#else
+#define MVR_TRACE_ZONE(name) ((void)0)
+#endif
+
+namespace MVRender {
+    // One finished zone, fields are atomic only so a dump can read them while the thread keeps writing
+    struct TraceEvent {
+        std::atomic<const char *> name;
+        std::atomic<uint64_t> start; // nanoseconds since the trace clock started
+        std::atomic<uint64_t> duration; // nanoseconds
+    };
+
+    // A ring of the newest TRACE_BUFFER_EVENTS zones one thread finished. Only the owning thread writes
+    // to it so writes never lock, dumps copy it out and throw away whatever was overwritten meanwhile.
+    struct TraceBuffer {
+        TraceEvent events[TRACE_BUFFER_EVENTS];
+        std::atomic<uint64_t> head = 0; // events ever written, the next one goes in head % TRACE_BUFFER_EVENTS
+        uint32_t thread_id; // small id for the trace, in the order threads first traced something
+    };
+
+    // Nanoseconds since the trace clock started, the clock starts the first time this is called
+    uint64_t trace_now();
+
+    // Adds a finished zone to the calling thread's ring, the first call on a thread registers its ring
+    void trace_event(const char *name, uint64_t start, uint64_t end);
+
+    // Writes every zone still in the rings to path as Chrome trace JSON, can fail if path can't be written
+    void dump_trace(const std::string &path);
+
+    // Records the time from construction to destruction, use MVR_TRACE_ZONE instead of this directly
+    class TraceZone {
+        const char *m_name;
+        uint64_t m_start;
+    public:
+        explicit TraceZone(const char *name) : m_name(name), m_start(trace_now()) {}
+        ~TraceZone() { trace_event(m_name, m_start, trace_now()); }
+
+        TraceZone(TraceZone const&)       = delete;
+        void operator=(TraceZone const&)  = delete;
+    };
+}
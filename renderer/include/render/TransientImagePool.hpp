@@ -0,0 +1,92 @@
+/// \brief Memory for the frame graph's transient images, shared between images that are never alive at once
+#pragma once
+#include <volk.h>
+#include <vk_mem_alloc.h>
+#include <vector>
+
+namespace MVRender {
+    struct TransientImagePoolCreateInfo {
+        VmaAllocator allocator;
+        VkDevice logical_device;
+        uint32_t frame_in_flight_index; // for debug names
+    };
+
+    // What a transient image looks like, the frame graph fills these out from create_image
+    struct TransientImageDescription {
+        VkFormat format;
+        uint32_t width;
+        uint32_t height;
+        uint32_t mip_levels;
+        uint32_t array_layers;
+        VkSampleCountFlagBits samples;
+        VkImageUsageFlags usage;
+        VkImageAspectFlags aspect;
+
+        bool operator==(const TransientImageDescription &) const = default;
+    };
+
+    // A transient image a frame needs, alive from the start of its first batch to the end of its last
+    struct TransientImageRequest {
+        TransientImageDescription description;
+        uint32_t first_batch;
+        uint32_t last_batch;
+
+        bool operator==(const TransientImageRequest &) const = default;
+    };
+
+    struct TransientImage {
+        VkImage image;
+        VkImageView view;
+        VmaAllocation allocation; // null for images in the shared heap
+        VkDeviceSize offset; // into the heap
+        VkDeviceSize size;
+        bool in_heap; // shares the heap with other images, anything overlapping it has to be waited on
+        bool lazy; // lazily allocated, the memory may never be committed at all
+    };
+
+    struct TransientImagePoolStats {
+        VkDeviceSize bytes; // memory held right now, lazily allocated images count at their full size
+        VkDeviceSize peak_bytes; // most memory a single frame has needed with aliasing, not counting lazy images
+        VkDeviceSize peak_unaliased_bytes; // most memory a single frame would have needed without aliasing
+        VkDeviceSize lazy_bytes; // lazily allocated images held right now
+    };
+
+    // One frame in flight's transient images. Every frame the graph asks for the images it needs and when
+    // they're alive, images whose lifetimes don't overlap get placed in the same stretch of one shared
+    // allocation, biggest first. Attachments that are only ever used as attachments get lazily allocated
+    // memory of their own instead where the device has it, since tilers may never need to back them.
+    // If a frame asks for exactly what the last one did, the last frame's images are handed out again.
+    class TransientImagePool {
+        VmaAllocator m_allocator;
+        VkDevice m_logical_device;
+        uint32_t m_frame_in_flight_index;
+        bool m_lazy_supported = false; // some memory type is lazily allocated
+
+        // The shared heap, only ever grows
+        VmaAllocation m_heap = VK_NULL_HANDLE;
+        VkDeviceSize m_heap_size = 0;
+        uint32_t m_heap_memory_type = 0;
+
+        std::vector<TransientImageRequest> m_requests; // what m_images were made for
+        std::vector<TransientImage> m_images;
+        VkDeviceSize m_peak_bytes = 0;
+        VkDeviceSize m_peak_unaliased_bytes = 0;
+
+        // Makes the image, lazily allocated if it can be, anything else still needs memory bound
+        TransientImage create_image(const TransientImageDescription &description, const char *name);
+
+        void destroy_images();
+    public:
+        explicit TransientImagePool(TransientImagePoolCreateInfo &create_info);
+        ~TransientImagePool();
+
+        TransientImagePool(TransientImagePool const&)     = delete;
+        void operator=(TransientImagePool const&)  = delete;
+
+        // Gives every request an image, in the same order. The GPU has to be done with the last frame this
+        // pool was used for, since images it had may be destroyed. Can fail if memory runs out.
+        const std::vector<TransientImage> &place(const std::vector<TransientImageRequest> &requests, const std::vector<const char *> &names);
+
+        [[nodiscard]] TransientImagePoolStats stats() const;
+    };
+}
@@ -3,123 +3,71 @@
 #include <vulkan/vk_enum_string_helper.h>
 #include <vk_mem_alloc.h>
 #include <fmt/core.h>
+#include <spdlog/spdlog.h>
 
 #include "render/Renderer.hpp"
 #include "render/BufferAllocator.hpp"
 #include "render/Buffers.h"
 #include "render/Logging.hpp"
+#include "render/Trace.hpp"
 
 #include <filesystem>
 
-void MVRender::BufferAllocator::append_page(VkDeviceSize size) {
-    auto &renderer = MVRender::Renderer::instance();
-    const uint32_t page_index = m_buffer_pages.size();
+void MVRender::BufferAllocator::append_page(TempStream &stream, VkDeviceSize size) {
+    MVR_TRACE_ZONE("BufferAllocator::append_page");
+    stream.pages.emplace_back(m_page_pool->acquire(stream.usage, size));
+}
 
-    // Create the staging buffer
-    VkBuffer out_stage_buffer;
-    VmaAllocation out_stage_allocation;
-    VkBufferCreateInfo staging_buffer_create_info = {
-        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .size = size,
-        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        .queueFamilyIndexCount = 1,
-        .pQueueFamilyIndices = &m_queue_family_index,
-    };
-    VmaAllocationCreateInfo staging_allocation_create_info = {
-        .flags = 0,
-        .usage = VMA_MEMORY_USAGE_CPU_TO_GPU,
-        .requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-    };
-    VmaAllocationInfo stage_allocation_info;
-    VkResult stage_buffer_result = vmaCreateBuffer(m_vma, &staging_buffer_create_info,
-        &staging_allocation_create_info, &out_stage_buffer, &out_stage_allocation, &stage_allocation_info);
-
-    if (stage_buffer_result != VK_SUCCESS) {
-        const char *string_result = string_VkResult(stage_buffer_result);
-        throw Exception(MVR_RESULT_VULKAN_ERROR, fmt::format("Failed to allocate staging buffer for new page, {}", string_result));
-    }
-
-    renderer.debug_name_object(
-            reinterpret_cast<uint64_t>(out_stage_buffer),
-            VK_OBJECT_TYPE_BUFFER,
-            fmt::format("Buffer FIF[{}].page[{}] (staging)", m_index, page_index)
-    );
-
-    // Create the device buffer
-    VkBuffer out_device_buffer;
-    VmaAllocation out_device_allocation;
-    VkBufferCreateInfo device_buffer_create_info = {
-        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .size = size,
-        .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
-            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_TEXEL_BUFFER_BIT,
-        .queueFamilyIndexCount = 1,
-        .pQueueFamilyIndices = &m_queue_family_index,
-    };
-    VmaAllocationCreateInfo device_allocation_create_info = {
-        .usage = VMA_MEMORY_USAGE_GPU_TO_CPU,
-        .requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-    };
-    VmaAllocationInfo device_allocation_info;
-    VkResult device_buffer_result = vmaCreateBuffer(m_vma, &device_buffer_create_info,
-        &device_allocation_create_info, &out_device_buffer, &out_device_allocation, &device_allocation_info);
-
-    if (device_buffer_result != VK_SUCCESS) {
-        // Gotta throw out the staging buffer
-        vmaDestroyBuffer(m_vma, out_stage_buffer, out_stage_allocation);
-
-        const char *string_result = string_VkResult(device_buffer_result);
-        throw Exception(MVR_RESULT_VULKAN_ERROR, fmt::format("Failed to allocate device buffer for new page, {}", string_result));
-    }
-
-    renderer.debug_name_object(
-            reinterpret_cast<uint64_t>(out_device_buffer),
-            VK_OBJECT_TYPE_BUFFER,
-            fmt::format("Buffer FIF[{}].page[{}] (device)", m_index, page_index)
-    );
-
-    // Now that we have the memory, we need to map it
-    void *data;
-    VkResult memory_map_result = vmaMapMemory(m_vma, out_stage_allocation, &data);
-
-    BufferPage page = {
-        .vram_buffer = out_device_buffer,
-        .vram_allocation = out_device_allocation,
-        .staging_buffer = out_stage_buffer,
-        .staging_allocation = out_stage_allocation,
-        .offset = 0,
-        .size = size,
-        .data = data,
-    };
+// Bytes left in a page, the offset may run past the end when threads race for the last chunk
+static VkDeviceSize page_remaining(const MVRender::BufferPage &page) {
+    const VkDeviceSize offset = page.offset.load(std::memory_order_relaxed);
+    return offset < page.size ? page.size - offset : 0;
+}
 
-    m_buffer_pages.emplace_back(page);
+MVRender::BufferPage *MVRender::BufferAllocator::find_page(TempStream &stream, VkDeviceSize size) {
+    MVR_TRACE_ZONE("BufferAllocator::find_page");
+    // Shared pages are only ever claimed from front to back, so whatever is after the current
+    // page is untouched this frame and big enough for anything under the dedicated threshold
+    if (stream.current_page.load(std::memory_order_relaxed) != nullptr) {
+        stream.cursor++;
+    }
+    if (stream.cursor < stream.pages.size()) {
+        return stream.pages[stream.cursor].get();
+    }
 
-    // If there was a mapping error we will make it unusable for the frame
-    if (memory_map_result != VK_SUCCESS) {
-        m_buffer_pages.at(m_buffer_pages.size() - 1).offset = size;
+    // Borrow another page if we've run out
+    append_page(stream, size);
+    stream.cursor = stream.pages.size() - 1;
+    return stream.pages.back().get();
+}
 
-        const char *string_result = string_VkResult(memory_map_result);
-        throw Exception(MVR_RESULT_VULKAN_ERROR, fmt::format("Failed to map memory for new page, {}", string_result));
-    }
+MVRender::BufferPage *MVRender::BufferAllocator::claim_dedicated_page(MVR_BufferUsage usage, VkDeviceSize size) {
+    std::unique_ptr<BufferPage> page = m_page_pool->acquire(usage, size);
+    page->offset.store(size, std::memory_order_relaxed);
+
+    std::lock_guard lock(m_page_mutex);
+    m_dedicated_pages.emplace_back(std::move(page));
+    return m_dedicated_pages.back().get();
 }
 
-MVRender::BufferPage *MVRender::BufferAllocator::find_page(VkDeviceSize size) {
-    // Try and find a page with available space
-    BufferPage *found_page = nullptr;
-    for (auto &page: m_buffer_pages) {
-        if (page.size - page.offset >= size) {
-            found_page = &page;
-            break;
+void MVRender::BufferAllocator::claim_range(TempStream &stream, VkDeviceSize size, BufferPage **page, VkDeviceSize *offset) {
+    while (true) {
+        BufferPage *current = stream.current_page.load(std::memory_order_acquire);
+        if (current != nullptr) {
+            VkDeviceSize claimed = current->offset.fetch_add(size, std::memory_order_relaxed);
+            if (claimed + size <= current->size) {
+                *page = current;
+                *offset = claimed;
+                return;
+            }
         }
-    }
 
-    // Create a new page if there isn't already an available page
-    if (found_page == nullptr) {
-        VkDeviceSize page_size = size > m_page_size ? m_page_size + size : m_page_size;
-        append_page(page_size);
-        found_page = &m_buffer_pages.at(m_buffer_pages.size() - 1);
+        // The current page is full, only the first thread to get here moves everyone to a new page
+        std::lock_guard lock(m_page_mutex);
+        if (stream.current_page.load(std::memory_order_relaxed) == current) {
+            stream.current_page.store(find_page(stream, size), std::memory_order_release);
+        }
     }
-    return found_page;
 }
 
 // This will return current + size, where size is rounded up to the nearest alignment
@@ -131,47 +79,115 @@ static VkDeviceSize move_by_alignment(VkDeviceSize current, VkDeviceSize increas
     return current + increase;
 }
 
-MVRender::BufferDescriptor *MVRender::BufferAllocator::get_buffer_descriptor(VkDeviceSize size) {
-    BufferPage *page = find_page(size);
+// Each thread has one arena per usage, it is only valid for the allocator epoch it was claimed in
+static thread_local MVRender::TempArena t_temp_arenas[MVR_BUFFER_USAGE_COUNT];
+
+// Hands out a unique epoch to every allocator frame
+static std::atomic<uint64_t> g_temp_epoch = 1;
+
+MVRender::BufferDescriptor *MVRender::BufferAllocator::get_buffer_descriptor(MVR_BufferUsage usage, VkDeviceSize size, uint32_t *slot) {
+    TempStream &stream = m_streams[usage];
+    const VkDeviceSize aligned_size = move_by_alignment(0, size, stream.alignment);
+    BufferPage *page;
+    VkDeviceSize offset;
+
+    if (aligned_size > TEMP_DEDICATED_THRESHOLD) {
+        // Big enough that sharing a page would waste most of it
+        page = claim_dedicated_page(usage, aligned_size);
+        offset = 0;
+    } else if (aligned_size > TEMP_CHUNK_SIZE) {
+        // Won't fit in a chunk, so claim it straight from the page
+        claim_range(stream, aligned_size, &page, &offset);
+    } else {
+        TempArena &arena = t_temp_arenas[usage];
+        const uint64_t epoch = m_epoch.load(std::memory_order_relaxed);
+        if (arena.epoch != epoch || arena.end - arena.offset < aligned_size) {
+            claim_range(stream, TEMP_CHUNK_SIZE, &arena.page, &arena.offset);
+            arena.end = arena.offset + TEMP_CHUNK_SIZE;
+            arena.epoch = epoch;
+        }
+        page = arena.page;
+        offset = arena.offset;
+        arena.offset += aligned_size;
+    }
 
-    BufferDescriptor descriptor = {
+    BufferDescriptor *descriptor = m_descriptors.claim(slot);
+    *descriptor = {
         .buffer = page->vram_buffer,
-        .offset = page->offset,
+        .offset = offset,
         .size = size,
-        .data = static_cast<uint8_t*>(page->data) + page->offset,
+        .data = static_cast<uint8_t*>(page->data) + offset,
     };
-    m_buffers.emplace_back(descriptor);
-
-    page->offset = move_by_alignment(page->offset, size, m_minimum_alignment);
-
-    return &m_buffers.back();
+    return descriptor;
 }
 
 MVRender::BufferAllocator::BufferAllocator(MVRender::BufferAllocatorCreateInfo &create_info) {
-    m_page_size = create_info.page_size;
+    m_page_pool = create_info.page_pool;
     m_vma = create_info.allocator;
     m_logical_device = create_info.logical_device;
-    m_queue_family_index = create_info.queue_family_index;
     m_index = create_info.frame_in_flight_index;
-
-    // We need to find the minimum alignment we care about (minimum being the highest value
-    // of all the alignments of the types of data this thing supports)
-    VkDeviceSize align1 = create_info.device_properties.limits.minStorageBufferOffsetAlignment;
-    VkDeviceSize align2 = create_info.device_properties.limits.minTexelBufferOffsetAlignment;
-    m_minimum_alignment = align1 > align2 ? align1 : align2;
+    m_epoch = g_temp_epoch.fetch_add(1);
+
+    // Each usage only needs to be aligned as much as that usage demands, general buffers can be used
+    // as anything so they need the highest value of all the alignments of the types of data they support.
+    // Vertex, index and indirect data have no offset limit, but 4 bytes keeps every element aligned.
+    const VkPhysicalDeviceLimits &limits = create_info.device_properties.limits;
+    VkDeviceSize storage_alignment = limits.minStorageBufferOffsetAlignment;
+    VkDeviceSize texel_alignment = limits.minTexelBufferOffsetAlignment;
+    VkDeviceSize alignments[MVR_BUFFER_USAGE_COUNT] = {};
+    alignments[MVR_BUFFER_USAGE_GENERAL] = storage_alignment > texel_alignment ? storage_alignment : texel_alignment;
+    alignments[MVR_BUFFER_USAGE_VERTEX] = 4;
+    alignments[MVR_BUFFER_USAGE_INDEX] = 4;
+    alignments[MVR_BUFFER_USAGE_UNIFORM] = limits.minUniformBufferOffsetAlignment;
+    alignments[MVR_BUFFER_USAGE_STORAGE] = storage_alignment;
+    alignments[MVR_BUFFER_USAGE_INDIRECT] = 4;
+    for (int i = 0; i < MVR_BUFFER_USAGE_COUNT; i++) {
+        m_streams[i].usage = static_cast<MVR_BufferUsage>(i);
+        m_streams[i].alignment = alignments[i] > 0 ? alignments[i] : 1;
+    }
 }
 
 MVRender::BufferAllocator::~BufferAllocator() {
-    for (auto page: m_buffer_pages) {
-        vmaDestroyBuffer(m_vma, page.vram_buffer, page.vram_allocation);
-        vmaDestroyBuffer(m_vma, page.staging_buffer, page.staging_allocation);
+    for (auto &stream: m_streams) {
+        for (auto &page: stream.pages) {
+            m_page_pool->release(std::move(page));
+        }
+    }
+    for (auto &page: m_dedicated_pages) {
+        m_page_pool->release(std::move(page));
     }
 }
 
-MVR_Buffer MVRender::BufferAllocator::allocate_temp_buffer(VkDeviceSize size, void **data) {
-    BufferDescriptor *descriptor = get_buffer_descriptor(size);
+MVR_Buffer MVRender::BufferAllocator::allocate_temp_buffer(VkDeviceSize size, void **data, MVR_BufferUsage usage) {
+    if (usage < 0 || usage >= MVR_BUFFER_USAGE_COUNT) {
+        throw Exception(MVR_RESULT_INVALID_ARGUMENT, fmt::format("{} is not a valid buffer usage", static_cast<int>(usage)));
+    }
+    uint32_t slot;
+    BufferDescriptor *descriptor = get_buffer_descriptor(usage, size, &slot);
     *data = descriptor->data;
-    return reinterpret_cast<MVR_Buffer>(descriptor);
+    const uint64_t epoch = m_epoch.load(std::memory_order_relaxed) & TEMP_HANDLE_EPOCH_MASK;
+    return TEMP_HANDLE_BIT | (epoch << 32) | slot;
+}
+
+MVRender::BufferDescriptor *MVRender::BufferAllocator::resolve_temp_buffer(MVR_Buffer buffer) {
+    // Epochs are unique to each frame of each allocator, so this catches handles from older frames too
+    const uint64_t epoch = m_epoch.load(std::memory_order_relaxed) & TEMP_HANDLE_EPOCH_MASK;
+    BufferDescriptor *descriptor = nullptr;
+    if (is_temp_handle(buffer) && ((buffer >> 32) & TEMP_HANDLE_EPOCH_MASK) == epoch) {
+        descriptor = m_descriptors.get(static_cast<uint32_t>(buffer));
+    }
+    if (descriptor == nullptr) {
+        throw Exception(MVR_RESULT_INVALID_HANDLE, "Temporary buffer handle is invalid or from a previous frame");
+    }
+    return descriptor;
+}
+
+size_t MVRender::BufferAllocator::page_count() const {
+    size_t count = m_dedicated_pages.size();
+    for (auto &stream: m_streams) {
+        count += stream.pages.size();
+    }
+    return count;
 }
 
 MVR_Buffer MVRender::BufferAllocator::allocate_permanent_buffer(VkDeviceSize size, void *data) {
@@ -180,41 +196,154 @@ MVR_Buffer MVRender::BufferAllocator::allocate_permanent_buffer(VkDeviceSize siz
     return MVR_INVALID_HANDLE;
 }
 
-void MVRender::BufferAllocator::record_copy_commands(VkCommandBuffer command_buffer) {
-    // Go through each page, unmap the memory, then add a copy command
-    for (auto &page: m_buffer_pages) {
-        vmaUnmapMemory(m_vma, page.staging_allocation);
-        VkBufferCopy2 buffer_region = {
-                .sType = VK_STRUCTURE_TYPE_BUFFER_COPY_2,
-                .size = page.offset,
+bool MVRender::BufferAllocator::record_page_copy(BufferPage &page, VkCommandBuffer command_buffer) {
+    const VkDeviceSize used = page.size - page_remaining(page);
+    if (used == 0) {
+        return false;
+    }
+
+    // Pages stay mapped, so non-coherent memory only needs the written range flushed
+    if (!page.coherent) {
+        vmaFlushAllocation(m_vma, page.direct ? page.vram_allocation : page.staging_allocation, 0, used);
+    }
+
+    // Direct pages were written in place and have nothing to copy
+    if (page.direct) {
+        return false;
+    }
+
+    VkBufferCopy2 buffer_region = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_COPY_2,
+            .size = used,
+    };
+    VkCopyBufferInfo2 copy_buffer = {
+            .sType = VK_STRUCTURE_TYPE_COPY_BUFFER_INFO_2,
+            .srcBuffer = page.staging_buffer,
+            .dstBuffer = page.vram_buffer,
+            .regionCount = 1,
+            .pRegions = &buffer_region
+    };
+
+    if (command_buffer != VK_NULL_HANDLE) {
+        vkCmdCopyBuffer2(command_buffer, &copy_buffer);
+    }
+    return true;
+}
+
+void MVRender::record_transfer_barriers(const CopyCommandsInfo &info, const std::vector<CopiedRange> &copied_ranges) {
+    if (copied_ranges.empty() || info.transfer_commands == VK_NULL_HANDLE) {
+        return;
+    }
+
+    // Same queue, so a plain barrier is enough to make the copies visible to the rest of the frame
+    if (info.transfer_queue_family == info.graphics_queue_family) {
+        VkMemoryBarrier2 barrier = {
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+                .srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                .dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                .dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT,
         };
-        VkCopyBufferInfo2 copy_buffer = {
-                .sType = VK_STRUCTURE_TYPE_COPY_BUFFER_INFO_2,
-                .srcBuffer = page.staging_buffer,
-                .dstBuffer = page.vram_buffer,
-                .regionCount = 1,
-                .pRegions = &buffer_region
+        VkDependencyInfo dependency_info = {
+                .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+                .memoryBarrierCount = 1,
+                .pMemoryBarriers = &barrier,
         };
+        vkCmdPipelineBarrier2(info.graphics_commands, &dependency_info);
+        return;
+    }
 
-        if (page.offset > 0 && command_buffer != VK_NULL_HANDLE) {
-            vkCmdCopyBuffer2(command_buffer, &copy_buffer);
+    // Otherwise the transfer queue releases every range it copied into and the graphics queue acquires them.
+    // The previous contents of those ranges never matter, so there is no need to transfer ownership back the other way.
+    std::vector<VkBufferMemoryBarrier2> release_barriers;
+    std::vector<VkBufferMemoryBarrier2> acquire_barriers;
+    for (const CopiedRange &range: copied_ranges) {
+        release_barriers.push_back({
+                .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+                .srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                .srcQueueFamilyIndex = info.transfer_queue_family,
+                .dstQueueFamilyIndex = info.graphics_queue_family,
+                .buffer = range.buffer,
+                .offset = range.offset,
+                .size = range.size,
+        });
+        acquire_barriers.push_back({
+                .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+                .dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                .dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT,
+                .srcQueueFamilyIndex = info.transfer_queue_family,
+                .dstQueueFamilyIndex = info.graphics_queue_family,
+                .buffer = range.buffer,
+                .offset = range.offset,
+                .size = range.size,
+        });
+    }
+    VkDependencyInfo release_info = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .bufferMemoryBarrierCount = static_cast<uint32_t>(release_barriers.size()),
+            .pBufferMemoryBarriers = release_barriers.data(),
+    };
+    vkCmdPipelineBarrier2(info.transfer_commands, &release_info);
+    VkDependencyInfo acquire_info = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .bufferMemoryBarrierCount = static_cast<uint32_t>(acquire_barriers.size()),
+            .pBufferMemoryBarriers = acquire_barriers.data(),
+    };
+    vkCmdPipelineBarrier2(info.graphics_commands, &acquire_info);
+}
+
+void MVRender::BufferAllocator::record_copy_commands(const CopyCommandsInfo &info) {
+    MVR_TRACE_ZONE("BufferAllocator::record_copy_commands");
+    // Go through each page, flush what was written this frame, then add a copy command
+    std::vector<CopiedRange> copied_ranges;
+    for (auto &stream: m_streams) {
+        for (auto &page: stream.pages) {
+            if (record_page_copy(*page, info.transfer_commands)) {
+                copied_ranges.push_back({page->vram_buffer, 0, VK_WHOLE_SIZE});
+            }
         }
     }
+    for (auto &page: m_dedicated_pages) {
+        if (record_page_copy(*page, info.transfer_commands)) {
+            copied_ranges.push_back({page->vram_buffer, 0, VK_WHOLE_SIZE});
+        }
+    }
+    record_transfer_barriers(info, copied_ranges);
 }
 
 void MVRender::BufferAllocator::begin_frame() {
-    // We only need to go through each page and reset the offset and remap the page
-    for (auto &page: m_buffer_pages) {
-        page.offset = 0;
-        VkResult result = vmaMapMemory(m_vma, page.staging_allocation, &page.data);
-        if (result != VK_SUCCESS) {
-            const char *string_result = string_VkResult(result);
-            throw Exception(MVR_RESULT_VULKAN_ERROR, fmt::format("Failed to map staging buffer for page, {}", string_result));
+    // Pages that sat empty all of last frame go back to the pool for other frames to borrow,
+    // the rest are persistently mapped so we only need to reset their offsets
+    VkDeviceSize used_bytes = 0;
+    for (auto &stream: m_streams) {
+        size_t kept_pages = 0;
+        for (auto &page: stream.pages) {
+            const VkDeviceSize used = page->size - page_remaining(*page);
+            if (used == 0) {
+                m_page_pool->release(std::move(page));
+                continue;
+            }
+            used_bytes += used;
+            page->offset.store(0, std::memory_order_relaxed);
+            stream.pages[kept_pages++] = std::move(page);
         }
+        stream.pages.resize(kept_pages);
+        stream.cursor = 0;
+        stream.current_page.store(stream.pages.empty() ? nullptr : stream.pages.front().get(), std::memory_order_release);
+    }
+
+    // Dedicated pages are only ever good for one frame
+    for (auto &page: m_dedicated_pages) {
+        used_bytes += page->size - page_remaining(*page);
+        m_page_pool->release(std::move(page));
     }
+    m_dedicated_pages.clear();
+    m_page_pool->record_frame_usage(used_bytes, m_descriptors.total_buffer_bytes());
 
-    // And reset the tracked buffers
-    m_buffers.resize(0);
+    // And reset the tracked buffers, a new epoch makes every thread claim a fresh chunk
+    m_descriptors.reset();
+    m_epoch.store(g_temp_epoch.fetch_add(1), std::memory_order_relaxed);
 }
 
 MVR_API MVR_Result mvr_CreateTempBuffer(uint64_t size, void *data, MVR_Buffer *buffer) {
@@ -246,19 +375,73 @@ MVR_API MVR_Result mvr_AllocateTempBuffer(uint64_t size, void **data, MVR_Buffer
     return status;
 }
 
+MVR_API MVR_Result mvr_CreateTempBufferWithUsage(MVR_CreateTempBufferWithUsageParams *params, MVR_Buffer *buffer) {
+    MVR_Result status = MVR_RESULT_SUCCESS;
+    try {
+        auto &instance = MVRender::Renderer::instance();
+        void *write_data;
+        *buffer = instance.get_buffer_allocator().allocate_temp_buffer(params->size, &write_data, params->usage);
+
+        // Write user data into the buffer right away
+        memcpy(write_data, params->data, params->size);
+    } catch (MVRender::Exception& r) {
+        status = r.result();
+        *buffer = MVR_INVALID_HANDLE;
+    }
+    return status;
+}
+
+MVR_API MVR_Result mvr_AllocateTempBufferWithUsage(MVR_AllocateTempBufferWithUsageParams *params, void **data, MVR_Buffer *buffer) {
+    MVR_Result status = MVR_RESULT_SUCCESS;
+    try {
+        auto &instance = MVRender::Renderer::instance();
+        *buffer = instance.get_buffer_allocator().allocate_temp_buffer(params->size, data, params->usage);
+    } catch (MVRender::Exception& r) {
+        status = r.result();
+        *data = nullptr;
+        *buffer = MVR_INVALID_HANDLE;
+    }
+    return status;
+}
+
 MVR_API MVR_Result mvr_CreateBuffer(uint64_t size, void *data, MVR_Buffer *buffer) {
     MVR_Result status = MVR_RESULT_SUCCESS;
     *buffer = MVR_INVALID_HANDLE;
     try {
         auto &instance = MVRender::Renderer::instance();
-        *buffer = reinterpret_cast<MVR_Buffer>(instance.load_permanent_buffer(size, data));
+        *buffer = instance.load_permanent_buffer(size, data);
+    } catch (MVRender::Exception& r) {
+        status = r.result();
+    }
+    return status;
+}
+
+MVR_API MVR_Result mvr_UpdateBuffer(MVR_UpdateBufferParams *params) {
+    MVR_Result status = MVR_RESULT_SUCCESS;
+    try {
+        MVRender::Renderer::instance().update_permanent_buffer(params->buffer, params->offset, params->size, params->data);
     } catch (MVRender::Exception& r) {
         status = r.result();
     }
     return status;
 }
 
+MVR_API bool mvr_IsBufferReady(MVR_Buffer buffer) {
+    try {
+        return MVRender::Renderer::instance().is_buffer_ready(buffer);
+    } catch (MVRender::Exception& r) {
+        return false;
+    }
+}
+
 MVR_API void mvr_DestroyBuffer(MVR_Buffer buffer) {
-    auto &instance = MVRender::Renderer::instance();
-    instance.free_permanent_buffer(reinterpret_cast<MVRender::BufferDescriptor *>(buffer));
+    // Temp buffers go away on their own
+    if (buffer == MVR_INVALID_HANDLE || MVRender::is_temp_handle(buffer)) {
+        return;
+    }
+    try {
+        MVRender::Renderer::instance().free_permanent_buffer(buffer);
+    } catch (MVRender::Exception& r) {
+        // Destroying twice is a user bug, but not one worth crashing over; the error message says what happened
+    }
 }
\ No newline at end of file
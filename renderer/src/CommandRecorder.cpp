@@ -0,0 +1,215 @@
+#define VK_NO_PROTOTYPES
+#include <volk.h>
+#include <vulkan/vk_enum_string_helper.h>
+#include <fmt/core.h>
+#include <algorithm>
+
+#include "render/CommandRecorder.hpp"
+#include "render/Renderer.hpp"
+#include "render/Logging.hpp"
+
+// The pool a thread last claimed, it is only valid for the recorder epoch it was claimed in
+struct ThreadCommandsSlot {
+    uint64_t epoch = 0;
+    MVRender::ThreadCommands *commands = nullptr;
+};
+static thread_local ThreadCommandsSlot t_thread_commands;
+
+// Hands out a unique epoch to every recorder frame
+static std::atomic<uint64_t> g_command_epoch = 1;
+
+MVRender::CommandRecorder::CommandRecorder(CommandRecorderCreateInfo &create_info) {
+    m_logical_device = create_info.logical_device;
+    m_graphics_queue_family = create_info.graphics_queue_family;
+    m_index = create_info.frame_in_flight_index;
+    m_epoch = g_command_epoch.fetch_add(1);
+    auto &renderer = Renderer::instance();
+
+    // Copy, drawing, then compute unless compute gets its own pool below
+    m_graphics_pool = create_pool(m_graphics_queue_family, "graphics");
+    VkCommandBuffer command_buffers[3];
+    VkCommandBufferAllocateInfo allocate_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = m_graphics_pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = create_info.async_compute ? 2u : 3u,
+    };
+    VkResult allocate_result = vkAllocateCommandBuffers(m_logical_device, &allocate_info, command_buffers);
+    if (allocate_result != VK_SUCCESS) {
+        const char *string_result = string_VkResult(allocate_result);
+        throw Exception(MVR_RESULT_CRITICAL_VULKAN_ERROR, fmt::format("Failed to create command buffers, Vulkan error {}", string_result));
+    }
+
+    if (create_info.async_compute) {
+        m_compute_pool = create_pool(create_info.compute_queue_family, "compute");
+        allocate_info.commandPool = m_compute_pool;
+        allocate_info.commandBufferCount = 1;
+        allocate_result = vkAllocateCommandBuffers(m_logical_device, &allocate_info, &command_buffers[2]);
+        if (allocate_result != VK_SUCCESS) {
+            const char *string_result = string_VkResult(allocate_result);
+            throw Exception(MVR_RESULT_CRITICAL_VULKAN_ERROR, fmt::format("Failed to create compute command buffer, Vulkan error {}", string_result));
+        }
+    }
+    m_copy_commands = command_buffers[0];
+    m_draw_commands = command_buffers[1];
+    m_compute_commands = command_buffers[2];
+
+    m_transfer_commands = m_copy_commands;
+    if (create_info.dedicated_transfer) {
+        m_transfer_pool = create_pool(create_info.transfer_queue_family, "transfer");
+        allocate_info.commandPool = m_transfer_pool;
+        allocate_info.commandBufferCount = 1;
+        allocate_result = vkAllocateCommandBuffers(m_logical_device, &allocate_info, &m_transfer_commands);
+        if (allocate_result != VK_SUCCESS) {
+            const char *string_result = string_VkResult(allocate_result);
+            throw Exception(MVR_RESULT_CRITICAL_VULKAN_ERROR, fmt::format("Failed to create transfer command buffer, Vulkan error {}", string_result));
+        }
+        renderer.debug_name_object(
+                reinterpret_cast<uint64_t>(m_transfer_commands),
+                VK_OBJECT_TYPE_COMMAND_BUFFER,
+                fmt::format("Command buffer FIF[{}] transfer", m_index)
+        );
+    }
+
+    renderer.debug_name_object(
+            reinterpret_cast<uint64_t>(m_copy_commands),
+            VK_OBJECT_TYPE_COMMAND_BUFFER,
+            fmt::format("Command buffer FIF[{}] copy", m_index)
+    );
+    renderer.debug_name_object(
+            reinterpret_cast<uint64_t>(m_compute_commands),
+            VK_OBJECT_TYPE_COMMAND_BUFFER,
+            fmt::format("Command buffer FIF[{}] compute", m_index)
+    );
+    renderer.debug_name_object(
+            reinterpret_cast<uint64_t>(m_draw_commands),
+            VK_OBJECT_TYPE_COMMAND_BUFFER,
+            fmt::format("Command buffer FIF[{}] drawing", m_index)
+    );
+}
+
+MVRender::CommandRecorder::~CommandRecorder() {
+    // Destroying a pool frees every buffer that came from it
+    for (auto &thread: m_threads) {
+        vkDestroyCommandPool(m_logical_device, thread->pool, nullptr);
+    }
+    if (m_transfer_pool != VK_NULL_HANDLE) {
+        vkDestroyCommandPool(m_logical_device, m_transfer_pool, nullptr);
+    }
+    if (m_compute_pool != VK_NULL_HANDLE) {
+        vkDestroyCommandPool(m_logical_device, m_compute_pool, nullptr);
+    }
+    vkDestroyCommandPool(m_logical_device, m_graphics_pool, nullptr);
+}
+
+VkCommandPool MVRender::CommandRecorder::create_pool(uint32_t queue_family, const char *name) {
+    // Buffers only live for a frame and are never reset one at a time
+    VkCommandPoolCreateInfo command_pool_create_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+            .queueFamilyIndex = queue_family,
+    };
+    VkCommandPool pool;
+    VkResult result = vkCreateCommandPool(m_logical_device, &command_pool_create_info, nullptr, &pool);
+    if (result != VK_SUCCESS) {
+        const char *string_result = string_VkResult(result);
+        throw Exception(MVR_RESULT_CRITICAL_VULKAN_ERROR, fmt::format("Failed to create {} command pool, Vulkan error {}", name, string_result));
+    }
+    Renderer::instance().debug_name_object(
+            reinterpret_cast<uint64_t>(pool),
+            VK_OBJECT_TYPE_COMMAND_POOL,
+            fmt::format("Command pool FIF[{}] {}", m_index, name)
+    );
+    return pool;
+}
+
+void MVRender::CommandRecorder::begin_frame() {
+    vkResetCommandPool(m_logical_device, m_graphics_pool, 0);
+    if (m_compute_pool != VK_NULL_HANDLE) {
+        vkResetCommandPool(m_logical_device, m_compute_pool, 0);
+    }
+    if (m_transfer_pool != VK_NULL_HANDLE) {
+        vkResetCommandPool(m_logical_device, m_transfer_pool, 0);
+    }
+
+    // Only pools that were claimed last frame have anything to reset
+    for (size_t i = 0; i < m_claimed_threads; i++) {
+        vkResetCommandPool(m_logical_device, m_threads[i]->pool, 0);
+        m_threads[i]->used = 0;
+        m_threads[i]->recorded.clear();
+    }
+    m_claimed_threads = 0;
+    m_sequence = 0;
+    m_epoch.store(g_command_epoch.fetch_add(1), std::memory_order_relaxed);
+}
+
+MVRender::ThreadCommands &MVRender::CommandRecorder::thread_commands() {
+    const uint64_t epoch = m_epoch.load(std::memory_order_relaxed);
+    if (t_thread_commands.epoch == epoch) {
+        return *t_thread_commands.commands;
+    }
+
+    // First secondary this thread has asked for this frame, pools are handed out in the order threads show up
+    std::lock_guard lock(m_thread_mutex);
+    if (m_claimed_threads == m_threads.size()) {
+        auto commands = std::make_unique<ThreadCommands>();
+        commands->pool = create_pool(m_graphics_queue_family, "worker");
+        m_threads.push_back(std::move(commands));
+    }
+    ThreadCommands *commands = m_threads[m_claimed_threads++].get();
+    t_thread_commands = {.epoch = epoch, .commands = commands};
+    return *commands;
+}
+
+VkCommandBuffer MVRender::CommandRecorder::begin_secondary(uint32_t order) {
+    ThreadCommands &commands = thread_commands();
+    if (commands.used == commands.buffers.size()) {
+        VkCommandBufferAllocateInfo allocate_info = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .commandPool = commands.pool,
+                .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+                .commandBufferCount = 1,
+        };
+        VkCommandBuffer buffer;
+        VkResult allocate_result = vkAllocateCommandBuffers(m_logical_device, &allocate_info, &buffer);
+        if (allocate_result != VK_SUCCESS) {
+            const char *string_result = string_VkResult(allocate_result);
+            throw Exception(MVR_RESULT_VULKAN_ERROR, fmt::format("Failed to create secondary command buffer, Vulkan error {}", string_result));
+        }
+        commands.buffers.push_back(buffer);
+    }
+    VkCommandBuffer buffer = commands.buffers[commands.used++];
+
+    // Secondaries are executed outside of any rendering so there is nothing to inherit
+    VkCommandBufferInheritanceInfo inheritance_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+    };
+    VkCommandBufferBeginInfo begin_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+            .pInheritanceInfo = &inheritance_info,
+    };
+    VkResult begin_result = vkBeginCommandBuffer(buffer, &begin_info);
+    if (begin_result != VK_SUCCESS) {
+        const char *string_result = string_VkResult(begin_result);
+        throw Exception(MVR_RESULT_VULKAN_ERROR, fmt::format("Failed to begin secondary command buffer, Vulkan error {}", string_result));
+    }
+
+    const uint64_t key = (static_cast<uint64_t>(order) << 32) | m_sequence.fetch_add(1, std::memory_order_relaxed);
+    commands.recorded.push_back({.key = key, .buffer = buffer});
+    return buffer;
+}
+
+std::vector<MVRender::SecondaryCommands> MVRender::CommandRecorder::end_secondaries() {
+    std::vector<SecondaryCommands> secondaries;
+    for (size_t i = 0; i < m_claimed_threads; i++) {
+        for (auto &recorded: m_threads[i]->recorded) {
+            vkEndCommandBuffer(recorded.buffer);
+            secondaries.push_back(recorded);
+        }
+    }
+    std::sort(secondaries.begin(), secondaries.end(), [](const SecondaryCommands &a, const SecondaryCommands &b) {
+        return a.key < b.key;
+    });
+    return secondaries;
+}
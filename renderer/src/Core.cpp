@@ -25,6 +25,39 @@ MVR_API MVR_Result mvr_PresentFrame() {
     return res;
 }
 
+MVR_API MVR_Result mvr_SetPresentMode(MVR_PresentMode present_mode) {
+    MVR_Result res = MVR_RESULT_SUCCESS;
+    try {
+        MVRender::Renderer::instance().set_present_mode(present_mode);
+    } catch (MVRender::Exception& r) {
+        res = r.result();
+    }
+
+    return res;
+}
+
+MVR_API MVR_Result mvr_SetFrameRateLimit(double frames_per_second) {
+    MVR_Result res = MVR_RESULT_SUCCESS;
+    try {
+        MVRender::Renderer::instance().set_frame_rate_limit(frames_per_second);
+    } catch (MVRender::Exception& r) {
+        res = r.result();
+    }
+
+    return res;
+}
+
+MVR_API MVR_Result mvr_SetFramesInFlight(uint32_t count) {
+    MVR_Result res = MVR_RESULT_SUCCESS;
+    try {
+        MVRender::Renderer::instance().set_frames_in_flight(count);
+    } catch (MVRender::Exception& r) {
+        res = r.result();
+    }
+
+    return res;
+}
+
 MVR_API void mvr_Quit() {
     MVRender::Renderer::instance().quit_vulkan();
 }
\ No newline at end of file
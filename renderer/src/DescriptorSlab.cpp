@@ -0,0 +1,66 @@
+#include <fmt/core.h>
+#include <algorithm>
+
+#include "render/DescriptorSlab.hpp"
+#include "render/Logging.hpp"
+
+MVRender::DescriptorSlab::DescriptorSlab() {
+    for (auto &chunk: m_chunks) {
+        chunk.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+MVRender::DescriptorSlab::~DescriptorSlab() {
+    for (auto &chunk: m_chunks) {
+        delete[] chunk.load();
+    }
+}
+
+MVRender::BufferDescriptor *MVRender::DescriptorSlab::claim(uint32_t *slot) {
+    const uint32_t index = m_count.fetch_add(1, std::memory_order_relaxed);
+    const uint32_t chunk_index = index / TEMP_DESCRIPTOR_CHUNK_SIZE;
+    if (chunk_index >= MAX_TEMP_DESCRIPTOR_CHUNKS) {
+        throw Exception(MVR_RESULT_OUT_OF_MEMORY, fmt::format("Exceeded the limit of {} temporary buffers per frame", MAX_TEMP_DESCRIPTOR_CHUNKS * TEMP_DESCRIPTOR_CHUNK_SIZE));
+    }
+
+    // If this chunk doesn't exist yet whoever gets here first creates it
+    BufferDescriptor *chunk = m_chunks[chunk_index].load(std::memory_order_acquire);
+    if (chunk == nullptr) {
+        auto *new_chunk = new BufferDescriptor[TEMP_DESCRIPTOR_CHUNK_SIZE];
+        if (m_chunks[chunk_index].compare_exchange_strong(chunk, new_chunk, std::memory_order_acq_rel)) {
+            chunk = new_chunk;
+        } else {
+            delete[] new_chunk;
+        }
+    }
+    *slot = index;
+    return &chunk[index % TEMP_DESCRIPTOR_CHUNK_SIZE];
+}
+
+MVRender::BufferDescriptor *MVRender::DescriptorSlab::get(uint32_t slot) const {
+    if (slot >= size()) {
+        return nullptr;
+    }
+    BufferDescriptor *chunk = m_chunks[slot / TEMP_DESCRIPTOR_CHUNK_SIZE].load(std::memory_order_acquire);
+    return chunk != nullptr ? &chunk[slot % TEMP_DESCRIPTOR_CHUNK_SIZE] : nullptr;
+}
+
+uint32_t MVRender::DescriptorSlab::size() const {
+    // Failed claims still bump the count, so it can run past the real capacity
+    const uint32_t count = m_count.load(std::memory_order_relaxed);
+    const uint32_t capacity = MAX_TEMP_DESCRIPTOR_CHUNKS * TEMP_DESCRIPTOR_CHUNK_SIZE;
+    return count < capacity ? count : capacity;
+}
+
+VkDeviceSize MVRender::DescriptorSlab::total_buffer_bytes() const {
+    const uint32_t count = size();
+    VkDeviceSize total = 0;
+    for (uint32_t chunk_index = 0; chunk_index * TEMP_DESCRIPTOR_CHUNK_SIZE < count; chunk_index++) {
+        BufferDescriptor *chunk = m_chunks[chunk_index].load(std::memory_order_acquire);
+        const uint32_t chunk_count = std::min(count - chunk_index * TEMP_DESCRIPTOR_CHUNK_SIZE, TEMP_DESCRIPTOR_CHUNK_SIZE);
+        for (uint32_t i = 0; i < chunk_count; i++) {
+            total += chunk[i].size;
+        }
+    }
+    return total;
+}
@@ -0,0 +1,611 @@
+#define VK_NO_PROTOTYPES
+#include <volk.h>
+#include <vulkan/vk_enum_string_helper.h>
+#include <fmt/core.h>
+#include <algorithm>
+
+#include "render/FrameGraph.hpp"
+#include "render/Logging.hpp"
+#include "render/Trace.hpp"
+
+// Stands in for the frame's uploads, or whatever an image was doing before the frame
+constexpr MVRender::FramePass NO_PASS = UINT32_MAX;
+
+// A pass that read a resource since it was last written
+struct ReaderState {
+    MVRender::FramePass pass;
+    MVRender::FramePassQueue queue;
+    VkPipelineStageFlags2 stage;
+};
+
+struct MVRender::FrameGraphResourceState {
+    MVRender::FramePass writer;
+    MVRender::FramePassQueue writer_queue;
+    VkPipelineStageFlags2 write_stage;
+    VkAccessFlags2 write_access;
+    std::vector<ReaderState> readers;
+    VkImageLayout layout;
+    MVRender::FramePassQueue owner; // latest command buffer that had the resource, in submission order
+    VkPipelineStageFlags2 queue_stages[MVRender::FRAME_PASS_QUEUE_COUNT]; // everything each command buffer did with it
+    VkAccessFlags2 queue_writes[MVRender::FRAME_PASS_QUEUE_COUNT];
+};
+
+static void merge_barrier(MVRender::FrameGraphBarrier &into, const MVRender::FrameGraphBarrier &barrier) {
+    into.memory.srcStageMask |= barrier.memory.srcStageMask;
+    into.memory.srcAccessMask |= barrier.memory.srcAccessMask;
+    into.memory.dstStageMask |= barrier.memory.dstStageMask;
+    into.memory.dstAccessMask |= barrier.memory.dstAccessMask;
+    into.images.insert(into.images.end(), barrier.images.begin(), barrier.images.end());
+    into.image_resources.insert(into.image_resources.end(), barrier.image_resources.begin(), barrier.image_resources.end());
+    into.buffers.insert(into.buffers.end(), barrier.buffers.begin(), barrier.buffers.end());
+    into.buffer_resources.insert(into.buffer_resources.end(), barrier.buffer_resources.begin(), barrier.buffer_resources.end());
+}
+
+// Work that went out on the other queue is covered by the semaphore between the submissions
+static bool cross_queue(bool async_compute, MVRender::FramePassQueue a, MVRender::FramePassQueue b) {
+    return async_compute && a != b && (a == MVRender::FRAME_PASS_COMPUTE || b == MVRender::FRAME_PASS_COMPUTE);
+}
+
+// Adds what something on queue has to wait on once nothing else is going to use a resource
+static void wait_for_last_use(const MVRender::FrameGraphResourceState &state, MVRender::FramePassQueue queue, bool async_compute, VkPipelineStageFlags2 &stage, VkAccessFlags2 &access) {
+    if (state.readers.empty() && !cross_queue(async_compute, state.writer_queue, queue)) {
+        stage |= state.write_stage;
+        access |= state.write_access;
+    }
+    for (auto &reader: state.readers) {
+        if (!cross_queue(async_compute, reader.queue, queue)) {
+            stage |= reader.stage;
+        }
+    }
+}
+
+static MVRender::FrameGraphBarrier empty_barrier() {
+    MVRender::FrameGraphBarrier barrier = {};
+    barrier.memory.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    return barrier;
+}
+
+static void record_barrier(VkCommandBuffer commands, const MVRender::FrameGraphBarrier &barrier) {
+    VkDependencyInfo dependency_info = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .memoryBarrierCount = barrier.memory.dstStageMask != 0 ? 1u : 0u,
+            .pMemoryBarriers = &barrier.memory,
+            .bufferMemoryBarrierCount = static_cast<uint32_t>(barrier.buffers.size()),
+            .pBufferMemoryBarriers = barrier.buffers.data(),
+            .imageMemoryBarrierCount = static_cast<uint32_t>(barrier.images.size()),
+            .pImageMemoryBarriers = barrier.images.data(),
+    };
+    vkCmdPipelineBarrier2(commands, &dependency_info);
+}
+
+void MVRender::FrameGraph::reset() {
+    m_passes.clear();
+    m_resources.clear();
+    m_buffer_resources.clear();
+    m_image_resources.clear();
+    m_transient_images.clear();
+    m_culled.clear();
+    m_batches.clear();
+    m_final_barrier = empty_barrier();
+    for (auto &barrier: m_release_barriers) {
+        barrier = empty_barrier();
+    }
+    m_compiled = false;
+}
+
+void MVRender::FrameGraph::set_queue_families(uint32_t graphics_family, uint32_t compute_family) {
+    m_graphics_family = graphics_family;
+    m_compute_family = compute_family;
+}
+
+void MVRender::FrameGraph::transfer_ownership(FrameGraphBarrier &acquire, FrameGraphResource resource, FramePassQueue from, FramePassQueue to, VkImageLayout old_layout, VkImageLayout new_layout,
+                                              VkPipelineStageFlags2 src_stage, VkAccessFlags2 src_access, VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access) {
+    const FrameGraphResourceInfo &info = m_resources[resource];
+    FrameGraphBarrier &release = m_release_barriers[from];
+    if (info.is_image()) {
+        VkImageMemoryBarrier2 barrier = {
+                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+                .oldLayout = old_layout,
+                .newLayout = new_layout,
+                .srcQueueFamilyIndex = queue_family(from),
+                .dstQueueFamilyIndex = queue_family(to),
+                .image = info.image,
+                .subresourceRange = info.range,
+        };
+        release.images.push_back(barrier);
+        release.image_resources.push_back(resource);
+        barrier.srcStageMask = src_stage;
+        barrier.srcAccessMask = src_access;
+        barrier.dstStageMask = dst_stage;
+        barrier.dstAccessMask = dst_access;
+        acquire.images.push_back(barrier);
+        acquire.image_resources.push_back(resource);
+    } else {
+        VkBufferMemoryBarrier2 barrier = {
+                .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+                .srcQueueFamilyIndex = queue_family(from),
+                .dstQueueFamilyIndex = queue_family(to),
+                .buffer = info.buffer,
+                .offset = 0,
+                .size = VK_WHOLE_SIZE,
+        };
+        release.buffers.push_back(barrier);
+        release.buffer_resources.push_back(resource);
+        barrier.srcStageMask = src_stage;
+        barrier.srcAccessMask = src_access;
+        barrier.dstStageMask = dst_stage;
+        barrier.dstAccessMask = dst_access;
+        acquire.buffers.push_back(barrier);
+        acquire.buffer_resources.push_back(resource);
+    }
+}
+
+MVRender::FrameGraphResource MVRender::FrameGraph::import_buffer(VkBuffer buffer, const char *name, bool output) {
+    auto it = m_buffer_resources.find(buffer);
+    if (it != m_buffer_resources.end()) {
+        m_resources[it->second].output |= output;
+        return it->second;
+    }
+    const auto resource = static_cast<FrameGraphResource>(m_resources.size());
+    m_resources.push_back({
+            .buffer = buffer,
+            .image = VK_NULL_HANDLE,
+            .initial_layout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .final_layout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .output = output,
+            .name = name,
+    });
+    m_buffer_resources[buffer] = resource;
+    return resource;
+}
+
+MVRender::FrameGraphResource MVRender::FrameGraph::import_image(const FrameGraphImageInfo &info) {
+    auto it = m_image_resources.find(info.image);
+    if (it != m_image_resources.end()) {
+        // Only one import gets to say where the image ends up
+        FrameGraphResourceInfo &resource = m_resources[it->second];
+        if (resource.final_layout == VK_IMAGE_LAYOUT_UNDEFINED) {
+            resource.final_layout = info.final_layout;
+        } else if (info.final_layout != VK_IMAGE_LAYOUT_UNDEFINED && info.final_layout != resource.final_layout) {
+            throw Exception(MVR_RESULT_INVALID_ARGUMENT, fmt::format("Image {} was imported again with final layout {}, it already ends up in {}", resource.name, string_VkImageLayout(info.final_layout), string_VkImageLayout(resource.final_layout)));
+        }
+        resource.initial_stage |= info.initial_stage;
+        resource.output |= info.output;
+        return it->second;
+    }
+    const auto resource = static_cast<FrameGraphResource>(m_resources.size());
+    m_resources.push_back({
+            .buffer = VK_NULL_HANDLE,
+            .image = info.image,
+            .range = info.range,
+            .initial_layout = info.initial_layout,
+            .initial_stage = info.initial_stage,
+            .final_layout = info.final_layout,
+            .output = info.output,
+            .name = info.name,
+    });
+    m_image_resources[info.image] = resource;
+    return resource;
+}
+
+MVRender::FrameGraphResource MVRender::FrameGraph::create_image(const FrameGraphTransientImageInfo &info) {
+    if (info.width == 0 || info.height == 0 || info.usage == 0) {
+        throw Exception(MVR_RESULT_INVALID_ARGUMENT, fmt::format("Transient image {} is {}x{} with usage {}, it needs a size and a usage", info.name, info.width, info.height, info.usage));
+    }
+
+    // Zero mips or layers means one, so the range and the image agree
+    const uint32_t mip_levels = std::max(info.mip_levels, 1u);
+    const uint32_t array_layers = std::max(info.array_layers, 1u);
+    const auto resource = static_cast<FrameGraphResource>(m_resources.size());
+    m_resources.push_back({
+            .buffer = VK_NULL_HANDLE,
+            .image = VK_NULL_HANDLE,
+            .view = VK_NULL_HANDLE,
+            .range = {
+                    .aspectMask = info.aspect,
+                    .baseMipLevel = 0, .levelCount = mip_levels,
+                    .baseArrayLayer = 0, .layerCount = array_layers,
+            },
+            .initial_layout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .final_layout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .output = false,
+            .transient = true,
+            .description = {
+                    .format = info.format,
+                    .width = info.width,
+                    .height = info.height,
+                    .mip_levels = mip_levels,
+                    .array_layers = array_layers,
+                    .samples = info.samples,
+                    .usage = info.usage,
+                    .aspect = info.aspect,
+            },
+            .name = info.name,
+    });
+    m_transient_images.push_back(resource);
+    m_compiled = false;
+    return resource;
+}
+
+MVRender::FramePass MVRender::FrameGraph::add_pass(const char *name, FramePassQueue queue, std::function<void(VkCommandBuffer)> record) {
+    const auto pass = static_cast<FramePass>(m_passes.size());
+    m_passes.push_back({
+            .name = name,
+            .queue = queue,
+            .record = std::move(record),
+            .side_effects = false,
+    });
+    m_compiled = false;
+    return pass;
+}
+
+void MVRender::FrameGraph::add_access(FramePass pass, FrameGraphResource resource, VkPipelineStageFlags2 stage, VkAccessFlags2 access, VkImageLayout layout, bool write) {
+    if (pass >= m_passes.size() || resource >= m_resources.size()) {
+        throw Exception(MVR_RESULT_INVALID_ARGUMENT, fmt::format("Pass {} or resource {} isn't in the frame graph", pass, resource));
+    }
+    m_passes[pass].accesses.push_back({
+            .resource = resource,
+            .stage = stage,
+            .access = access,
+            .layout = m_resources[resource].is_image() ? layout : VK_IMAGE_LAYOUT_UNDEFINED,
+            .write = write,
+    });
+    m_compiled = false;
+}
+
+void MVRender::FrameGraph::read(FramePass pass, FrameGraphResource resource, VkPipelineStageFlags2 stage, VkAccessFlags2 access, VkImageLayout layout) {
+    add_access(pass, resource, stage, access, layout, false);
+}
+
+void MVRender::FrameGraph::write(FramePass pass, FrameGraphResource resource, VkPipelineStageFlags2 stage, VkAccessFlags2 access, VkImageLayout layout) {
+    add_access(pass, resource, stage, access, layout, true);
+}
+
+void MVRender::FrameGraph::set_side_effects(FramePass pass) {
+    m_passes.at(pass).side_effects = true;
+    m_compiled = false;
+}
+
+void MVRender::FrameGraph::cull_passes() {
+    // Find which pass wrote what each pass reads
+    std::vector<std::vector<FramePass>> producers(m_passes.size());
+    std::vector<FramePass> last_writer(m_resources.size(), NO_PASS);
+    std::vector<bool> live(m_passes.size(), false);
+    for (FramePass pass = 0; pass < m_passes.size(); pass++) {
+        live[pass] = m_passes[pass].side_effects;
+        for (auto &access: m_passes[pass].accesses) {
+            if (!access.write && last_writer[access.resource] != NO_PASS) {
+                producers[pass].push_back(last_writer[access.resource]);
+            }
+        }
+        for (auto &access: m_passes[pass].accesses) {
+            if (access.write) {
+                last_writer[access.resource] = pass;
+                live[pass] = live[pass] || m_resources[access.resource].output;
+            }
+        }
+    }
+
+    // Producers always come before the passes they feed, so one walk backwards reaches all of them
+    for (FramePass pass = static_cast<FramePass>(m_passes.size()); pass-- > 0;) {
+        if (live[pass]) {
+            for (FramePass producer: producers[pass]) {
+                live[producer] = true;
+            }
+        }
+    }
+    m_culled.resize(m_passes.size());
+    for (FramePass pass = 0; pass < m_passes.size(); pass++) {
+        m_culled[pass] = !live[pass];
+    }
+}
+
+void MVRender::FrameGraph::place_transient_images(TransientImagePool &transient_pool, bool async_compute, const std::vector<FrameGraphResourceState> &states) {
+    // Batches run in the order they're in, even across queues, so lifetimes are counted in batches
+    std::vector<uint32_t> first_batch(m_resources.size(), UINT32_MAX);
+    std::vector<uint32_t> last_batch(m_resources.size(), 0);
+    for (auto batch = 0u; batch < m_batches.size(); batch++) {
+        for (FramePass pass: m_batches[batch].passes) {
+            for (auto &access: m_passes[pass].accesses) {
+                first_batch[access.resource] = std::min(first_batch[access.resource], batch);
+                last_batch[access.resource] = std::max(last_batch[access.resource], batch);
+            }
+        }
+    }
+
+    // Images only culled passes used never get made
+    std::vector<FrameGraphResource> used;
+    std::vector<TransientImageRequest> requests;
+    std::vector<const char *> names;
+    for (FrameGraphResource resource: m_transient_images) {
+        if (first_batch[resource] == UINT32_MAX) {
+            continue;
+        }
+        used.push_back(resource);
+        requests.push_back({
+                .description = m_resources[resource].description,
+                .first_batch = first_batch[resource],
+                .last_batch = last_batch[resource],
+        });
+        names.push_back(m_resources[resource].name);
+    }
+    const std::vector<TransientImage> &images = transient_pool.place(requests, names);
+    for (size_t i = 0; i < used.size(); i++) {
+        m_resources[used[i]].image = images[i].image;
+        m_resources[used[i]].view = images[i].view;
+    }
+    auto patch_images = [this](FrameGraphBarrier &barrier) {
+        for (size_t i = 0; i < barrier.images.size(); i++) {
+            barrier.images[i].image = m_resources[barrier.image_resources[i]].image;
+        }
+    };
+    for (auto &batch: m_batches) {
+        patch_images(batch.barrier);
+    }
+    for (auto &barrier: m_release_barriers) {
+        patch_images(barrier);
+    }
+    patch_images(m_final_barrier);
+
+    // An image taking over memory from one that's done with it waits on everything that used the old one,
+    // in the barrier that takes it out of undefined at its first use
+    for (size_t after = 0; after < used.size(); after++) {
+        FrameGraphBatch &batch = m_batches[requests[after].first_batch];
+        for (size_t before = 0; before < used.size(); before++) {
+            const TransientImage &old_image = images[before];
+            const TransientImage &new_image = images[after];
+            if (!old_image.in_heap || !new_image.in_heap || requests[before].last_batch >= requests[after].first_batch ||
+                old_image.offset >= new_image.offset + new_image.size || new_image.offset >= old_image.offset + old_image.size) {
+                continue;
+            }
+            VkPipelineStageFlags2 src_stage = VK_PIPELINE_STAGE_2_NONE;
+            VkAccessFlags2 src_access = VK_ACCESS_2_NONE;
+            wait_for_last_use(states[used[before]], batch.queue, async_compute, src_stage, src_access);
+            if (src_stage == VK_PIPELINE_STAGE_2_NONE) {
+                continue;
+            }
+            auto it = std::find(batch.barrier.image_resources.begin(), batch.barrier.image_resources.end(), used[after]);
+            if (it != batch.barrier.image_resources.end()) {
+                VkImageMemoryBarrier2 &image_barrier = batch.barrier.images[it - batch.barrier.image_resources.begin()];
+                image_barrier.srcStageMask |= src_stage;
+                image_barrier.srcAccessMask |= src_access;
+            } else {
+                // First use didn't give a layout, so there's no transition to hang the wait on
+                batch.barrier.memory.srcStageMask |= src_stage;
+                batch.barrier.memory.srcAccessMask |= src_access;
+                batch.barrier.memory.dstStageMask |= VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+                batch.barrier.memory.dstAccessMask |= VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+            }
+        }
+    }
+}
+
+void MVRender::FrameGraph::compile(bool async_compute, TransientImagePool *transient_pool) {
+    MVR_TRACE_ZONE("FrameGraph::compile");
+    m_batches.clear();
+    m_final_barrier = empty_barrier();
+    for (auto &barrier: m_release_barriers) {
+        barrier = empty_barrier();
+    }
+    if (!m_transient_images.empty() && transient_pool == nullptr) {
+        throw Exception(MVR_RESULT_INVALID_ARGUMENT, "The frame graph has transient images but nowhere to put them");
+    }
+    cull_passes();
+
+    // Buffers start out written by the frame's uploads, images in whatever layout and stage they were imported with
+    std::vector<FrameGraphResourceState> states(m_resources.size());
+    for (size_t i = 0; i < m_resources.size(); i++) {
+        const bool image = m_resources[i].is_image();
+        states[i] = {
+                .writer = NO_PASS,
+                .writer_queue = FRAME_PASS_COPY,
+                .write_stage = image ? m_resources[i].initial_stage : VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+                .write_access = image ? VK_ACCESS_2_NONE : VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                .layout = m_resources[i].initial_layout,
+                .owner = FRAME_PASS_COPY,
+        };
+        states[i].queue_stages[FRAME_PASS_COPY] = states[i].write_stage;
+        states[i].queue_writes[FRAME_PASS_COPY] = states[i].write_access;
+    }
+
+    // Ownership only has to move if compute is on a family of its own
+    const bool transfers = async_compute && m_graphics_family != m_compute_family;
+
+    std::vector<uint32_t> levels(m_passes.size(), 0);
+    std::vector<FrameGraphBarrier> barriers(m_passes.size(), empty_barrier());
+    for (FramePass pass = 0; pass < m_passes.size(); pass++) {
+        if (m_culled[pass]) {
+            continue;
+        }
+        const FrameGraphPass &info = m_passes[pass];
+        for (auto &access: info.accesses) {
+            FrameGraphResourceState &state = states[access.resource];
+            const FrameGraphResourceInfo &resource = m_resources[access.resource];
+            const bool transition = resource.is_image() && access.layout != state.layout;
+
+            // Contents of images in undefined layout don't matter, so they can go to the new queue as they are
+            const bool transfer = transfers && info.queue > state.owner && queue_family(info.queue) != queue_family(state.owner) &&
+                                  !(resource.is_image() && state.layout == VK_IMAGE_LAYOUT_UNDEFINED);
+            const FramePassQueue owner = state.owner;
+            state.owner = std::max(state.owner, info.queue);
+            state.queue_stages[info.queue] |= access.stage;
+            if (access.write) {
+                state.queue_writes[info.queue] |= access.access;
+            }
+
+            // Gathers what this access has to wait on, and pushes the pass past producers in its own command buffer
+            VkPipelineStageFlags2 src_stage = VK_PIPELINE_STAGE_2_NONE;
+            VkAccessFlags2 src_access = VK_ACCESS_2_NONE;
+            auto wait_on = [&](FramePass producer, FramePassQueue producer_queue, VkPipelineStageFlags2 stage, VkAccessFlags2 producer_access) {
+                if (producer == pass) {
+                    return;
+                }
+                if (producer_queue > info.queue) {
+                    throw Exception(MVR_RESULT_INVALID_ARGUMENT, fmt::format(
+                            "Pass \"{}\" uses {} after pass \"{}\", but its command buffer is submitted first",
+                            info.name, resource.name, m_passes[producer].name
+                    ));
+                }
+                if (producer != NO_PASS && producer_queue == info.queue) {
+                    levels[pass] = std::max(levels[pass], levels[producer] + 1);
+                }
+                if (!cross_queue(async_compute, producer_queue, info.queue)) {
+                    src_stage |= stage;
+                    src_access |= producer_access;
+                }
+            };
+
+            // Writes and layout changes wait for everything reading the old contents, or the last write if
+            // nothing has. Plain reads only wait for the last write.
+            if (access.write || transition) {
+                if (state.readers.empty()) {
+                    wait_on(state.writer, state.writer_queue, state.write_stage, state.write_access);
+                }
+                for (auto &reader: state.readers) {
+                    wait_on(reader.pass, reader.queue, reader.stage, VK_ACCESS_2_NONE);
+                }
+                state.writer = pass;
+                state.writer_queue = info.queue;
+                state.write_stage = access.stage;
+                state.write_access = access.write ? access.access : VK_ACCESS_2_NONE;
+                state.readers.clear();
+            } else {
+                wait_on(state.writer, state.writer_queue, state.write_stage, state.write_access);
+                state.readers.push_back({.pass = pass, .queue = info.queue, .stage = access.stage});
+            }
+
+            if (transfer) {
+                // The acquire does the layout transition too, if there is one
+                const VkImageLayout new_layout = transition ? access.layout : state.layout;
+                transfer_ownership(barriers[pass], access.resource, owner, info.queue, state.layout, new_layout, src_stage, src_access, access.stage, access.access);
+                state.layout = new_layout;
+            } else if (transition) {
+                barriers[pass].images.push_back({
+                        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+                        .srcStageMask = src_stage,
+                        .srcAccessMask = src_access,
+                        .dstStageMask = access.stage,
+                        .dstAccessMask = access.access,
+                        .oldLayout = state.layout,
+                        .newLayout = access.layout,
+                        .image = resource.image,
+                        .subresourceRange = resource.range,
+                });
+                barriers[pass].image_resources.push_back(access.resource);
+                state.layout = access.layout;
+            } else if (src_stage != VK_PIPELINE_STAGE_2_NONE) {
+                VkMemoryBarrier2 &memory = barriers[pass].memory;
+                memory.srcStageMask |= src_stage;
+                memory.srcAccessMask |= src_access;
+                memory.dstStageMask |= access.stage;
+                memory.dstAccessMask |= access.access;
+            }
+        }
+    }
+
+    // Images that end the frame somewhere specific get moved there after the last graphics batch, and
+    // whatever compute still owns goes back to graphics. Transient images and images in undefined layout
+    // have nothing worth keeping, so they're left where they are.
+    for (size_t i = 0; i < m_resources.size(); i++) {
+        const FrameGraphResourceInfo &resource = m_resources[i];
+        FrameGraphResourceState &state = states[i];
+        const auto index = static_cast<FrameGraphResource>(i);
+        const bool final_transition = resource.is_image() && resource.final_layout != VK_IMAGE_LAYOUT_UNDEFINED && resource.final_layout != state.layout;
+        const bool give_back = transfers && state.owner == FRAME_PASS_COMPUTE && !resource.transient &&
+                               !(resource.is_image() && state.layout == VK_IMAGE_LAYOUT_UNDEFINED);
+        if (!final_transition && !give_back) {
+            continue;
+        }
+        const VkImageLayout new_layout = final_transition ? resource.final_layout : state.layout;
+        VkPipelineStageFlags2 src_stage = VK_PIPELINE_STAGE_2_NONE;
+        VkAccessFlags2 src_access = VK_ACCESS_2_NONE;
+        wait_for_last_use(state, FRAME_PASS_GRAPHICS, async_compute, src_stage, src_access);
+        if (give_back) {
+            transfer_ownership(m_final_barrier, index, FRAME_PASS_COMPUTE, FRAME_PASS_GRAPHICS, state.layout, new_layout,
+                               src_stage, src_access, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT);
+            continue;
+        }
+        m_final_barrier.images.push_back({
+                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+                .srcStageMask = src_stage,
+                .srcAccessMask = src_access,
+                .dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                .dstAccessMask = VK_ACCESS_2_NONE,
+                .oldLayout = state.layout,
+                .newLayout = resource.final_layout,
+                .image = resource.image,
+                .subresourceRange = resource.range,
+        });
+        m_final_barrier.image_resources.push_back(index);
+    }
+
+    // Releases wait on everything their command buffer did with the resource, including uses added after
+    // the pass that needed the transfer
+    for (auto queue = 0u; queue < FRAME_PASS_QUEUE_COUNT; queue++) {
+        FrameGraphBarrier &release = m_release_barriers[queue];
+        for (size_t i = 0; i < release.images.size(); i++) {
+            release.images[i].srcStageMask = states[release.image_resources[i]].queue_stages[queue];
+            release.images[i].srcAccessMask = states[release.image_resources[i]].queue_writes[queue];
+        }
+        for (size_t i = 0; i < release.buffers.size(); i++) {
+            release.buffers[i].srcStageMask = states[release.buffer_resources[i]].queue_stages[queue];
+            release.buffers[i].srcAccessMask = states[release.buffer_resources[i]].queue_writes[queue];
+        }
+    }
+
+    // Submission order first, then level, then the order passes were added in
+    std::vector<FramePass> order;
+    for (FramePass pass = 0; pass < m_passes.size(); pass++) {
+        if (!m_culled[pass]) {
+            order.push_back(pass);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [this, &levels](FramePass a, FramePass b) {
+        if (m_passes[a].queue != m_passes[b].queue) {
+            return m_passes[a].queue < m_passes[b].queue;
+        }
+        return levels[a] < levels[b];
+    });
+    for (FramePass pass: order) {
+        if (m_batches.empty() || m_batches.back().queue != m_passes[pass].queue || levels[m_batches.back().passes.front()] != levels[pass]) {
+            m_batches.push_back({.queue = m_passes[pass].queue, .barrier = empty_barrier()});
+        }
+        m_batches.back().passes.push_back(pass);
+        merge_barrier(m_batches.back().barrier, barriers[pass]);
+    }
+    if (!m_transient_images.empty()) {
+        place_transient_images(*transient_pool, async_compute, states);
+    }
+    m_compiled = true;
+}
+
+void MVRender::FrameGraph::execute(const FrameGraphCommands &commands) {
+    MVR_TRACE_ZONE("FrameGraph::execute");
+    if (!m_compiled) {
+        throw Exception(MVR_RESULT_INVALID_ARGUMENT, "The frame graph has to be compiled before it is executed");
+    }
+    const VkCommandBuffer command_buffers[FRAME_PASS_QUEUE_COUNT] = {
+            commands.copy_commands,
+            commands.compute_commands,
+            commands.draw_commands,
+    };
+    for (auto &batch: m_batches) {
+        VkCommandBuffer command_buffer = command_buffers[batch.queue];
+        if (!batch.barrier.empty()) {
+            record_barrier(command_buffer, batch.barrier);
+        }
+        for (FramePass pass: batch.passes) {
+            if (m_passes[pass].record) {
+                m_passes[pass].record(command_buffer);
+            }
+        }
+    }
+    for (auto queue = 0u; queue < FRAME_PASS_QUEUE_COUNT; queue++) {
+        if (!m_release_barriers[queue].empty()) {
+            record_barrier(command_buffers[queue], m_release_barriers[queue]);
+        }
+    }
+    if (!m_final_barrier.empty()) {
+        record_barrier(commands.draw_commands, m_final_barrier);
+    }
+}
@@ -0,0 +1,220 @@
+#define VK_NO_PROTOTYPES
+#include <volk.h>
+#include <vulkan/vk_enum_string_helper.h>
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <array>
+#include <cstdio>
+
+#include "render/GpuProfiler.hpp"
+#include "render/Renderer.hpp"
+#include "render/Logging.hpp"
+
+// Begin and end stamps of the copy, compute and draw command buffers, user zones come after
+constexpr uint32_t COPY_QUERY = 0;
+constexpr uint32_t COMPUTE_QUERY = 2;
+constexpr uint32_t DRAW_QUERY = 4;
+constexpr uint32_t STAGE_QUERIES = 6;
+constexpr uint32_t PROFILER_QUERIES = STAGE_QUERIES + MVR_MAX_GPU_ZONES * 2;
+
+static uint64_t valid_bits_mask(uint32_t valid_bits) {
+    return valid_bits >= 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+}
+
+MVRender::GpuProfiler::GpuProfiler(GpuProfilerCreateInfo &create_info) {
+    m_logical_device = create_info.logical_device;
+    m_graphics_mask = valid_bits_mask(create_info.graphics_valid_bits);
+    m_compute_mask = valid_bits_mask(create_info.compute_valid_bits);
+    m_period = create_info.timestamp_period / 1000000.0;
+    m_zones.reserve(MVR_MAX_GPU_ZONES);
+    if (create_info.graphics_valid_bits == 0) {
+        return;
+    }
+
+    VkQueryPoolCreateInfo query_pool_create_info = {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = PROFILER_QUERIES,
+    };
+    VkResult result = vkCreateQueryPool(m_logical_device, &query_pool_create_info, nullptr, &m_pool);
+    if (result != VK_SUCCESS) {
+        const char *string_result = string_VkResult(result);
+        throw Exception(MVR_RESULT_CRITICAL_VULKAN_ERROR, fmt::format("Failed to create timestamp query pool, Vulkan error {}", string_result));
+    }
+    Renderer::instance().debug_name_object(
+            reinterpret_cast<uint64_t>(m_pool),
+            VK_OBJECT_TYPE_QUERY_POOL,
+            fmt::format("Timestamp queries FIF[{}]", create_info.frame_in_flight_index)
+    );
+}
+
+MVRender::GpuProfiler::~GpuProfiler() {
+    if (m_pool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(m_logical_device, m_pool, nullptr);
+    }
+}
+
+double MVRender::GpuProfiler::elapsed(uint64_t begin, uint64_t end, uint64_t mask) const {
+    return static_cast<double>((end - begin) & mask) * m_period;
+}
+
+bool MVRender::GpuProfiler::resolve(MVR_GpuFrameStats *stats) {
+    if (m_pool == VK_NULL_HANDLE || m_frame == 0) {
+        return false;
+    }
+
+    // Each query comes back as its value then whether it's available, nothing here waits on the GPU
+    const auto query_count = static_cast<uint32_t>(STAGE_QUERIES + m_zones.size() * 2);
+    std::array<uint64_t, PROFILER_QUERIES * 2> results;
+    VkResult result = vkGetQueryPoolResults(
+            m_logical_device, m_pool, 0, query_count,
+            query_count * 2 * sizeof(uint64_t), results.data(), 2 * sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT
+    );
+    if (result != VK_SUCCESS && result != VK_NOT_READY) {
+        const char *string_result = string_VkResult(result);
+        throw Exception(MVR_RESULT_VULKAN_ERROR, fmt::format("Failed to get timestamp query results, Vulkan error {}", string_result));
+    }
+    auto available = [&results](uint32_t query) { return results[query * 2 + 1] != 0; };
+    auto value = [&results](uint32_t query) { return results[query * 2]; };
+
+    // Drawing ends last on the graphics queue, if that isn't in yet the frame isn't done
+    if (!available(COPY_QUERY) || !available(DRAW_QUERY + 1)) {
+        return false;
+    }
+    *stats = {};
+    stats->supported = true;
+    stats->frame = m_frame;
+    stats->copy_time = elapsed(value(COPY_QUERY), value(COPY_QUERY + 1), m_graphics_mask);
+    stats->draw_time = elapsed(value(DRAW_QUERY), value(DRAW_QUERY + 1), m_graphics_mask);
+    stats->total_time = elapsed(value(COPY_QUERY), value(DRAW_QUERY + 1), m_graphics_mask);
+    if (m_compute_mask != 0 && available(COMPUTE_QUERY) && available(COMPUTE_QUERY + 1)) {
+        stats->compute_time = elapsed(value(COMPUTE_QUERY), value(COMPUTE_QUERY + 1), m_compute_mask);
+    }
+    for (auto &zone: m_zones) {
+        if (!available(zone.query) || !available(zone.query + 1)) {
+            continue;
+        }
+        MVR_GpuZone &out = stats->zones[stats->zone_count++];
+        std::snprintf(out.name, sizeof(out.name), "%s", zone.name);
+        out.depth = zone.depth;
+        out.start = elapsed(value(COPY_QUERY), value(zone.query), m_graphics_mask);
+        out.duration = elapsed(value(zone.query), value(zone.query + 1), m_graphics_mask);
+    }
+    stats->dropped_zones = m_dropped_zones;
+    m_frame = 0;
+    return true;
+}
+
+void MVRender::GpuProfiler::begin_frame(uint64_t frame, VkCommandBuffer copy_commands, VkCommandBuffer compute_commands, VkCommandBuffer draw_commands) {
+    m_zones.clear();
+    m_open_zones.clear();
+    m_dropped_zones = 0;
+    m_stamps.clear();
+    m_next_stamp = 0;
+    m_stamp_depth = 0;
+    m_taking_zones = true;
+    m_frame = 0;
+    if (m_pool == VK_NULL_HANDLE) {
+        return;
+    }
+
+    // Copies are submitted before anything else in the frame, so the reset goes at the top of them
+    vkCmdResetQueryPool(copy_commands, m_pool, 0, PROFILER_QUERIES);
+    vkCmdWriteTimestamp2(copy_commands, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, m_pool, COPY_QUERY);
+    if (m_compute_mask != 0) {
+        vkCmdWriteTimestamp2(compute_commands, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, m_pool, COMPUTE_QUERY);
+    }
+    vkCmdWriteTimestamp2(draw_commands, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, m_pool, DRAW_QUERY);
+    m_frame = frame;
+}
+
+void MVRender::GpuProfiler::end_frame(VkCommandBuffer copy_commands, VkCommandBuffer compute_commands, VkCommandBuffer draw_commands) {
+    if (m_pool == VK_NULL_HANDLE) {
+        return;
+    }
+
+    vkCmdWriteTimestamp2(copy_commands, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, m_pool, COPY_QUERY + 1);
+    if (m_compute_mask != 0) {
+        vkCmdWriteTimestamp2(compute_commands, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, m_pool, COMPUTE_QUERY + 1);
+    }
+    vkCmdWriteTimestamp2(draw_commands, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, m_pool, DRAW_QUERY + 1);
+}
+
+void MVRender::GpuProfiler::push_zone(const char *name, uint32_t order) {
+    if (!m_taking_zones) {
+        throw Exception(MVR_RESULT_INVALID_ARGUMENT, "GPU zones can only be pushed while a frame is being recorded");
+    }
+
+    // Zones are still tracked without timestamps so pushes and pops have to match either way
+    if (m_zones.size() == MVR_MAX_GPU_ZONES) {
+        m_dropped_zones += 1;
+        m_open_zones.push_back({.zone = UINT32_MAX, .order = order});
+        return;
+    }
+    GpuZoneQueries zone = {
+            .depth = 0,
+            .query = static_cast<uint32_t>(STAGE_QUERIES + m_zones.size() * 2),
+    };
+    std::snprintf(zone.name, sizeof(zone.name), "%s", name);
+    const auto index = static_cast<uint32_t>(m_zones.size());
+    m_open_zones.push_back({.zone = index, .order = order});
+    m_zones.push_back(zone);
+    m_stamps.push_back({.position = secondary_position(order) - 1, .zone = index, .begin = true});
+}
+
+void MVRender::GpuProfiler::pop_zone(uint32_t order) {
+    if (!m_taking_zones) {
+        throw Exception(MVR_RESULT_INVALID_ARGUMENT, "GPU zones can only be popped while a frame is being recorded");
+    }
+    if (m_open_zones.empty()) {
+        throw Exception(MVR_RESULT_INVALID_ARGUMENT, "No GPU zone is open, every pop needs a push before it");
+    }
+    const GpuOpenZone open = m_open_zones.back();
+    if (order < open.order) {
+        throw Exception(MVR_RESULT_INVALID_ARGUMENT, fmt::format("A GPU zone pushed at order {} can't be popped at order {}", open.order, order));
+    }
+    m_open_zones.pop_back();
+    if (open.zone != UINT32_MAX) {
+        m_stamps.push_back({.position = secondary_position(order) + 1, .zone = open.zone, .begin = false});
+    }
+}
+
+void MVRender::GpuProfiler::close_zones() {
+    if (!m_open_zones.empty()) {
+        spdlog::warn("{} GPU zones were still open at the end of the frame, closing them.", m_open_zones.size());
+        while (!m_open_zones.empty()) {
+            pop_zone(UINT32_MAX);
+        }
+    }
+    m_taking_zones = false;
+
+    // Stamps at the same position stay in the order they were pushed and popped in, so nesting holds
+    std::stable_sort(m_stamps.begin(), m_stamps.end(), [](const GpuZoneStamp &a, const GpuZoneStamp &b) {
+        return a.position < b.position;
+    });
+}
+
+bool MVRender::GpuProfiler::has_stamps_before(uint64_t position) const {
+    return m_next_stamp < m_stamps.size() && m_stamps[m_next_stamp].position < position;
+}
+
+void MVRender::GpuProfiler::write_stamps(VkCommandBuffer commands, uint64_t position) {
+    for (; has_stamps_before(position); m_next_stamp++) {
+        const GpuZoneStamp &stamp = m_stamps[m_next_stamp];
+        GpuZoneQueries &zone = m_zones[stamp.zone];
+        if (stamp.begin) {
+            zone.depth = m_stamp_depth++;
+        } else {
+            m_stamp_depth -= 1;
+        }
+        if (m_pool != VK_NULL_HANDLE) {
+            vkCmdWriteTimestamp2(
+                    commands,
+                    stamp.begin ? VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT : VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                    m_pool,
+                    stamp.begin ? zone.query : zone.query + 1
+            );
+        }
+    }
+}
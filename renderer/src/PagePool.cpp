@@ -0,0 +1,311 @@
+#define VK_NO_PROTOTYPES
+#include <volk.h>
+#include <vulkan/vk_enum_string_helper.h>
+#include <vk_mem_alloc.h>
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include "render/PagePool.hpp"
+#include "render/Renderer.hpp"
+#include "render/Logging.hpp"
+
+// Vulkan usage flags for the buffers behind a page, not including transfer usage
+static VkBufferUsageFlags page_usage_flags(MVR_BufferUsage usage) {
+    switch (usage) {
+        case MVR_BUFFER_USAGE_VERTEX: return VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+        case MVR_BUFFER_USAGE_INDEX: return VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+        case MVR_BUFFER_USAGE_UNIFORM: return VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+        case MVR_BUFFER_USAGE_STORAGE: return VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+        case MVR_BUFFER_USAGE_INDIRECT: return VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+        default: return VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_TEXEL_BUFFER_BIT;
+    }
+}
+
+std::unique_ptr<MVRender::BufferPage> MVRender::PagePool::create_direct_page(MVR_BufferUsage usage, VkDeviceSize size) {
+    // One buffer that lives in device-local memory the host can write to, kept mapped forever
+    VkBuffer out_buffer;
+    VmaAllocation out_allocation;
+    VkBufferCreateInfo buffer_create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | page_usage_flags(usage), // readbacks copy out of it
+        .queueFamilyIndexCount = 1,
+        .pQueueFamilyIndices = &m_queue_family_index,
+    };
+    VmaAllocationCreateInfo allocation_create_info = {
+        .flags = VMA_ALLOCATION_CREATE_MAPPED_BIT,
+        .usage = VMA_MEMORY_USAGE_UNKNOWN,
+        .requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+        .preferredFlags = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+    };
+    VmaAllocationInfo allocation_info;
+    VkResult buffer_result = vmaCreateBuffer(m_vma, &buffer_create_info,
+        &allocation_create_info, &out_buffer, &out_allocation, &allocation_info);
+
+    if (buffer_result != VK_SUCCESS) {
+        const char *string_result = string_VkResult(buffer_result);
+        throw Exception(MVR_RESULT_VULKAN_ERROR, fmt::format("Failed to allocate direct buffer for new page, {}", string_result));
+    }
+
+    MVRender::Renderer::instance().debug_name_object(
+            reinterpret_cast<uint64_t>(out_buffer),
+            VK_OBJECT_TYPE_BUFFER,
+            fmt::format("Temp page[{}] (direct)", m_created_pages)
+    );
+
+    auto page = std::make_unique<BufferPage>();
+    page->vram_buffer = out_buffer;
+    page->vram_allocation = out_allocation;
+    page->staging_buffer = VK_NULL_HANDLE;
+    page->staging_allocation = VK_NULL_HANDLE;
+    page->offset = 0;
+    page->size = size;
+    page->data = allocation_info.pMappedData;
+    page->direct = true;
+    page->usage = usage;
+    page->last_used_frame = m_frame;
+    page->size_class = size_class(size);
+
+    VkMemoryPropertyFlags memory_flags;
+    vmaGetAllocationMemoryProperties(m_vma, out_allocation, &memory_flags);
+    page->coherent = (memory_flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+    return page;
+}
+
+std::unique_ptr<MVRender::BufferPage> MVRender::PagePool::create_staged_page(MVR_BufferUsage usage, VkDeviceSize size) {
+    auto &renderer = MVRender::Renderer::instance();
+
+    // Create the staging buffer
+    VkBuffer out_stage_buffer;
+    VmaAllocation out_stage_allocation;
+    VkBufferCreateInfo staging_buffer_create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        .queueFamilyIndexCount = 1,
+        .pQueueFamilyIndices = &m_queue_family_index,
+    };
+    VmaAllocationCreateInfo staging_allocation_create_info = {
+        .flags = VMA_ALLOCATION_CREATE_MAPPED_BIT,
+        .usage = VMA_MEMORY_USAGE_CPU_TO_GPU,
+        .requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+    };
+    VmaAllocationInfo stage_allocation_info;
+    VkResult stage_buffer_result = vmaCreateBuffer(m_vma, &staging_buffer_create_info,
+        &staging_allocation_create_info, &out_stage_buffer, &out_stage_allocation, &stage_allocation_info);
+
+    if (stage_buffer_result != VK_SUCCESS) {
+        const char *string_result = string_VkResult(stage_buffer_result);
+        throw Exception(MVR_RESULT_VULKAN_ERROR, fmt::format("Failed to allocate staging buffer for new page, {}", string_result));
+    }
+
+    renderer.debug_name_object(
+            reinterpret_cast<uint64_t>(out_stage_buffer),
+            VK_OBJECT_TYPE_BUFFER,
+            fmt::format("Temp page[{}] (staging)", m_created_pages)
+    );
+
+    // Create the device buffer
+    VkBuffer out_device_buffer;
+    VmaAllocation out_device_allocation;
+    VkBufferCreateInfo device_buffer_create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | page_usage_flags(usage),
+        .queueFamilyIndexCount = 1,
+        .pQueueFamilyIndices = &m_queue_family_index,
+    };
+    VmaAllocationCreateInfo device_allocation_create_info = {
+        .usage = VMA_MEMORY_USAGE_GPU_TO_CPU,
+        .requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+    };
+    VmaAllocationInfo device_allocation_info;
+    VkResult device_buffer_result = vmaCreateBuffer(m_vma, &device_buffer_create_info,
+        &device_allocation_create_info, &out_device_buffer, &out_device_allocation, &device_allocation_info);
+
+    if (device_buffer_result != VK_SUCCESS) {
+        // Gotta throw out the staging buffer
+        vmaDestroyBuffer(m_vma, out_stage_buffer, out_stage_allocation);
+
+        const char *string_result = string_VkResult(device_buffer_result);
+        throw Exception(MVR_RESULT_VULKAN_ERROR, fmt::format("Failed to allocate device buffer for new page, {}", string_result));
+    }
+
+    renderer.debug_name_object(
+            reinterpret_cast<uint64_t>(out_device_buffer),
+            VK_OBJECT_TYPE_BUFFER,
+            fmt::format("Temp page[{}] (device)", m_created_pages)
+    );
+
+    // The staging memory stays mapped for the whole life of the page
+    VkMemoryPropertyFlags memory_flags;
+    vmaGetAllocationMemoryProperties(m_vma, out_stage_allocation, &memory_flags);
+
+    auto page = std::make_unique<BufferPage>();
+    page->vram_buffer = out_device_buffer;
+    page->vram_allocation = out_device_allocation;
+    page->staging_buffer = out_stage_buffer;
+    page->staging_allocation = out_stage_allocation;
+    page->offset = 0;
+    page->size = size;
+    page->data = stage_allocation_info.pMappedData;
+    page->direct = false;
+    page->usage = usage;
+    page->coherent = (memory_flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+    page->last_used_frame = m_frame;
+    page->size_class = size_class(size);
+    return page;
+}
+
+uint32_t MVRender::PagePool::size_class(VkDeviceSize size) const {
+    uint32_t page_class = 0;
+    while ((m_page_size << page_class) < size) {
+        page_class++;
+    }
+    return page_class;
+}
+
+void MVRender::PagePool::destroy_page(BufferPage &page) {
+    vmaDestroyBuffer(m_vma, page.vram_buffer, page.vram_allocation);
+    if (!page.direct) {
+        vmaDestroyBuffer(m_vma, page.staging_buffer, page.staging_allocation);
+    }
+    m_page_count -= 1;
+    m_page_bytes -= page.size;
+}
+
+MVRender::PagePool::PagePool(PagePoolCreateInfo &create_info) {
+    m_vma = create_info.allocator;
+    m_page_size = create_info.page_size;
+    m_queue_family_index = create_info.queue_family_index;
+    m_trim_frames = create_info.trim_frames;
+
+    // UMA devices and ReBAR GPUs expose memory that is both device-local and host-visible,
+    // there is no reason to stage temp buffers on those
+    const VkPhysicalDeviceMemoryProperties *memory_properties;
+    vmaGetMemoryProperties(m_vma, &memory_properties);
+    const VkMemoryPropertyFlags direct_flags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    for (uint32_t i = 0; i < memory_properties->memoryTypeCount; i++) {
+        if ((memory_properties->memoryTypes[i].propertyFlags & direct_flags) == direct_flags) {
+            m_direct_write = true;
+            break;
+        }
+    }
+}
+
+MVRender::PagePool::~PagePool() {
+    for (auto &usage_bins: m_free_bins) {
+        for (auto &bin: usage_bins) {
+            for (auto &page: bin) {
+                destroy_page(*page);
+            }
+        }
+    }
+    if (m_page_count > 0) {
+        spdlog::warn("{} temp pages were still borrowed when the page pool was destroyed.", m_page_count);
+    }
+}
+
+std::unique_ptr<MVRender::BufferPage> MVRender::PagePool::acquire(MVR_BufferUsage usage, VkDeviceSize size) {
+    std::lock_guard lock(m_mutex);
+    const uint32_t page_class = size_class(size);
+    auto &usage_bins = m_free_bins[usage];
+
+    // Most recently released pages are at the back, and are the least likely to be trimmed
+    if (page_class < usage_bins.size() && !usage_bins[page_class].empty()) {
+        std::unique_ptr<BufferPage> page = std::move(usage_bins[page_class].back());
+        usage_bins[page_class].pop_back();
+        return page;
+    }
+
+    // Nothing idle in this size class, so make a new one
+    VkDeviceSize page_size = m_page_size << page_class;
+    std::unique_ptr<BufferPage> page;
+
+    // Skip staging entirely when the device lets us, the small device-local host-visible heap
+    // on some ReBAR-less GPUs can run out, in which case we fall back to a staged page
+    if (m_direct_write) {
+        try {
+            page = create_direct_page(usage, page_size);
+        } catch (MVRender::Exception& r) {
+            spdlog::warn("Falling back to a staged temp page, {}", mvr_GetError());
+        }
+    }
+    if (!page) {
+        page = create_staged_page(usage, page_size);
+    }
+
+    m_created_pages += 1;
+    m_page_count += 1;
+    m_page_bytes += page->size;
+    return page;
+}
+
+void MVRender::PagePool::release(std::unique_ptr<BufferPage> page) {
+    std::lock_guard lock(m_mutex);
+    page->offset.store(0, std::memory_order_relaxed);
+    page->last_used_frame = m_frame;
+    auto &usage_bins = m_free_bins[page->usage];
+    if (page->size_class >= usage_bins.size()) {
+        usage_bins.resize(page->size_class + 1);
+    }
+    usage_bins[page->size_class].emplace_back(std::move(page));
+}
+
+void MVRender::PagePool::record_frame_usage(VkDeviceSize used_bytes, VkDeviceSize requested_bytes) {
+    std::lock_guard lock(m_mutex);
+    if (used_bytes > m_high_water_mark) {
+        m_high_water_mark = used_bytes;
+    }
+    m_last_frame_bytes = used_bytes;
+    m_last_frame_waste = used_bytes > requested_bytes ? used_bytes - requested_bytes : 0;
+}
+
+void MVRender::PagePool::trim(uint64_t frame) {
+    std::lock_guard lock(m_mutex);
+    m_frame = frame;
+
+    // Bins are ordered by release, so idle pages are always at the front
+    size_t trimmed = 0;
+    for (auto &usage_bins: m_free_bins) {
+        for (auto &bin: usage_bins) {
+            size_t idle = 0;
+            while (idle < bin.size() && frame - bin[idle]->last_used_frame >= m_trim_frames) {
+                destroy_page(*bin[idle]);
+                idle++;
+            }
+            bin.erase(bin.begin(), bin.begin() + static_cast<ptrdiff_t>(idle));
+            trimmed += idle;
+        }
+    }
+
+    if (trimmed > 0) {
+        spdlog::info("Freed {} temp pages that were idle for {} frames.", trimmed, m_trim_frames);
+    }
+}
+
+size_t MVRender::PagePool::page_count() {
+    std::lock_guard lock(m_mutex);
+    return m_page_count;
+}
+
+VkDeviceSize MVRender::PagePool::page_bytes() {
+    std::lock_guard lock(m_mutex);
+    return m_page_bytes;
+}
+
+VkDeviceSize MVRender::PagePool::high_water_mark() {
+    std::lock_guard lock(m_mutex);
+    return m_high_water_mark;
+}
+
+MVRender::PagePoolStats MVRender::PagePool::stats() {
+    std::lock_guard lock(m_mutex);
+    return {
+        .page_count = m_page_count,
+        .page_bytes = m_page_bytes,
+        .high_water_mark = m_high_water_mark,
+        .last_frame_bytes = m_last_frame_bytes,
+        .last_frame_waste = m_last_frame_waste,
+    };
+}
@@ -0,0 +1,166 @@
+#define VK_NO_PROTOTYPES
+#include <volk.h>
+#include <vk_mem_alloc.h>
+#include <fmt/core.h>
+#include <unordered_map>
+
+#include "render/Renderer.hpp"
+#include "render/Readback.h"
+#include "render/Logging.hpp"
+
+MVR_Readback MVRender::Renderer::read_buffer_async(MVR_Buffer buffer, VkDeviceSize offset, VkDeviceSize size) {
+    BufferDescriptor *descriptor = resolve_buffer(buffer);
+    if (size == 0 || offset > descriptor->size || size > descriptor->size - offset) {
+        throw Exception(MVR_RESULT_INVALID_ARGUMENT, fmt::format("Readback of {} bytes at offset {} doesn't fit in a {} byte buffer", size, offset, descriptor->size));
+    }
+
+    // Space only comes back on its own if the oldest readback has been released, otherwise it's up to the user
+    uint64_t region;
+    VkDeviceSize readback_offset;
+    while (!m_readback_ring->try_allocate(size, &readback_offset, &region)) {
+        uint64_t oldest_value = m_readback_ring->oldest_value();
+        if (oldest_value == 0) {
+            throw Exception(MVR_RESULT_OUT_OF_MEMORY, fmt::format("No room for a {} byte readback, release old readbacks or make the readback ring bigger", size));
+        }
+        wait_for_timeline(oldest_value);
+        m_readback_ring->reclaim(oldest_value);
+    }
+
+    m_pending_readbacks.push_back({
+            .buffer = descriptor->buffer,
+            .buffer_offset = descriptor->offset + offset,
+            .readback_offset = readback_offset,
+            .size = size,
+    });
+    Readback *readback;
+    MVR_Readback handle = m_readbacks.insert(&readback);
+    readback->region = region;
+    readback->offset = readback_offset;
+    readback->size = size;
+    readback->ready_value = m_frame_count + 1;
+    return handle;
+}
+
+void MVRender::Renderer::record_pending_readbacks(VkCommandBuffer commands) {
+    if (m_pending_readbacks.empty()) {
+        return;
+    }
+
+    // Wait for anything this frame wrote, then copy each source buffer out in one go
+    VkMemoryBarrier2 barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+            .srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            .srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+            .dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT,
+    };
+    VkDependencyInfo dependency_info = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .memoryBarrierCount = 1,
+            .pMemoryBarriers = &barrier,
+    };
+    vkCmdPipelineBarrier2(commands, &dependency_info);
+
+    std::unordered_map<VkBuffer, std::vector<VkBufferCopy2>> regions;
+    for (auto &readback: m_pending_readbacks) {
+        regions[readback.buffer].push_back({
+                .sType = VK_STRUCTURE_TYPE_BUFFER_COPY_2,
+                .srcOffset = readback.buffer_offset,
+                .dstOffset = readback.readback_offset,
+                .size = readback.size,
+        });
+    }
+    for (auto &[buffer, buffer_regions]: regions) {
+        VkCopyBufferInfo2 copy_buffer_info = {
+                .sType = VK_STRUCTURE_TYPE_COPY_BUFFER_INFO_2,
+                .srcBuffer = buffer,
+                .dstBuffer = m_readback_ring->buffer(),
+                .regionCount = static_cast<uint32_t>(buffer_regions.size()),
+                .pRegions = buffer_regions.data(),
+        };
+        vkCmdCopyBuffer2(commands, &copy_buffer_info);
+    }
+
+    // The host reads the results once the timeline says the frame is done
+    barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+            .srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+            .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT,
+            .dstAccessMask = VK_ACCESS_2_HOST_READ_BIT,
+    };
+    vkCmdPipelineBarrier2(commands, &dependency_info);
+    m_pending_readbacks.clear();
+}
+
+bool MVRender::Renderer::is_readback_ready(MVR_Readback readback) {
+    Readback *r = m_readbacks.get(readback);
+    if (r == nullptr) {
+        return false;
+    }
+    uint64_t completed_value;
+    VkResult result = vkGetSemaphoreCounterValue(m_vk_logical_device, m_timeline_semaphore, &completed_value);
+    resolve_vulkan_error(result, false, "Failed to get timeline semaphore value");
+    return completed_value >= r->ready_value;
+}
+
+const void *MVRender::Renderer::get_readback_data(MVR_Readback readback) {
+    Readback *r = m_readbacks.get(readback);
+    if (r == nullptr) {
+        throw Exception(MVR_RESULT_INVALID_HANDLE, fmt::format("Readback handle {:#x} was released or was never valid", readback));
+    }
+    if (!is_readback_ready(readback)) {
+        throw Exception(MVR_RESULT_NOT_READY, "Readback is still in flight, check mvr_IsReadbackReady first");
+    }
+    m_readback_ring->invalidate(r->offset, r->size);
+    return m_readback_ring->data(r->offset);
+}
+
+void MVRender::Renderer::release_readback(MVR_Readback readback) {
+    Readback *r = m_readbacks.get(readback);
+    if (r == nullptr) {
+        throw Exception(MVR_RESULT_INVALID_HANDLE, fmt::format("Readback handle {:#x} was released or was never valid", readback));
+    }
+
+    // If the copy hasn't happened yet the space still waits for it before being reused
+    m_readback_ring->release(r->region);
+    m_readbacks.remove(readback);
+}
+
+MVR_API MVR_Result mvr_ReadBufferAsync(MVR_ReadBufferAsyncParams *params, MVR_Readback *readback) {
+    MVR_Result status = MVR_RESULT_SUCCESS;
+    *readback = MVR_INVALID_HANDLE;
+    try {
+        *readback = MVRender::Renderer::instance().read_buffer_async(params->buffer, params->offset, params->size);
+    } catch (MVRender::Exception& r) {
+        status = r.result();
+    }
+    return status;
+}
+
+MVR_API bool mvr_IsReadbackReady(MVR_Readback readback) {
+    try {
+        return MVRender::Renderer::instance().is_readback_ready(readback);
+    } catch (MVRender::Exception& r) {
+        return false;
+    }
+}
+
+MVR_API MVR_Result mvr_GetReadbackData(MVR_Readback readback, const void **data) {
+    MVR_Result status = MVR_RESULT_SUCCESS;
+    *data = nullptr;
+    try {
+        *data = MVRender::Renderer::instance().get_readback_data(readback);
+    } catch (MVRender::Exception& r) {
+        status = r.result();
+    }
+    return status;
+}
+
+MVR_API void mvr_ReleaseReadback(MVR_Readback readback) {
+    try {
+        MVRender::Renderer::instance().release_readback(readback);
+    } catch (MVRender::Exception& r) {
+        // Releasing twice is harmless, the error message says what happened
+    }
+}
@@ -6,13 +6,18 @@
 #include <SDL3/SDL_vulkan.h>
 #include <fmt/core.h>
 #include <spdlog/spdlog.h>
+#include <algorithm>
 
 #include "render/Renderer.hpp"
 #include "render/Logging.hpp"
 #include "render/Constants.hpp"
+#include "render/Trace.hpp"
 
 void MVRender::Renderer::initialize_vulkan(MVR_InitializeParams& params) {
+    validate_initialize_params(params);
     m_initialize_params = params;
+    m_headless = false;
+    m_swapchain_dirty = false;
     initialize_instance();
     initialize_function_pointers();
     build_surface_format();
@@ -40,13 +45,15 @@ void MVRender::Renderer::quit_vulkan() {
 }
 
 void MVRender::Renderer::initialize_vulkan_headless() {
-    // this is mostly the same as above but no window, so no surface and no swapchain
-    // therefore we can't test sync
+    // this is mostly the same as above but no window, so no surface and no swapchain,
+    // frames can still be run with begin_frame/end_frame but nothing gets presented
     MVR_InitializeParams params = {
             .debug = true,
             .present_mode = MVR_PRESENT_MODE_TRIPLE_BUFFER
     };
     m_initialize_params = params;
+    m_headless = true;
+    m_image_acquired = false;
     initialize_instance(true);
     initialize_function_pointers();
     initialize_sync();
@@ -59,11 +66,6 @@ void MVRender::Renderer::quit_vulkan_headless() {
     spdlog::info("Waiting for GPU to idle.");
     vkDeviceWaitIdle(m_vk_logical_device);
 
-    // Manually unmap page buffers
-    for (auto& page: m_frame_res) {
-        page.buffer_allocator.record_copy_commands(VK_NULL_HANDLE);
-    }
-
     // Destroy subsystems
     quit_frame_resources();
     quit_vma();
@@ -71,6 +73,24 @@ void MVRender::Renderer::quit_vulkan_headless() {
     quit_instance();
 
     spdlog::info("Freed Vulkan resources.");
+    if (m_validation_errors > 0) {
+        throw Exception(MVR_RESULT_VULKAN_ERROR, fmt::format("Validation layers reported {} errors", m_validation_errors.load()));
+    }
+}
+
+// Logs validation messages and counts the errors so tests can fail on them
+static VKAPI_ATTR VkBool32 VKAPI_CALL debug_callback(VkDebugUtilsMessageSeverityFlagBitsEXT severity, VkDebugUtilsMessageTypeFlagsEXT type, const VkDebugUtilsMessengerCallbackDataEXT *data, void *user_data) {
+    if (severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) {
+        spdlog::error("Vulkan: {}", data->pMessage);
+        if (type & VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT) {
+            static_cast<std::atomic<uint32_t> *>(user_data)->fetch_add(1);
+        }
+    } else if (severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT) {
+        spdlog::warn("Vulkan: {}", data->pMessage);
+    } else {
+        spdlog::info("Vulkan: {}", data->pMessage);
+    }
+    return VK_FALSE;
 }
 
 void MVRender::Renderer::initialize_instance(bool headless) {
@@ -84,8 +104,10 @@ void MVRender::Renderer::initialize_instance(bool headless) {
 
     // Create instance
     vkb::InstanceBuilder builder;
+    m_validation_errors = 0;
     builder.set_app_name("MVR")
-            .use_default_debug_messenger()
+            .set_debug_callback(debug_callback)
+            .set_debug_callback_user_data_pointer(&m_validation_errors)
             .require_api_version(1, 3, 0)
             .request_validation_layers(m_initialize_params.debug);
 
@@ -147,6 +169,10 @@ void MVRender::Renderer::initialize_instance(bool headless) {
 
     spdlog::info("Found suitable physical device {}.", phys_ret.value().name);
 
+    // Lets VMA report real heap budgets that account for other programs
+    m_memory_budget_enabled = phys_ret.value().enable_extension_if_present(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    spdlog::info("Memory budget extension {}found.", m_memory_budget_enabled ? "" : "not ");
+
     vkb::DeviceBuilder device_builder{ phys_ret.value () };
 
     // Enable required features
@@ -199,6 +225,33 @@ void MVRender::Renderer::initialize_instance(bool headless) {
     } else {
         spdlog::info("Created graphics/compute queue.");
     }
+
+    // Staging copies can run alongside drawing on a transfer-only queue, if there isn't one they share the graphics queue
+    auto transfer_queue_ret = m_vkb_logical_device.get_dedicated_queue(vkb::QueueType::transfer);
+    m_dedicated_transfer = transfer_queue_ret.has_value();
+    if (m_dedicated_transfer) {
+        m_vk_transfer_queue = transfer_queue_ret.value();
+        m_transfer_queue_family_index = m_vkb_logical_device.get_dedicated_queue_index(vkb::QueueType::transfer).value();
+        spdlog::info("Created dedicated transfer queue.");
+    } else {
+        m_vk_transfer_queue = m_vk_queue;
+        m_transfer_queue_family_index = m_queue_family_index;
+        spdlog::info("No dedicated transfer queue, copies will use the graphics queue.");
+    }
+
+    // Compute work can overlap drawing on a queue family without graphics, otherwise it shares the graphics queue
+    auto compute_queue_ret = m_vkb_logical_device.get_queue(vkb::QueueType::compute);
+    m_async_compute = compute_queue_ret.has_value();
+    if (m_async_compute) {
+        m_vk_compute_queue = compute_queue_ret.value();
+        m_compute_queue_family_index = m_vkb_logical_device.get_queue_index(vkb::QueueType::compute).value();
+        spdlog::info("Created async compute queue.");
+    } else {
+        m_vk_compute_queue = m_vk_queue;
+        m_compute_queue_family_index = m_queue_family_index;
+        spdlog::info("No async compute queue, compute will use the graphics queue.");
+    }
+    m_frame_graph.set_queue_families(m_queue_family_index, m_compute_queue_family_index);
 }
 
 void MVRender::Renderer::quit_instance() {
@@ -240,10 +293,16 @@ void MVRender::Renderer::build_surface_format() {
         throw Exception(MVR_RESULT_NO_DEVICE, "The device surface does not support an sRGB format.");
     }
 
-    // And fill out capabilities
+    // And fill out capabilities, some platforms leave the extent up to us so it comes from the window instead
     vkGetPhysicalDeviceSurfaceCapabilitiesKHR(m_vk_physical_device, m_vk_surface, &m_surface_format.caps);
     m_surface_format.width = m_surface_format.caps.currentExtent.width;
     m_surface_format.height = m_surface_format.caps.currentExtent.height;
+    if (m_surface_format.width == UINT32_MAX) {
+        int width, height;
+        SDL_GetWindowSizeInPixels(m_initialize_params.window, &width, &height);
+        m_surface_format.width = std::clamp(static_cast<uint32_t>(width), m_surface_format.caps.minImageExtent.width, m_surface_format.caps.maxImageExtent.width);
+        m_surface_format.height = std::clamp(static_cast<uint32_t>(height), m_surface_format.caps.minImageExtent.height, m_surface_format.caps.maxImageExtent.height);
+    }
     m_surface_format.max_image_count = m_surface_format.caps.maxImageCount;
     m_surface_format.min_image_count = m_surface_format.caps.minImageCount;
     m_surface_format.format = surface_format.format;
@@ -265,10 +324,9 @@ void MVRender::Renderer::build_surface_format() {
     spdlog::info("Built surface format information.");
 }
 
-void MVRender::Renderer::initialize_swapchain() {
+void MVRender::Renderer::initialize_swapchain(VkSwapchainKHR old_swapchain) {
     VkSwapchainCreateInfoKHR sc_create_info = {
             .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
-            //.oldSwapchain = nullptr, TODO: Possibly use this later down the line
             .surface = m_vk_surface,
             .minImageCount = m_surface_format.min_image_count <= 3 ? 3 : m_surface_format.min_image_count,
             .imageFormat = m_surface_format.format,
@@ -284,6 +342,7 @@ void MVRender::Renderer::initialize_swapchain() {
             .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
             .presentMode = get_present_mode(m_initialize_params.present_mode),
             .clipped = true,
+            .oldSwapchain = old_swapchain, // lets the driver hand resources over instead of starting from scratch
     };
     VkResult swapchain_result = vkCreateSwapchainKHR(m_vk_logical_device, &sc_create_info, VK_NULL_HANDLE, &m_vk_swapchain);
 
@@ -398,6 +457,60 @@ void MVRender::Renderer::quit_swapchain() {
     vkDestroySwapchainKHR(m_vk_logical_device, m_vk_swapchain, nullptr);
 }
 
+bool MVRender::Renderer::recreate_swapchain() {
+    // A minimized window has no area and can't have a swapchain, frames carry on without presenting until it comes back
+    build_surface_format();
+    if (m_surface_format.width == 0 || m_surface_format.height == 0) {
+        m_swapchain_dirty = true;
+        return false;
+    }
+
+    // Frames that are still in flight present from the old swapchain, so it and its views and semaphores
+    // stay alive until the last of those frames and the first on the new swapchain are done
+    VkSwapchainKHR old_swapchain = m_vk_swapchain;
+    std::vector<SwapchainResources> old_swapchain_res = std::move(m_swapchain_res);
+    m_swapchain_res.clear();
+    initialize_swapchain(old_swapchain);
+    m_deletion_queue.push(m_frame_count + 1, [this, old_swapchain, old_swapchain_res]() {
+        for (auto &swapchain_resource: old_swapchain_res) {
+            vkDestroyImageView(m_vk_logical_device, swapchain_resource.image_view, nullptr);
+            vkDestroySemaphore(m_vk_logical_device, swapchain_resource.submit_ready_semaphore, nullptr);
+            vkDestroySemaphore(m_vk_logical_device, swapchain_resource.image_ready_semaphore, nullptr);
+        }
+        vkDestroySwapchainKHR(m_vk_logical_device, old_swapchain, nullptr);
+    });
+    m_swapchain_dirty = false;
+    spdlog::info("Recreated swapchain at {}x{}.", m_surface_format.width, m_surface_format.height);
+    return true;
+}
+
+void MVRender::Renderer::acquire_swapchain_image() {
+    m_image_acquired = false;
+    if (m_swapchain_dirty && !recreate_swapchain()) {
+        return;
+    }
+
+    // Out of date means nothing was acquired so the swapchain has to be rebuilt right away, suboptimal
+    // still hands over an image so the rebuild can wait for the next frame
+    VkResult acquire_result = vkAcquireNextImageKHR(m_vk_logical_device, m_vk_swapchain, UINT64_MAX, m_swapchain_res[m_frame_count % m_swapchain_image_count].image_ready_semaphore, nullptr, &m_current_sc_image);
+    if (acquire_result == VK_ERROR_OUT_OF_DATE_KHR) {
+        if (!recreate_swapchain()) {
+            return;
+        }
+        acquire_result = vkAcquireNextImageKHR(m_vk_logical_device, m_vk_swapchain, UINT64_MAX, m_swapchain_res[m_frame_count % m_swapchain_image_count].image_ready_semaphore, nullptr, &m_current_sc_image);
+    }
+    if (acquire_result == VK_SUBOPTIMAL_KHR) {
+        m_swapchain_dirty = true;
+    } else if (acquire_result == VK_ERROR_OUT_OF_DATE_KHR) {
+        m_swapchain_dirty = true; // still out of date right after a rebuild, skip presenting this frame
+        return;
+    } else if (acquire_result != VK_SUCCESS) {
+        const char *string_result = string_VkResult(acquire_result);
+        throw Exception(MVR_RESULT_CRITICAL_VULKAN_ERROR, fmt::format("Failed to acquire swapchain image, Vulkan error {}", string_result));
+    }
+    m_image_acquired = true;
+}
+
 void MVRender::Renderer::initialize_sync() {
     VkSemaphoreTypeCreateInfo timeline_create_info = {
             .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
@@ -418,18 +531,65 @@ void MVRender::Renderer::initialize_sync() {
             VK_OBJECT_TYPE_SEMAPHORE,
             fmt::format("Semaphore - timeline")
     );
-    spdlog::info("Create timeline semaphore.");
+
+    // The transfer queue gets its own timeline so the graphics submit can wait on the frame's copies
+    result = vkCreateSemaphore(m_vk_logical_device, &semaphore_create_info, nullptr, &m_transfer_semaphore);
+    if (result != VK_SUCCESS) {
+        const char *string_result = string_VkResult(result);
+        throw Exception(MVR_RESULT_CRITICAL_VULKAN_ERROR, fmt::format("Failed to create transfer timeline semaphore, Vulkan error {}", string_result));
+    }
+    debug_name_object(
+            reinterpret_cast<uint64_t>(m_transfer_semaphore),
+            VK_OBJECT_TYPE_SEMAPHORE,
+            fmt::format("Semaphore - transfer timeline")
+    );
+
+    // With async compute the frame's copies, compute and drawing each signal their own timeline
+    result = vkCreateSemaphore(m_vk_logical_device, &semaphore_create_info, nullptr, &m_copy_semaphore);
+    if (result != VK_SUCCESS) {
+        const char *string_result = string_VkResult(result);
+        throw Exception(MVR_RESULT_CRITICAL_VULKAN_ERROR, fmt::format("Failed to create copy timeline semaphore, Vulkan error {}", string_result));
+    }
+    debug_name_object(
+            reinterpret_cast<uint64_t>(m_copy_semaphore),
+            VK_OBJECT_TYPE_SEMAPHORE,
+            fmt::format("Semaphore - copy timeline")
+    );
+    result = vkCreateSemaphore(m_vk_logical_device, &semaphore_create_info, nullptr, &m_compute_semaphore);
+    if (result != VK_SUCCESS) {
+        const char *string_result = string_VkResult(result);
+        throw Exception(MVR_RESULT_CRITICAL_VULKAN_ERROR, fmt::format("Failed to create compute timeline semaphore, Vulkan error {}", string_result));
+    }
+    debug_name_object(
+            reinterpret_cast<uint64_t>(m_compute_semaphore),
+            VK_OBJECT_TYPE_SEMAPHORE,
+            fmt::format("Semaphore - compute timeline")
+    );
+    spdlog::info("Create timeline semaphores.");
+
+    VkFenceCreateInfo fence_create_info = {
+            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    };
+    result = vkCreateFence(m_vk_logical_device, &fence_create_info, nullptr, &m_single_use_fence);
+    if (result != VK_SUCCESS) {
+        const char *string_result = string_VkResult(result);
+        throw Exception(MVR_RESULT_CRITICAL_VULKAN_ERROR, fmt::format("Failed to create single-use fence, Vulkan error {}", string_result));
+    }
 }
 
 void MVRender::Renderer::quit_sync() {
+    vkDestroyFence(m_vk_logical_device, m_single_use_fence, nullptr);
+    vkDestroySemaphore(m_vk_logical_device, m_compute_semaphore, nullptr);
+    vkDestroySemaphore(m_vk_logical_device, m_copy_semaphore, nullptr);
+    vkDestroySemaphore(m_vk_logical_device, m_transfer_semaphore, nullptr);
     vkDestroySemaphore(m_vk_logical_device, m_timeline_semaphore, nullptr);
 }
 
 void MVRender::Renderer::initialize_frame_resources() {
-    // Create command pool
+    // Create the command pool single-use command buffers come from
     VkCommandPoolCreateInfo command_pool_create_info = {
             .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-            .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+            .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
             .queueFamilyIndex = m_queue_family_index,
     };
     VkResult command_pool_result = vkCreateCommandPool(m_vk_logical_device, &command_pool_create_info, nullptr, &m_command_pool);
@@ -438,67 +598,166 @@ void MVRender::Renderer::initialize_frame_resources() {
         throw Exception(MVR_RESULT_CRITICAL_VULKAN_ERROR, fmt::format("Failed to create command pool, Vulkan error {}", string_result));
     }
 
-    // Create per-frame resources
-    for (int i = 0; i < FRAMES_IN_FLIGHT; i++) {
-        VkCommandBuffer command_buffers[3];
-        VkCommandBufferAllocateInfo allocate_info = {
-                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-                .commandPool = m_command_pool,
-                .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-                .commandBufferCount = 3,
-        };
-        VkResult allocate_result = vkAllocateCommandBuffers(m_vk_logical_device, &allocate_info, command_buffers);
-        if (allocate_result != VK_SUCCESS) {
-            const char *string_result = string_VkResult(allocate_result);
-            throw Exception(MVR_RESULT_CRITICAL_VULKAN_ERROR, fmt::format("Failed to create command buffers, Vulkan error {}", string_result));
+    // Transfer queue command buffers have to come from a pool of the transfer family
+    m_transfer_command_pool = VK_NULL_HANDLE;
+    if (m_dedicated_transfer) {
+        command_pool_create_info.queueFamilyIndex = m_transfer_queue_family_index;
+        command_pool_result = vkCreateCommandPool(m_vk_logical_device, &command_pool_create_info, nullptr, &m_transfer_command_pool);
+        if (command_pool_result != VK_SUCCESS) {
+            const char *string_result = string_VkResult(command_pool_result);
+            throw Exception(MVR_RESULT_CRITICAL_VULKAN_ERROR, fmt::format("Failed to create transfer command pool, Vulkan error {}", string_result));
         }
+    }
 
-        BufferAllocatorCreateInfo buffer_allocator_create_info = {
-                .allocator = m_vma,
-                .logical_device = m_vk_logical_device,
-                .page_size = VRAM_PAGE_SIZE,
-                .queue_family_index = m_queue_family_index,
-                .device_properties = m_vk_physical_device_properties,
-                .frame_in_flight_index = static_cast<uint32_t>(i),
-        };
+    // Every frame's temp buffer allocator borrows pages from the same pool
+    PagePoolCreateInfo page_pool_create_info = {
+            .allocator = m_vma,
+            .page_size = VRAM_PAGE_SIZE,
+            .queue_family_index = m_queue_family_index,
+            .trim_frames = TEMP_PAGE_TRIM_FRAMES,
+    };
+    m_page_pool = std::make_unique<PagePool>(page_pool_create_info);
+
+    // Permanent uploads all stream through one ring that lives as long as the renderer
+    StagingRingCreateInfo staging_ring_create_info = {
+            .allocator = m_vma,
+            .size = m_initialize_params.staging_ring_size != 0 ? m_initialize_params.staging_ring_size : STAGING_RING_SIZE,
+            .queue_family_index = m_queue_family_index,
+            .readback = false,
+    };
+    m_staging_ring = std::make_unique<StagingRing>(staging_ring_create_info);
+
+    // Readbacks get their own ring of host-cached memory
+    StagingRingCreateInfo readback_ring_create_info = {
+            .allocator = m_vma,
+            .size = m_initialize_params.readback_ring_size != 0 ? m_initialize_params.readback_ring_size : READBACK_RING_SIZE,
+            .queue_family_index = m_queue_family_index,
+            .readback = true,
+    };
+    m_readback_ring = std::make_unique<StagingRing>(readback_ring_create_info);
+
+    SharedBufferPoolCreateInfo shared_buffer_pool_create_info = {
+            .allocator = m_vma,
+            .block_size = SHARED_BUFFER_BLOCK_SIZE,
+            .threshold = SHARED_BUFFER_THRESHOLD,
+            .device_properties = m_vk_physical_device_properties,
+            .queue_family_index = m_queue_family_index,
+    };
+    m_shared_buffers = std::make_unique<SharedBufferPool>(shared_buffer_pool_create_info);
 
-        FrameResources res = {
-                .copy_commands = command_buffers[0],
-                .compute_commands = command_buffers[1],
-                .draw_commands = command_buffers[2],
-                .buffer_allocator = BufferAllocator(buffer_allocator_create_info),
-        };
+    // Create per-frame resources
+    m_frames_in_flight = m_initialize_params.frames_in_flight != 0 ? m_initialize_params.frames_in_flight : FRAMES_IN_FLIGHT;
+    m_requested_frames_in_flight = m_frames_in_flight;
+    reset_frame_timing();
+    m_frame_timings = {};
+    m_unfinished_timing = m_frame_count + 1;
+    m_last_present_time = {};
+    m_gpu_frame_stats = {};
+    set_frame_rate_limit(m_initialize_params.frame_rate_limit);
+    for (uint32_t i = 0; i < m_frames_in_flight; i++) {
+        create_frame_resources(i);
+    }
+    spdlog::info("Created per-frame resources, temp buffers are {}.",
+                 m_page_pool->writes_directly() ? "written directly to vram" : "staged");
+}
 
-        m_frame_res.push_back(res);
+void MVRender::Renderer::create_frame_resources(uint32_t index) {
+    CommandRecorderCreateInfo command_recorder_create_info = {
+            .logical_device = m_vk_logical_device,
+            .graphics_queue_family = m_queue_family_index,
+            .transfer_queue_family = m_transfer_queue_family_index,
+            .compute_queue_family = m_compute_queue_family_index,
+            .dedicated_transfer = m_dedicated_transfer,
+            .async_compute = m_async_compute,
+            .frame_in_flight_index = index,
+    };
+    auto command_recorder = std::make_unique<CommandRecorder>(command_recorder_create_info);
+
+    BufferAllocatorCreateInfo buffer_allocator_create_info = {
+            .allocator = m_vma,
+            .logical_device = m_vk_logical_device,
+            .page_pool = m_page_pool.get(),
+            .device_properties = m_vk_physical_device_properties,
+            .frame_in_flight_index = index,
+    };
 
-        debug_name_object(
-                reinterpret_cast<uint64_t>(command_buffers[0]),
-                VK_OBJECT_TYPE_COMMAND_BUFFER,
-                fmt::format("Command buffer FIF[{}] copy", i)
-        );
-        debug_name_object(
-                reinterpret_cast<uint64_t>(command_buffers[1]),
-                VK_OBJECT_TYPE_COMMAND_BUFFER,
-                fmt::format("Command buffer FIF[{}] compute", i)
-        );
-        debug_name_object(
-                reinterpret_cast<uint64_t>(command_buffers[2]),
-                VK_OBJECT_TYPE_COMMAND_BUFFER,
-                fmt::format("Command buffer FIF[{}] drawing", i)
-        );
+    // Timestamps are only taken on queues that can write them, compute may be on a family that can't
+    GpuProfilerCreateInfo gpu_profiler_create_info = {
+            .logical_device = m_vk_logical_device,
+            .graphics_valid_bits = m_vkb_logical_device.queue_families[m_queue_family_index].timestampValidBits,
+            .compute_valid_bits = m_vkb_logical_device.queue_families[m_compute_queue_family_index].timestampValidBits,
+            .timestamp_period = m_vk_physical_device_properties.limits.timestampPeriod,
+            .frame_in_flight_index = index,
+    };
+
+    TransientImagePoolCreateInfo transient_image_pool_create_info = {
+            .allocator = m_vma,
+            .logical_device = m_vk_logical_device,
+            .frame_in_flight_index = index,
+    };
+
+    FrameResources res = {
+            .copy_commands = command_recorder->copy_commands(),
+            .compute_commands = command_recorder->compute_commands(),
+            .draw_commands = command_recorder->draw_commands(),
+            .transfer_commands = command_recorder->transfer_commands(),
+            .command_recorder = std::move(command_recorder),
+            .buffer_allocator = std::make_unique<BufferAllocator>(buffer_allocator_create_info),
+            .gpu_profiler = std::make_unique<GpuProfiler>(gpu_profiler_create_info),
+            .transient_images = std::make_unique<TransientImagePool>(transient_image_pool_create_info),
+    };
+    m_frame_res.push_back(std::move(res));
+}
+
+void MVRender::Renderer::destroy_frame_resources(FrameResources &frame) {
+    frame.command_recorder.reset(); // takes the frame's command buffers with it
+    frame.buffer_allocator.reset(); // hands its pages back to the pool
+    frame.gpu_profiler.reset();
+    frame.transient_images.reset();
+}
+
+void MVRender::Renderer::apply_frames_in_flight() {
+    // Every frame has to be done before their resources can be shuffled around, frames are
+    // picked with m_frame_count % m_frames_in_flight so which one is next changes too
+    wait_for_timeline(m_frame_count);
+    while (m_frame_res.size() > m_requested_frames_in_flight) {
+        destroy_frame_resources(m_frame_res.back());
+        m_frame_res.pop_back();
     }
-    spdlog::info("Created per-frame resources.");
+    for (auto i = static_cast<uint32_t>(m_frame_res.size()); i < m_requested_frames_in_flight; i++) {
+        create_frame_resources(i);
+    }
+    spdlog::info("Frames in flight changed from {} to {}.", m_frames_in_flight, m_requested_frames_in_flight);
+    m_frames_in_flight = m_requested_frames_in_flight;
+
+    // Timings from the old setting would muddy the new one
+    reset_frame_timing();
 }
 
 void MVRender::Renderer::quit_frame_resources() {
     vkDestroyCommandPool(m_vk_logical_device, m_command_pool, nullptr);
+    if (m_transfer_command_pool != VK_NULL_HANDLE) {
+        vkDestroyCommandPool(m_vk_logical_device, m_transfer_command_pool, nullptr);
+    }
+
+    // The GPU is idle by now, so deferred deletions and the staging ring can go
+    m_deletion_queue.flush_all();
+    m_pending_uploads.clear();
+    m_pending_updates.clear();
+    m_pending_readbacks.clear();
+    m_readbacks.clear();
+    m_staging_ring.reset();
+    m_readback_ring.reset();
+    m_shared_buffers.reset();
     // Intentionally free items in the frame resource list to call their destructors
     m_frame_res.resize(0);
+    m_page_pool.reset(); // allocators give their pages back when destroyed, so this goes last
     spdlog::info("Freed per-frame resources.");
 }
 
 void MVRender::Renderer::initialize_vma() {
     VmaAllocatorCreateInfo allocator_create_info = {
+        .flags = m_memory_budget_enabled ? static_cast<VmaAllocatorCreateFlags>(VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT) : 0u,
         .physicalDevice = m_vk_physical_device,
         .device = m_vk_logical_device,
         .instance = m_vk_instance,
@@ -523,8 +782,15 @@ void MVRender::Renderer::quit_vma() {
 }
 
 void MVRender::Renderer::begin_frame() {
-    // Wait for frames-in-flight to catch up
-    uint64_t wait_value = m_frame_count - FRAMES_IN_FLIGHT + 1;
+    MVR_TRACE_ZONE("Renderer::begin_frame");
+    if (m_requested_frames_in_flight != m_frames_in_flight) {
+        apply_frames_in_flight();
+    }
+    const std::chrono::steady_clock::duration limiter_time = limit_frame_rate();
+
+    // Wait for frames-in-flight to catch up, timing how long the CPU sits here
+    auto wait_start = std::chrono::steady_clock::now();
+    uint64_t wait_value = m_frame_count - m_frames_in_flight + 1;
     VkSemaphoreWaitInfo semaphore_wait_info = {
         .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
         .semaphoreCount = 1,
@@ -532,86 +798,197 @@ void MVRender::Renderer::begin_frame() {
         .pValues = &wait_value,
     };
     vkWaitSemaphores(m_vk_logical_device, &semaphore_wait_info, UINT64_MAX);
-
-    // Reset and begin this frame's command buffers
-    FrameResources *frame = &m_frame_res[m_frame_count % FRAMES_IN_FLIGHT];
-    vkResetCommandBuffer(frame->compute_commands, 0);
-    vkResetCommandBuffer(frame->copy_commands, 0);
-    vkResetCommandBuffer(frame->draw_commands, 0);
+    auto wait_end = std::chrono::steady_clock::now();
+    record_frame_timing(wait_start, wait_end);
+
+    // Staging space and resources the finished frames were using can be reused
+    uint64_t completed_value;
+    VkResult counter_result = vkGetSemaphoreCounterValue(m_vk_logical_device, m_timeline_semaphore, &completed_value);
+    resolve_vulkan_error(counter_result, false, "Failed to get timeline semaphore value");
+    finish_frame_timings(completed_value, wait_end);
+    m_staging_ring->reclaim(completed_value);
+    m_readback_ring->reclaim(completed_value);
+    m_deletion_queue.flush(completed_value);
+
+    // Reset all of this frame's command pools at once and begin its command buffers
+    FrameResources *frame = &m_frame_res[m_frame_count % m_frames_in_flight];
+    frame->command_recorder->begin_frame();
 
     VkCommandBufferBeginInfo begin_info = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
     };
     vkBeginCommandBuffer(frame->compute_commands, &begin_info);
     vkBeginCommandBuffer(frame->copy_commands, &begin_info);
     vkBeginCommandBuffer(frame->draw_commands, &begin_info);
+    if (m_dedicated_transfer) {
+        vkBeginCommandBuffer(frame->transfer_commands, &begin_info);
+    }
+
+    // The last frame this slot ran is done, so its timestamps can be read before the pool is reset
+    frame->gpu_profiler->resolve(&m_gpu_frame_stats);
+    frame->gpu_profiler->begin_frame(m_frame_count + 1, frame->copy_commands, frame->compute_commands, frame->draw_commands);
 
-    // Prepare temp buffers
-    frame->buffer_allocator.begin_frame();
+    // Passes from the last frame are already recorded
+    m_frame_graph.reset();
+
+    // Prepare temp buffers, then let go of pages nobody has needed in a while
+    frame->buffer_allocator->begin_frame();
+    m_page_pool->trim(m_frame_count);
 
     // Now that we have a frame in flight, acquire the swapchain image
-    vkAcquireNextImageKHR(m_vk_logical_device, m_vk_swapchain, UINT64_MAX, m_swapchain_res[m_frame_count % m_swapchain_image_count].image_ready_semaphore, nullptr, &m_current_sc_image);
+    auto acquire_start = std::chrono::steady_clock::now();
+    if (!m_headless) {
+        acquire_swapchain_image();
+    }
+    auto acquire_end = std::chrono::steady_clock::now();
+
+    // The swapchain image has to end up ready to present whether or not anything draws to it
+    if (m_image_acquired) {
+        FrameGraphImageInfo swapchain_image_info = {
+                .image = m_swapchain_res[m_current_sc_image].image,
+                .range = {
+                        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                        .baseMipLevel = 0, .levelCount = 1,
+                        .baseArrayLayer = 0, .layerCount = 1,
+                },
+                .initial_layout = VK_IMAGE_LAYOUT_UNDEFINED,
+                .initial_stage = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, // where the acquire semaphore is waited on
+                .final_layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                .output = true,
+                .name = "swapchain image",
+        };
+        m_swapchain_resource = m_frame_graph.import_image(swapchain_image_info);
+    }
+
+    // Start this frame's timings, the rest gets filled in as the frame goes
+    using milliseconds = std::chrono::duration<double, std::milli>;
+    FrameTimingRecord &record = m_frame_timings[(m_frame_count + 1) % FRAME_TIMING_HISTORY];
+    record = {};
+    record.timing.frame = m_frame_count + 1;
+    record.timing.limiter_time = milliseconds(limiter_time).count();
+    record.timing.wait_time = milliseconds(wait_end - wait_start).count();
+    record.timing.acquire_time = milliseconds(acquire_end - acquire_start).count();
+    record.record_start = acquire_end;
 }
 
 void MVRender::Renderer::end_frame() {
-    FrameResources *frame = &m_frame_res[m_frame_count % FRAMES_IN_FLIGHT];
-
-    // TODO: Remove this garbage (this exists to pretend there is stuff drawn so it dont instantly crash)
-    VkImageMemoryBarrier2 barrier{
-            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
-            .srcStageMask = VK_PIPELINE_STAGE_2_NONE,
-            .srcAccessMask = VK_ACCESS_2_NONE,
-            .dstStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
-            .dstAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
-            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-            .newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-            .image = m_swapchain_res[m_current_sc_image].image,
-            .subresourceRange = {
-                    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                    .baseMipLevel = 0, .levelCount = 1,
-                    .baseArrayLayer = 0, .layerCount = 1,
-            },
+    MVR_TRACE_ZONE("Renderer::end_frame");
+    FrameResources *frame = &m_frame_res[m_frame_count % m_frames_in_flight];
+
+    // Compiling can fail and only needs the graph, so it goes before anything is recorded or uploads are
+    // handed to the staging ring
+    m_frame_graph.compile(m_async_compute, frame->transient_images.get());
+
+    // Whatever worker threads recorded goes first, in the order they asked for
+    execute_secondaries(*frame);
+
+    // Temp buffer and permanent uploads go first in the copy commands, the frame graph's passes wait on them
+    CopyCommandsInfo copy_commands_info = {
+            .transfer_commands = frame->transfer_commands,
+            .graphics_commands = frame->copy_commands,
+            .transfer_queue_family = m_transfer_queue_family_index,
+            .graphics_queue_family = m_queue_family_index,
     };
+    frame->buffer_allocator->record_copy_commands(copy_commands_info);
+    record_pending_uploads(copy_commands_info);
+    record_pending_updates(frame->copy_commands);
+    m_staging_ring->submit(m_frame_count + 1);
 
-    VkDependencyInfo depInfo{
-            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
-            .imageMemoryBarrierCount = 1,
-            .pImageMemoryBarriers = &barrier,
-    };
-
-    vkCmdPipelineBarrier2(frame->draw_commands, &depInfo);
+    m_frame_graph.execute({
+            .copy_commands = frame->copy_commands,
+            .compute_commands = frame->compute_commands,
+            .draw_commands = frame->draw_commands,
+    });
 
-    // Let temp buffer record its commands before ending
-    frame->buffer_allocator.record_copy_commands(frame->copy_commands);
+    // Readbacks want whatever the frame left in their buffers, so they go after everything else
+    record_pending_readbacks(frame->draw_commands);
+    m_readback_ring->submit(m_frame_count + 1);
 
     // End command buffers for the frame
+    frame->gpu_profiler->end_frame(frame->copy_commands, frame->compute_commands, frame->draw_commands);
     vkEndCommandBuffer(frame->compute_commands);
     vkEndCommandBuffer(frame->copy_commands);
     vkEndCommandBuffer(frame->draw_commands);
 
-    // Prepare the final frame submission
+    // Copies go off first on their own queue, the graphics submit waits for them below
+    if (m_dedicated_transfer) {
+        vkEndCommandBuffer(frame->transfer_commands);
+        uint64_t transfer_signal_value = m_frame_count + 1;
+        VkTimelineSemaphoreSubmitInfo transfer_timeline_submit = {
+                .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+                .signalSemaphoreValueCount = 1,
+                .pSignalSemaphoreValues = &transfer_signal_value,
+        };
+        VkSubmitInfo transfer_submit_info = {
+                .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                .pNext = &transfer_timeline_submit,
+                .commandBufferCount = 1,
+                .pCommandBuffers = &frame->transfer_commands,
+                .signalSemaphoreCount = 1,
+                .pSignalSemaphores = &m_transfer_semaphore,
+        };
+        VkResult transfer_submit_result = vkQueueSubmit(m_vk_transfer_queue, 1, &transfer_submit_info, nullptr);
+        if (transfer_submit_result != VK_SUCCESS) {
+            const char *string_result = string_VkResult(transfer_submit_result);
+            throw Exception(MVR_RESULT_CRITICAL_VULKAN_ERROR, fmt::format("Failed to submit transfer queue, Vulkan error {}", string_result));
+        }
+    }
+
+    // With async compute, copies and compute go off in their own submissions and drawing waits on compute
+    if (m_async_compute) {
+        submit_async_compute(frame);
+    }
+
+    // Prepare the final frame submission, frames that didn't acquire an image have no swapchain semaphores to deal with
     VkCommandBuffer buffers[] = {
             frame->copy_commands,
             frame->compute_commands,
             frame->draw_commands,
     };
+    uint32_t wait_count = 0;
+    VkSemaphore wait_semaphores[2];
+    uint64_t wait_values[2];
+    VkPipelineStageFlags wait_stage_masks[2];
+    if (m_image_acquired) {
+        wait_semaphores[wait_count] = m_swapchain_res[m_frame_count % m_swapchain_image_count].image_ready_semaphore;
+        wait_values[wait_count] = 1;
+        wait_stage_masks[wait_count] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT; // the swapchain image's first barrier waits on this stage
+        wait_count++;
+    }
+    if (m_async_compute) {
+        wait_semaphores[wait_count] = m_compute_semaphore;
+        wait_values[wait_count] = m_frame_count + 1;
+        wait_stage_masks[wait_count] = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        wait_count++;
+    } else if (m_dedicated_transfer) {
+        wait_semaphores[wait_count] = m_transfer_semaphore;
+        wait_values[wait_count] = m_frame_count + 1;
+        wait_stage_masks[wait_count] = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        wait_count++;
+    }
+    uint32_t signal_count = m_image_acquired ? 2 : 1;
     uint64_t signal_values[] = {m_frame_count + 1, 1};
+    VkSemaphore signal_semaphores[] = {m_timeline_semaphore, VK_NULL_HANDLE};
+    if (m_image_acquired) {
+        signal_semaphores[1] = m_swapchain_res[m_frame_count % m_swapchain_image_count].submit_ready_semaphore;
+    }
     VkTimelineSemaphoreSubmitInfo timelineSubmit = {
             .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
-            .signalSemaphoreValueCount = 2,
+            .waitSemaphoreValueCount = wait_count,
+            .pWaitSemaphoreValues = wait_values,
+            .signalSemaphoreValueCount = signal_count,
             .pSignalSemaphoreValues = signal_values,
     };
-    VkSemaphore signal_semaphores[] = {m_timeline_semaphore, m_swapchain_res[m_frame_count % m_swapchain_image_count].submit_ready_semaphore};
-    VkPipelineStageFlags wait_stage_mask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
     VkSubmitInfo submit_info = {
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
         .pNext = &timelineSubmit,
-        .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &m_swapchain_res[m_frame_count % m_swapchain_image_count].image_ready_semaphore,
-        .pWaitDstStageMask = &wait_stage_mask,
-        .commandBufferCount = 3,
-        .pCommandBuffers = buffers,
-        .signalSemaphoreCount = 2,
+        .waitSemaphoreCount = wait_count,
+        .pWaitSemaphores = wait_semaphores,
+        .pWaitDstStageMask = wait_stage_masks,
+        .commandBufferCount = m_async_compute ? 1u : 3u,
+        .pCommandBuffers = m_async_compute ? &frame->draw_commands : buffers,
+        .signalSemaphoreCount = signal_count,
         .pSignalSemaphores = signal_semaphores,
     };
     VkResult queue_submit_result = vkQueueSubmit(m_vk_queue, 1, &submit_info, nullptr);
@@ -621,6 +998,21 @@ void MVRender::Renderer::end_frame() {
         throw Exception(MVR_RESULT_CRITICAL_VULKAN_ERROR, fmt::format("Failed to submit queue, Vulkan error {}", string_result));
     }
 
+    // Frames before the first begin_frame have no timing record to fill in
+    using milliseconds = std::chrono::duration<double, std::milli>;
+    FrameTimingRecord &record = m_frame_timings[(m_frame_count + 1) % FRAME_TIMING_HISTORY];
+    const bool timed = record.timing.frame == m_frame_count + 1;
+    if (timed) {
+        record.submit_time = std::chrono::steady_clock::now();
+        record.timing.record_time = milliseconds(record.submit_time - record.record_start).count();
+    }
+
+    if (!m_image_acquired) {
+        m_last_present_time = {};
+        m_frame_count += 1;
+        return;
+    }
+
     // Present the queue
     VkPresentInfoKHR present_info = {
             .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
@@ -637,9 +1029,15 @@ void MVRender::Renderer::end_frame() {
         throw Exception(MVR_RESULT_CRITICAL_VULKAN_ERROR, fmt::format("Failed to present queue, Vulkan error {}", string_result));
     }
 
+    auto present_time = std::chrono::steady_clock::now();
+    if (timed && m_last_present_time != std::chrono::steady_clock::time_point()) {
+        record.timing.present_interval = milliseconds(present_time - m_last_present_time).count();
+    }
+    m_last_present_time = present_time;
     m_frame_count += 1;
 
+    // The window changed under us, the swapchain gets rebuilt before the next acquire
     if (queue_present_result != VK_SUCCESS) {
-        // TODO: Rebuild the swapchain if its out of date
+        m_swapchain_dirty = true;
     }
 }
@@ -3,41 +3,59 @@
 #include <volk.h>
 #include <vulkan/vk_enum_string_helper.h>
 #include <fmt/core.h>
+#include <algorithm>
+#include <cmath>
+#include <thread>
 
 #include "render/Renderer.hpp"
 #include "render/BufferAllocator.hpp"
 #include "render/Constants.hpp"
 #include "render/Logging.hpp"
+#include "render/Trace.hpp"
 
-MVRender::BufferDescriptor *MVRender::Renderer::get_buffer_descriptor() {
-    int found_spot = -1;
-    for (int i = 0; i < m_permanent_buffer_occupied.size(); i++) {
-        if (!m_permanent_buffer_occupied.at(i)) {
-            found_spot = i;
-            m_permanent_buffer_occupied.at(i) = true;
-            break;
-        }
-    }
+MVRender::BufferAllocator &MVRender::Renderer::get_buffer_allocator() {
+    return *m_frame_res.at(m_frame_count % m_frames_in_flight).buffer_allocator;
+}
 
-    if (found_spot == -1) {
-        m_permanent_buffer_occupied.emplace_back(true);
-        m_permanent_buffers.emplace_back();
-        found_spot = m_permanent_buffer_occupied.size() - 1;
-    }
-    return &m_permanent_buffers.at(found_spot);
+MVRender::PagePool &MVRender::Renderer::get_page_pool() {
+    return *m_page_pool;
 }
 
-void MVRender::Renderer::remove_buffer_descriptor(MVRender::BufferDescriptor *descriptor) {
-    for (int i = 0; i < m_permanent_buffer_occupied.size(); i++) {
-        if (&m_permanent_buffers.at(i) == descriptor) {
-            m_permanent_buffer_occupied.at(i) = false;
-            break;
-        }
+MVRender::StagingRing &MVRender::Renderer::get_staging_ring() {
+    return *m_staging_ring;
+}
+
+MVRender::SharedBufferPool &MVRender::Renderer::get_shared_buffer_pool() {
+    return *m_shared_buffers;
+}
+
+MVRender::FrameGraph &MVRender::Renderer::get_frame_graph() {
+    return m_frame_graph;
+}
+
+MVRender::FrameGraphResource MVRender::Renderer::get_swapchain_resource() {
+    if (!m_image_acquired) {
+        throw Exception(MVR_RESULT_INVALID_ARGUMENT, "No swapchain image was acquired this frame");
     }
+    return m_swapchain_resource;
 }
 
-MVRender::BufferAllocator &MVRender::Renderer::get_buffer_allocator() {
-    return m_frame_res.at(m_frame_count % FRAMES_IN_FLIGHT).buffer_allocator;
+MVRender::DeletionQueue &MVRender::Renderer::get_deletion_queue() {
+    return m_deletion_queue;
+}
+
+MVRender::BufferDescriptor *MVRender::Renderer::resolve_buffer(MVR_Buffer buffer) {
+    if (is_temp_handle(buffer)) {
+        return get_buffer_allocator().resolve_temp_buffer(buffer);
+    }
+    if (buffer == MVR_INVALID_HANDLE) {
+        throw Exception(MVR_RESULT_INVALID_HANDLE, "Buffer handle is MVR_INVALID_HANDLE");
+    }
+    BufferDescriptor *descriptor = m_permanent_buffers.get(buffer);
+    if (descriptor == nullptr) {
+        throw Exception(MVR_RESULT_INVALID_HANDLE, fmt::format("Buffer handle {:#x} was destroyed or was never valid", buffer));
+    }
+    return descriptor;
 }
 
 VkPresentModeKHR MVRender::Renderer::get_present_mode(MVR_PresentMode present_mode) const {
@@ -48,10 +66,10 @@ VkPresentModeKHR MVRender::Renderer::get_present_mode(MVR_PresentMode present_mo
     return VK_PRESENT_MODE_FIFO_KHR;
 }
 
-VkCommandBuffer MVRender::Renderer::get_single_use_command_buffer() {
+VkCommandBuffer MVRender::Renderer::get_single_use_command_buffer(bool transfer) {
     VkCommandBufferAllocateInfo allocate_info = {
             .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-            .commandPool = m_command_pool,
+            .commandPool = transfer && m_dedicated_transfer ? m_transfer_command_pool : m_command_pool,
             .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
             .commandBufferCount = 1,
     };
@@ -69,7 +87,11 @@ VkCommandBuffer MVRender::Renderer::get_single_use_command_buffer() {
     return buffer;
 }
 
-void MVRender::Renderer::submit_single_use_command_buffer(VkCommandBuffer buffer) {
+void MVRender::Renderer::submit_single_use_command_buffer(VkCommandBuffer buffer, bool transfer) {
+    MVR_TRACE_ZONE("Renderer::submit_single_use_command_buffer");
+    VkQueue queue = transfer ? m_vk_transfer_queue : m_vk_queue;
+    VkCommandPool pool = transfer && m_dedicated_transfer ? m_transfer_command_pool : m_command_pool;
+
     VkResult end_result = vkEndCommandBuffer(buffer);
     resolve_vulkan_error(end_result, false, "Failed to begin single-use command buffer");
 
@@ -78,41 +100,279 @@ void MVRender::Renderer::submit_single_use_command_buffer(VkCommandBuffer buffer
             .commandBufferCount = 1,
             .pCommandBuffers = &buffer
     };
-    vkQueueSubmit(m_vk_queue, 1, &submit_info, nullptr);
+    vkResetFences(m_vk_logical_device, 1, &m_single_use_fence);
+    VkResult submit_result = vkQueueSubmit(queue, 1, &submit_info, m_single_use_fence);
+    resolve_vulkan_error(submit_result, false, "Failed to submit single-use command buffer");
 
-    // TODO: Something better than this pile of shit
-    vkQueueWaitIdle(m_vk_queue);
+    // Only wait for this submission, whatever frames are in flight on the queue can keep going
+    VkResult wait_result = vkWaitForFences(m_vk_logical_device, 1, &m_single_use_fence, VK_TRUE, UINT64_MAX);
+    resolve_vulkan_error(wait_result, false, "Failed to wait for single-use command buffer");
 
-    vkFreeCommandBuffers(m_vk_logical_device, m_command_pool, 1, &buffer);
+    vkFreeCommandBuffers(m_vk_logical_device, pool, 1, &buffer);
 }
 
-// TODO: Use something more RAII, or otherwise fix this mess.
-MVRender::BufferDescriptor *MVRender::Renderer::load_permanent_buffer(uint64_t size, void *data) {
-    static uint32_t index = 0;
-    index += 1;
+void MVRender::Renderer::wait_for_timeline(uint64_t value) {
+    VkSemaphoreWaitInfo semaphore_wait_info = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+            .semaphoreCount = 1,
+            .pSemaphores = &m_timeline_semaphore,
+            .pValues = &value,
+    };
+    VkResult wait_result = vkWaitSemaphores(m_vk_logical_device, &semaphore_wait_info, UINT64_MAX);
+    resolve_vulkan_error(wait_result, false, "Failed to wait for timeline semaphore");
+}
 
-    // Create the staging buffer
-    VkBuffer out_stage_buffer;
-    VmaAllocation out_stage_allocation;
-    VkBufferCreateInfo staging_buffer_create_info = {
-            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-            .size = size,
-            .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-            .queueFamilyIndexCount = 1,
-            .pQueueFamilyIndices = &m_queue_family_index,
+void MVRender::Renderer::submit_async_compute(FrameResources *frame) {
+    // Graphics queue copies first, after the transfer queue's if there is one
+    uint64_t wait_value = m_frame_count + 1;
+    uint64_t signal_value = m_frame_count + 1;
+    VkPipelineStageFlags wait_stage_mask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkTimelineSemaphoreSubmitInfo copy_timeline_submit = {
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .waitSemaphoreValueCount = m_dedicated_transfer ? 1u : 0u,
+            .pWaitSemaphoreValues = &wait_value,
+            .signalSemaphoreValueCount = 1,
+            .pSignalSemaphoreValues = &signal_value,
     };
-    VmaAllocationCreateInfo staging_allocation_create_info = {
-            .flags = 0,
-            .usage = VMA_MEMORY_USAGE_CPU_TO_GPU,
-            .requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+    VkSubmitInfo copy_submit_info = {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .pNext = &copy_timeline_submit,
+            .waitSemaphoreCount = m_dedicated_transfer ? 1u : 0u,
+            .pWaitSemaphores = &m_transfer_semaphore,
+            .pWaitDstStageMask = &wait_stage_mask,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &frame->copy_commands,
+            .signalSemaphoreCount = 1,
+            .pSignalSemaphores = &m_copy_semaphore,
     };
-    VmaAllocationInfo stage_allocation_info;
-    VkResult stage_buffer_result = vmaCreateBuffer(m_vma, &staging_buffer_create_info,
-                                                   &staging_allocation_create_info, &out_stage_buffer, &out_stage_allocation, &stage_allocation_info);
+    VkResult copy_submit_result = vkQueueSubmit(m_vk_queue, 1, &copy_submit_info, nullptr);
+    if (copy_submit_result != VK_SUCCESS) {
+        const char *string_result = string_VkResult(copy_submit_result);
+        throw Exception(MVR_RESULT_CRITICAL_VULKAN_ERROR, fmt::format("Failed to submit copy commands, Vulkan error {}", string_result));
+    }
 
-    if (stage_buffer_result != VK_SUCCESS) {
-        const char *string_result = string_VkResult(stage_buffer_result);
-        throw Exception(MVR_RESULT_VULKAN_ERROR, fmt::format("Failed to allocate staging buffer for new page, {}", string_result));
+    // Compute only waits on this frame's copies, so it can run while the last frame is still drawing
+    VkTimelineSemaphoreSubmitInfo compute_timeline_submit = {
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .waitSemaphoreValueCount = 1,
+            .pWaitSemaphoreValues = &wait_value,
+            .signalSemaphoreValueCount = 1,
+            .pSignalSemaphoreValues = &signal_value,
+    };
+    VkSubmitInfo compute_submit_info = {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .pNext = &compute_timeline_submit,
+            .waitSemaphoreCount = 1,
+            .pWaitSemaphores = &m_copy_semaphore,
+            .pWaitDstStageMask = &wait_stage_mask,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &frame->compute_commands,
+            .signalSemaphoreCount = 1,
+            .pSignalSemaphores = &m_compute_semaphore,
+    };
+    VkResult compute_submit_result = vkQueueSubmit(m_vk_compute_queue, 1, &compute_submit_info, nullptr);
+    if (compute_submit_result != VK_SUCCESS) {
+        const char *string_result = string_VkResult(compute_submit_result);
+        throw Exception(MVR_RESULT_CRITICAL_VULKAN_ERROR, fmt::format("Failed to submit compute queue, Vulkan error {}", string_result));
+    }
+}
+
+VkCommandBuffer MVRender::Renderer::begin_secondary_commands(uint32_t order) {
+    return m_frame_res.at(m_frame_count % m_frames_in_flight).command_recorder->begin_secondary(order);
+}
+
+void MVRender::Renderer::execute_secondaries(FrameResources &frame) {
+    frame.gpu_profiler->close_zones();
+    std::vector<SecondaryCommands> secondaries = frame.command_recorder->end_secondaries();
+
+    // Secondaries go out in as few calls as they can, runs are only split where a zone starts or ends
+    std::vector<VkCommandBuffer> run;
+    auto execute_run = [&frame, &run]() {
+        if (!run.empty()) {
+            vkCmdExecuteCommands(frame.draw_commands, static_cast<uint32_t>(run.size()), run.data());
+            run.clear();
+        }
+    };
+    for (auto &secondary: secondaries) {
+        const uint64_t position = GpuProfiler::secondary_position(static_cast<uint32_t>(secondary.key >> 32));
+        if (frame.gpu_profiler->has_stamps_before(position)) {
+            execute_run();
+            frame.gpu_profiler->write_stamps(frame.draw_commands, position);
+        }
+        run.push_back(secondary.buffer);
+    }
+    execute_run();
+    frame.gpu_profiler->write_stamps(frame.draw_commands, UINT64_MAX);
+}
+
+void MVRender::Renderer::set_present_mode(MVR_PresentMode present_mode) {
+    if (present_mode < MVR_PRESENT_MODE_VSYNC || present_mode > MVR_PRESENT_MODE_IMMEDIATE) {
+        throw Exception(MVR_RESULT_INVALID_ARGUMENT, fmt::format("{} is not a valid present mode", static_cast<int>(present_mode)));
+    }
+    if (present_mode == m_initialize_params.present_mode) {
+        return;
+    }
+
+    // Goes through the same rebuild a resize does, headless renderers just remember it
+    m_initialize_params.present_mode = present_mode;
+    m_swapchain_dirty = !m_headless;
+}
+
+// OS sleeps can overshoot by a millisecond or more, so this sleeps in shrinking steps and only yields
+// through the last fraction of a millisecond instead of spinning through the whole wait
+static void sleep_until_precise(std::chrono::steady_clock::time_point target) {
+    using namespace std::chrono_literals;
+    while (true) {
+        const auto remaining = target - std::chrono::steady_clock::now();
+        if (remaining <= 0s) {
+            return;
+        } else if (remaining > 2ms) {
+            std::this_thread::sleep_for(remaining - 2ms);
+        } else if (remaining > 200us) {
+            std::this_thread::sleep_for(100us);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+std::chrono::steady_clock::duration MVRender::Renderer::limit_frame_rate() {
+    if (m_frame_period == std::chrono::steady_clock::duration::zero()) {
+        return {};
+    }
+    const auto start = std::chrono::steady_clock::now();
+    sleep_until_precise(m_next_frame_time);
+    const auto now = std::chrono::steady_clock::now();
+
+    // Stay on the same beat, unless a long frame put us more than a whole frame behind
+    m_next_frame_time = now - m_next_frame_time < m_frame_period ? m_next_frame_time + m_frame_period : now + m_frame_period;
+    return now - start;
+}
+
+// Time between frames for a frame rate limit, zero for no limit. Tiny rates would overflow the clock's
+// ticks, so anything spacing frames out more than MAX_FRAME_PERIOD is turned away along with NaN and infinity.
+static std::chrono::steady_clock::duration frame_period(double frames_per_second) {
+    if (frames_per_second == 0) {
+        return {};
+    }
+    if (!std::isfinite(frames_per_second) || !(frames_per_second >= 1.0 / MVRender::MAX_FRAME_PERIOD)) {
+        throw MVRender::Exception(MVR_RESULT_INVALID_ARGUMENT, fmt::format("{} is not a valid frame rate limit", frames_per_second));
+    }
+    return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / frames_per_second));
+}
+
+void MVRender::Renderer::set_frame_rate_limit(double frames_per_second) {
+    m_frame_period = frame_period(frames_per_second);
+    m_next_frame_time = std::chrono::steady_clock::now();
+}
+
+void MVRender::Renderer::validate_initialize_params(const MVR_InitializeParams &params) {
+    if (params.frames_in_flight > MAX_FRAMES_IN_FLIGHT) {
+        throw Exception(MVR_RESULT_INVALID_ARGUMENT, fmt::format("Can't have {} frames in flight, the most is {}", params.frames_in_flight, MAX_FRAMES_IN_FLIGHT));
+    }
+    if (params.staging_ring_size != 0 && params.staging_ring_size < MIN_STAGING_RING_SIZE) {
+        throw Exception(MVR_RESULT_INVALID_ARGUMENT, fmt::format("A {} byte staging ring is too small, it needs at least {} bytes", params.staging_ring_size, MIN_STAGING_RING_SIZE));
+    }
+    frame_period(params.frame_rate_limit);
+}
+
+void MVRender::Renderer::set_frames_in_flight(uint32_t count) {
+    if (count == 0 || count > MAX_FRAMES_IN_FLIGHT) {
+        throw Exception(MVR_RESULT_INVALID_ARGUMENT, fmt::format("Can't have {} frames in flight, it has to be from 1 to {}", count, MAX_FRAMES_IN_FLIGHT));
+    }
+    m_requested_frames_in_flight = count;
+}
+
+VkDeviceSize MVRender::Renderer::claim_staging_space(VkDeviceSize size) {
+    // Flushing and waiting only help if it fits in the ring once the ring is empty
+    const VkDeviceSize aligned_size = (size + STAGING_RING_ALIGNMENT - 1) / STAGING_RING_ALIGNMENT * STAGING_RING_ALIGNMENT;
+    if (aligned_size > m_staging_ring->capacity()) {
+        throw Exception(MVR_RESULT_OUT_OF_MEMORY, fmt::format("A {} byte upload can't fit in the {} byte staging ring", size, m_staging_ring->capacity()));
+    }
+    VkDeviceSize offset;
+    while (!m_staging_ring->try_allocate(size, &offset)) {
+        uint64_t oldest_value = m_staging_ring->oldest_value();
+        if (oldest_value == 0) {
+            // Everything in the ring belongs to this frame, so it has to go out now to make room
+            flush_pending_uploads();
+            continue;
+        }
+
+        // Wait for the oldest upload to finish with its space
+        wait_for_timeline(oldest_value);
+        m_staging_ring->reclaim(oldest_value);
+    }
+    return offset;
+}
+
+VkDeviceSize MVRender::Renderer::staging_piece_size() const {
+    return m_staging_ring->capacity() / 4 > 0 ? m_staging_ring->capacity() / 4 : m_staging_ring->capacity();
+}
+
+void MVRender::Renderer::stage_upload(VkBuffer buffer, VkDeviceSize offset, const void *data, VkDeviceSize size) {
+    // Big uploads go through in pieces so they never need more than part of the ring at once
+    const VkDeviceSize piece_size = staging_piece_size();
+    const uint64_t flush_count = m_upload_flush_count;
+    VkDeviceSize uploaded = 0;
+    while (uploaded < size) {
+        const VkDeviceSize remaining = size - uploaded;
+        const VkDeviceSize piece = remaining < piece_size ? remaining : piece_size;
+        const VkDeviceSize staging_offset = claim_staging_space(piece);
+        memcpy(m_staging_ring->data(staging_offset), static_cast<const char *>(data) + uploaded, piece);
+        m_staging_ring->flush(staging_offset, piece);
+        m_pending_uploads.push_back({
+                .staging_offset = staging_offset,
+                .buffer = buffer,
+                .offset = offset + uploaded,
+                .size = piece,
+        });
+        uploaded += piece;
+    }
+
+    // Making room sent the first pieces out on the graphics queue. The rest go the same way, otherwise
+    // the dedicated transfer queue would write to a buffer the graphics family already wrote without owning it.
+    if (m_dedicated_transfer && flush_count != m_upload_flush_count) {
+        flush_pending_uploads();
+    }
+}
+
+void MVRender::Renderer::drop_pending_uploads(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size) {
+    std::erase_if(m_pending_uploads, [buffer, offset, size](const PendingUpload &upload) {
+        return upload.buffer == buffer && upload.offset >= offset && upload.offset < offset + size;
+    });
+}
+
+MVR_Buffer MVRender::Renderer::load_permanent_buffer(uint64_t size, void *data) {
+    MVR_TRACE_ZONE("Renderer::load_permanent_buffer");
+    if (size == 0) {
+        throw Exception(MVR_RESULT_INVALID_ARGUMENT, "Permanent buffers can't be empty");
+    }
+    static uint32_t index = 0;
+    index += 1;
+
+    // Small buffers get packed into a shared block instead of getting a buffer of their own
+    if (m_shared_buffers->fits(size)) {
+        SharedBufferRange range = m_shared_buffers->allocate(size);
+        try {
+            stage_upload(range.buffer, range.offset, data, size);
+        } catch (...) {
+            drop_pending_uploads(range.buffer, range.offset, size);
+            m_shared_buffers->free(range);
+            throw;
+        }
+
+        m_permanent_buffer_bytes += size;
+
+        BufferDescriptor *d;
+        MVR_Buffer handle = m_permanent_buffers.insert(&d);
+        d->size = size;
+        d->offset = range.offset;
+        d->buffer = range.buffer;
+        d->data = nullptr;
+        d->allocation = nullptr;
+        d->virtual_allocation = range.virtual_allocation;
+        d->ready_value = m_frame_count + 1;
+        return handle;
     }
 
     // Create the device buffer
@@ -121,7 +381,7 @@ MVRender::BufferDescriptor *MVRender::Renderer::load_permanent_buffer(uint64_t s
     VkBufferCreateInfo device_buffer_create_info = {
             .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
             .size = size,
-            .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+            .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_TEXEL_BUFFER_BIT,
             .queueFamilyIndexCount = 1,
             .pQueueFamilyIndices = &m_queue_family_index,
@@ -135,9 +395,6 @@ MVRender::BufferDescriptor *MVRender::Renderer::load_permanent_buffer(uint64_t s
                                                     &device_allocation_create_info, &out_device_buffer, &out_device_allocation, &device_allocation_info);
 
     if (device_buffer_result != VK_SUCCESS) {
-        // Gotta throw out the staging buffer
-        vmaDestroyBuffer(m_vma, out_stage_buffer, out_stage_allocation);
-
         const char *string_result = string_VkResult(device_buffer_result);
         throw Exception(MVR_RESULT_VULKAN_ERROR, fmt::format("Failed to allocate device buffer for new page, {}", string_result));
     }
@@ -148,55 +405,251 @@ MVRender::BufferDescriptor *MVRender::Renderer::load_permanent_buffer(uint64_t s
             fmt::format("Permanent buffer {}", index)
     );
 
-    // Now that we have the memory, we need to map it
-    void *mapped_memory;
-    VkResult memory_map_result = vmaMapMemory(m_vma, out_stage_allocation, &mapped_memory);
-
-    // If there was a mapping error we will erase it all
-    if (memory_map_result != VK_SUCCESS) {
-        vmaDestroyBuffer(m_vma, out_stage_buffer, out_stage_allocation);
-        vmaDestroyBuffer(m_vma, out_device_buffer, out_device_allocation);
-        const char *string_result = string_VkResult(memory_map_result);
-        throw Exception(MVR_RESULT_VULKAN_ERROR, fmt::format("Failed to map memory for new page, {}", string_result));
-    }
-
-    // Copy data to device buffer
-    memcpy(mapped_memory, data, size);
-    vmaUnmapMemory(m_vma, out_stage_allocation);
+    // The data goes into the staging ring now, the copy to the device buffer happens at the end of the frame
     try {
-        VkCommandBuffer command_buffer = get_single_use_command_buffer();
-        VkBufferCopy2 region = {
-                .sType = VK_STRUCTURE_TYPE_BUFFER_COPY_2,
-                .size = size,
-        };
-        VkCopyBufferInfo2 copy_buffer_info = {
-                .sType = VK_STRUCTURE_TYPE_COPY_BUFFER_INFO_2,
-                .srcBuffer = out_stage_buffer,
-                .dstBuffer = out_device_buffer,
-                .regionCount = 1,
-                .pRegions = &region,
-        };
-        vkCmdCopyBuffer2(command_buffer, &copy_buffer_info);
-        submit_single_use_command_buffer(command_buffer);
-        vmaDestroyBuffer(m_vma, out_stage_buffer, out_stage_allocation);
-    } catch (MVRender::Exception& r) {
-        vmaDestroyBuffer(m_vma, out_stage_buffer, out_stage_allocation);
+        stage_upload(out_device_buffer, 0, data, size);
+    } catch (...) {
+        drop_pending_uploads(out_device_buffer, 0, size);
         vmaDestroyBuffer(m_vma, out_device_buffer, out_device_allocation);
         throw;
     }
 
-    BufferDescriptor *d = get_buffer_descriptor();
-    d->size = 0;
+    m_permanent_buffer_bytes += size;
+
+    BufferDescriptor *d;
+    MVR_Buffer handle = m_permanent_buffers.insert(&d);
+    d->size = size;
     d->offset = 0;
     d->buffer = out_device_buffer;
     d->data = nullptr;
     d->allocation = out_device_allocation;
-    return d;
+    d->virtual_allocation = nullptr;
+    d->ready_value = m_frame_count + 1;
+    return handle;
+}
+
+// Copies out of the staging ring, one vkCmdCopyBuffer2 per destination buffer with a region for each piece going into it
+static void record_staging_copies(VkCommandBuffer commands, VkBuffer staging_buffer, const std::unordered_map<VkBuffer, std::vector<VkBufferCopy2>> &regions) {
+    for (auto &[buffer, buffer_regions]: regions) {
+        VkCopyBufferInfo2 copy_buffer_info = {
+                .sType = VK_STRUCTURE_TYPE_COPY_BUFFER_INFO_2,
+                .srcBuffer = staging_buffer,
+                .dstBuffer = buffer,
+                .regionCount = static_cast<uint32_t>(buffer_regions.size()),
+                .pRegions = buffer_regions.data(),
+        };
+        vkCmdCopyBuffer2(commands, &copy_buffer_info);
+    }
+}
+
+void MVRender::Renderer::record_pending_uploads(const CopyCommandsInfo &info) {
+    std::unordered_map<VkBuffer, std::vector<VkBufferCopy2>> regions;
+    std::vector<CopiedRange> copied_ranges;
+    for (auto &upload: m_pending_uploads) {
+        regions[upload.buffer].push_back({
+                .sType = VK_STRUCTURE_TYPE_BUFFER_COPY_2,
+                .srcOffset = upload.staging_offset,
+                .dstOffset = upload.offset,
+                .size = upload.size,
+        });
+
+        // Pieces of one upload are next to each other, so they only need one barrier
+        CopiedRange *last = copied_ranges.empty() ? nullptr : &copied_ranges.back();
+        if (last != nullptr && last->buffer == upload.buffer && last->offset + last->size == upload.offset) {
+            last->size += upload.size;
+        } else {
+            copied_ranges.push_back({upload.buffer, upload.offset, upload.size});
+        }
+    }
+    record_staging_copies(info.transfer_commands, m_staging_ring->buffer(), regions);
+    record_transfer_barriers(info, copied_ranges);
+    m_pending_uploads.clear();
+}
+
+void MVRender::Renderer::record_pending_updates(VkCommandBuffer commands) {
+    if (m_pending_updates.empty()) {
+        return;
+    }
+
+    // Updates overwrite data that earlier work may still be reading, and uploads recorded before this may still be writing
+    VkMemoryBarrier2 barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+            .srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            .srcAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+            .dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+    };
+    VkDependencyInfo dependency_info = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .memoryBarrierCount = 1,
+            .pMemoryBarriers = &barrier,
+    };
+    vkCmdPipelineBarrier2(commands, &dependency_info);
+
+    // Everything going into the same buffer goes out in one copy, shared blocks make that most of them
+    std::unordered_map<VkBuffer, std::vector<VkBufferCopy2>> regions;
+    std::vector<CopiedRange> copied_ranges;
+    for (auto &[handle, ranges]: m_pending_updates) {
+        for (auto &[offset, update]: ranges) {
+            regions[update.buffer].push_back({
+                    .sType = VK_STRUCTURE_TYPE_BUFFER_COPY_2,
+                    .srcOffset = update.staging_offset,
+                    .dstOffset = update.offset,
+                    .size = update.size,
+            });
+            copied_ranges.push_back({update.buffer, update.offset, update.size});
+        }
+    }
+    record_staging_copies(commands, m_staging_ring->buffer(), regions);
+    CopyCommandsInfo copy_commands_info = {
+            .transfer_commands = commands,
+            .graphics_commands = commands,
+            .transfer_queue_family = m_queue_family_index,
+            .graphics_queue_family = m_queue_family_index,
+    };
+    record_transfer_barriers(copy_commands_info, copied_ranges);
+    m_pending_updates.clear();
+}
+
+void MVRender::Renderer::flush_pending_uploads() {
+    // This goes out on the graphics queue so there is no ownership to hand over afterwards
+    VkCommandBuffer command_buffer = get_single_use_command_buffer();
+    CopyCommandsInfo copy_commands_info = {
+            .transfer_commands = command_buffer,
+            .graphics_commands = command_buffer,
+            .transfer_queue_family = m_queue_family_index,
+            .graphics_queue_family = m_queue_family_index,
+    };
+    record_pending_uploads(copy_commands_info);
+    record_pending_updates(command_buffer);
+    submit_single_use_command_buffer(command_buffer);
+    m_upload_flush_count += 1;
+
+    // The copies are done but the ring is FIFO, so this space comes back after the last submitted frame's
+    m_staging_ring->submit(m_frame_count);
+}
+
+void MVRender::Renderer::queue_update(MVR_Buffer handle, const BufferDescriptor &descriptor, VkDeviceSize offset, const void *data, VkDeviceSize size) {
+    const VkDeviceSize update_start = descriptor.offset + offset;
+    const VkDeviceSize update_end = update_start + size;
+
+    // Find the span of every pending update of this buffer that this one overlaps or touches
+    VkDeviceSize start = update_start;
+    VkDeviceSize end = update_end;
+    bool overlaps = false;
+    {
+        auto &ranges = m_pending_updates[handle];
+        auto range = ranges.upper_bound(update_start);
+        if (range != ranges.begin() && std::prev(range)->first + std::prev(range)->second.size >= update_start) {
+            range--;
+        }
+        for (; range != ranges.end() && range->first <= update_end; range++) {
+            start = std::min(start, range->first);
+            end = std::max(end, range->first + range->second.size);
+            overlaps = overlaps || (range->first < update_end && range->first + range->second.size > update_start);
+        }
+    }
+
+    // Merging only makes sense while the result fits in one piece. Ranges that just touch can stay
+    // separate, but overlapping ones can't go out in the same copy so the older ones get sent now.
+    if (end - start > staging_piece_size()) {
+        if (overlaps) {
+            flush_pending_uploads();
+        }
+        start = update_start;
+        end = update_end;
+    }
+
+    const uint64_t flush_count = m_upload_flush_count;
+    const VkDeviceSize staging_offset = claim_staging_space(end - start);
+    if (flush_count != m_upload_flush_count) {
+        // Making room sent the older updates along with everything else, only the new bytes are left
+        start = update_start;
+        end = update_end;
+    }
+
+    // Older bytes go in first so the new ones land on top of them
+    auto *staging = static_cast<char *>(m_staging_ring->data(staging_offset));
+    auto &ranges = m_pending_updates[handle];
+    auto range = ranges.lower_bound(start);
+    while (range != ranges.end() && range->first < end) {
+        memcpy(staging + (range->first - start), m_staging_ring->data(range->second.staging_offset), range->second.size);
+        range = ranges.erase(range);
+    }
+    memcpy(staging + (update_start - start), data, size);
+    m_staging_ring->flush(staging_offset, end - start);
+    ranges[start] = {
+            .staging_offset = staging_offset,
+            .buffer = descriptor.buffer,
+            .offset = start,
+            .size = end - start,
+    };
+}
+
+void MVRender::Renderer::update_permanent_buffer(MVR_Buffer buffer, VkDeviceSize offset, VkDeviceSize size, const void *data) {
+    if (is_temp_handle(buffer)) {
+        throw Exception(MVR_RESULT_INVALID_ARGUMENT, "Temp buffers can't be updated, write through their data pointer instead");
+    }
+    BufferDescriptor *descriptor = resolve_buffer(buffer);
+    if (offset > descriptor->size || size > descriptor->size - offset) {
+        throw Exception(MVR_RESULT_INVALID_ARGUMENT, fmt::format("Update of {} bytes at offset {} doesn't fit in a {} byte buffer", size, offset, descriptor->size));
+    }
+
+    // Big updates go through in pieces just like big uploads
+    const VkDeviceSize piece_size = staging_piece_size();
+    for (VkDeviceSize updated = 0; updated < size; updated += piece_size) {
+        const VkDeviceSize piece = std::min(size - updated, piece_size);
+        queue_update(buffer, *descriptor, offset + updated, static_cast<const char *>(data) + updated, piece);
+    }
+    descriptor->ready_value = m_frame_count + 1;
 }
 
-void MVRender::Renderer::free_permanent_buffer(BufferDescriptor *buffer) {
-    vmaDestroyBuffer(m_vma, buffer->buffer, buffer->allocation);
-    remove_buffer_descriptor(buffer);
+size_t MVRender::Renderer::pending_update_count() const {
+    size_t count = 0;
+    for (auto &[handle, ranges]: m_pending_updates) {
+        count += ranges.size();
+    }
+    return count;
+}
+
+bool MVRender::Renderer::is_buffer_ready(MVR_Buffer buffer) {
+    BufferDescriptor *descriptor = resolve_buffer(buffer);
+    if (is_temp_handle(buffer)) {
+        return true;
+    }
+    uint64_t completed_value;
+    VkResult result = vkGetSemaphoreCounterValue(m_vk_logical_device, m_timeline_semaphore, &completed_value);
+    resolve_vulkan_error(result, false, "Failed to get timeline semaphore value");
+    return completed_value >= descriptor->ready_value;
+}
+
+void MVRender::Renderer::free_permanent_buffer(MVR_Buffer handle) {
+    BufferDescriptor *buffer = resolve_buffer(handle);
+
+    // Uploads that never got recorded can just be dropped, their staging space comes back with the rest of the frame's
+    drop_pending_uploads(buffer->buffer, buffer->offset, buffer->size);
+    m_pending_updates.erase(handle);
+
+    // The handle dies right away but the memory has to wait until the current frame is done with it
+    const uint64_t last_use = m_frame_count + 1;
+    if (buffer->virtual_allocation != nullptr) {
+        SharedBufferRange range = {
+                .buffer = buffer->buffer,
+                .offset = buffer->offset,
+                .virtual_allocation = buffer->virtual_allocation,
+        };
+        m_deletion_queue.push(last_use, [this, range]() {
+            m_shared_buffers->free(range);
+        });
+    } else {
+        VkBuffer device_buffer = buffer->buffer;
+        VmaAllocation allocation = buffer->allocation;
+        m_deletion_queue.push(last_use, [this, device_buffer, allocation]() {
+            vmaDestroyBuffer(m_vma, device_buffer, allocation);
+        });
+    }
+    m_permanent_buffer_bytes -= buffer->size;
+    m_permanent_buffers.remove(handle);
 }
 
 void MVRender::Renderer::debug_name_object(uint64_t object, VkObjectType type, const std::string& name) {
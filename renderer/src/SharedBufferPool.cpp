@@ -0,0 +1,134 @@
+#define VK_NO_PROTOTYPES
+#include <volk.h>
+#include <vulkan/vk_enum_string_helper.h>
+#include <vk_mem_alloc.h>
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include "render/SharedBufferPool.hpp"
+#include "render/Renderer.hpp"
+#include "render/Logging.hpp"
+
+MVRender::SharedBufferPool::SharedBufferPool(SharedBufferPoolCreateInfo &create_info) {
+    m_vma = create_info.allocator;
+    m_block_size = create_info.block_size;
+    m_threshold = create_info.threshold;
+    m_queue_family_index = create_info.queue_family_index;
+
+    // Permanent buffers can be bound as storage or texel buffers so offsets have to work for both
+    const VkPhysicalDeviceLimits &limits = create_info.device_properties.limits;
+    m_alignment = limits.minStorageBufferOffsetAlignment > limits.minTexelBufferOffsetAlignment ?
+                  limits.minStorageBufferOffsetAlignment : limits.minTexelBufferOffsetAlignment;
+    if (m_alignment < 4) {
+        m_alignment = 4; // vkCmdCopyBuffer wants this much for its offsets anyway
+    }
+}
+
+MVRender::SharedBufferPool::~SharedBufferPool() {
+    for (auto &block: m_blocks) {
+        destroy_block(block);
+    }
+}
+
+MVRender::SharedBufferBlock &MVRender::SharedBufferPool::create_block() {
+    VkBuffer out_buffer;
+    VmaAllocation out_allocation;
+    VkBufferCreateInfo buffer_create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = m_block_size,
+        .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_TEXEL_BUFFER_BIT,
+        .queueFamilyIndexCount = 1,
+        .pQueueFamilyIndices = &m_queue_family_index,
+    };
+    VmaAllocationCreateInfo allocation_create_info = {
+        .usage = VMA_MEMORY_USAGE_GPU_TO_CPU,
+        .requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+    };
+    VmaAllocationInfo allocation_info;
+    VkResult buffer_result = vmaCreateBuffer(m_vma, &buffer_create_info, &allocation_create_info, &out_buffer, &out_allocation, &allocation_info);
+
+    if (buffer_result != VK_SUCCESS) {
+        const char *string_result = string_VkResult(buffer_result);
+        throw Exception(MVR_RESULT_VULKAN_ERROR, fmt::format("Failed to allocate shared permanent buffer block, {}", string_result));
+    }
+
+    VmaVirtualBlock out_virtual_block;
+    VmaVirtualBlockCreateInfo virtual_block_create_info = {
+        .size = m_block_size,
+    };
+    VkResult virtual_block_result = vmaCreateVirtualBlock(&virtual_block_create_info, &out_virtual_block);
+
+    if (virtual_block_result != VK_SUCCESS) {
+        vmaDestroyBuffer(m_vma, out_buffer, out_allocation);
+        const char *string_result = string_VkResult(virtual_block_result);
+        throw Exception(MVR_RESULT_VULKAN_ERROR, fmt::format("Failed to create virtual block for shared permanent buffers, {}", string_result));
+    }
+
+    Renderer::instance().debug_name_object(
+            reinterpret_cast<uint64_t>(out_buffer),
+            VK_OBJECT_TYPE_BUFFER,
+            fmt::format("Shared permanent block {}", m_blocks.size())
+    );
+
+    m_blocks.push_back({
+        .buffer = out_buffer,
+        .allocation = out_allocation,
+        .virtual_block = out_virtual_block,
+        .size = m_block_size,
+        .allocation_count = 0,
+    });
+    spdlog::info("Created shared permanent buffer block {}.", m_blocks.size() - 1);
+    return m_blocks.back();
+}
+
+void MVRender::SharedBufferPool::destroy_block(SharedBufferBlock &block) {
+    vmaClearVirtualBlock(block.virtual_block);
+    vmaDestroyVirtualBlock(block.virtual_block);
+    vmaDestroyBuffer(m_vma, block.buffer, block.allocation);
+}
+
+MVRender::SharedBufferRange MVRender::SharedBufferPool::allocate(VkDeviceSize size) {
+    VmaVirtualAllocationCreateInfo allocation_create_info = {
+        .size = size,
+        .alignment = m_alignment,
+    };
+    SharedBufferRange range = {};
+
+    // Newest blocks are the most likely to have room
+    for (auto block = m_blocks.rbegin(); block != m_blocks.rend(); block++) {
+        if (vmaVirtualAllocate(block->virtual_block, &allocation_create_info, &range.virtual_allocation, &range.offset) == VK_SUCCESS) {
+            range.buffer = block->buffer;
+            block->allocation_count += 1;
+            return range;
+        }
+    }
+
+    SharedBufferBlock &block = create_block();
+    VkResult result = vmaVirtualAllocate(block.virtual_block, &allocation_create_info, &range.virtual_allocation, &range.offset);
+    if (result != VK_SUCCESS) {
+        const char *string_result = string_VkResult(result);
+        throw Exception(MVR_RESULT_FAILURE, fmt::format("Failed to fit {} bytes in a new shared permanent buffer block, {}", size, string_result));
+    }
+    range.buffer = block.buffer;
+    block.allocation_count += 1;
+    return range;
+}
+
+void MVRender::SharedBufferPool::free(const SharedBufferRange &range) {
+    for (auto &block: m_blocks) {
+        if (block.buffer == range.buffer) {
+            vmaVirtualFree(block.virtual_block, range.virtual_allocation);
+            block.allocation_count -= 1;
+            return;
+        }
+    }
+}
+
+VkDeviceSize MVRender::SharedBufferPool::block_bytes() const {
+    VkDeviceSize bytes = 0;
+    for (auto &block: m_blocks) {
+        bytes += block.size;
+    }
+    return bytes;
+}
@@ -0,0 +1,143 @@
+#define VK_NO_PROTOTYPES
+#include <volk.h>
+#include <vulkan/vk_enum_string_helper.h>
+#include <vk_mem_alloc.h>
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include "render/StagingRing.hpp"
+#include "render/Renderer.hpp"
+#include "render/Constants.hpp"
+#include "render/Logging.hpp"
+
+MVRender::StagingRing::StagingRing(StagingRingCreateInfo &create_info) {
+    m_vma = create_info.allocator;
+    m_size = create_info.size;
+
+    // Reading write-combined memory is painfully slow, so readback rings ask for cached memory
+    VkBufferCreateInfo buffer_create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = m_size,
+        .usage = create_info.readback ? VK_BUFFER_USAGE_TRANSFER_DST_BIT : VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        .queueFamilyIndexCount = 1,
+        .pQueueFamilyIndices = &create_info.queue_family_index,
+    };
+    VmaAllocationCreateInfo allocation_create_info = {
+        .flags = VMA_ALLOCATION_CREATE_MAPPED_BIT,
+        .usage = create_info.readback ? VMA_MEMORY_USAGE_GPU_TO_CPU : VMA_MEMORY_USAGE_CPU_TO_GPU,
+        .requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+        .preferredFlags = create_info.readback ? static_cast<VkMemoryPropertyFlags>(VK_MEMORY_PROPERTY_HOST_CACHED_BIT) : 0u,
+    };
+    VmaAllocationInfo allocation_info;
+    VkResult result = vmaCreateBuffer(m_vma, &buffer_create_info, &allocation_create_info, &m_buffer, &m_allocation, &allocation_info);
+
+    if (result != VK_SUCCESS) {
+        const char *string_result = string_VkResult(result);
+        throw Exception(MVR_RESULT_CRITICAL_VULKAN_ERROR, fmt::format("Failed to allocate {} ring of {} bytes, {}", create_info.readback ? "readback" : "staging", m_size, string_result));
+    }
+
+    Renderer::instance().debug_name_object(
+            reinterpret_cast<uint64_t>(m_buffer),
+            VK_OBJECT_TYPE_BUFFER,
+            fmt::format("{} ring", create_info.readback ? "Readback" : "Staging")
+    );
+
+    VkMemoryPropertyFlags memory_flags;
+    vmaGetAllocationMemoryProperties(m_vma, m_allocation, &memory_flags);
+    m_coherent = (memory_flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+    m_data = allocation_info.pMappedData;
+    spdlog::info("Created {} byte {} ring.", m_size, create_info.readback ? "readback" : "staging");
+}
+
+MVRender::StagingRing::~StagingRing() {
+    vmaDestroyBuffer(m_vma, m_buffer, m_allocation);
+}
+
+bool MVRender::StagingRing::try_allocate(VkDeviceSize size, VkDeviceSize *offset, uint64_t *region) {
+    // Keep every region aligned so copies out of the ring are happy
+    if (size % STAGING_RING_ALIGNMENT != 0) {
+        size += STAGING_RING_ALIGNMENT - (size % STAGING_RING_ALIGNMENT);
+    }
+    if (size > m_size) {
+        return false;
+    }
+    if (m_used == 0) {
+        m_head = 0;
+        m_tail = 0;
+    }
+
+    // Space is free either between head and the end of the ring then the start of the ring and tail,
+    // or just between head and tail once head has wrapped around
+    VkDeviceSize start;
+    VkDeviceSize padding = 0;
+    if (m_used != 0 && m_head == m_tail) {
+        return false;
+    } else if (m_head >= m_tail) {
+        if (m_size - m_head >= size) {
+            start = m_head;
+        } else if (m_tail >= size) {
+            padding = m_size - m_head;
+            start = 0;
+        } else {
+            return false;
+        }
+    } else if (m_tail - m_head >= size) {
+        start = m_head;
+    } else {
+        return false;
+    }
+
+    m_regions.push_back({
+        .end = start + size,
+        .size = size + padding,
+        .timeline_value = 0,
+        .held = region != nullptr,
+    });
+    if (region != nullptr) {
+        *region = m_first_region + m_regions.size() - 1;
+    }
+    m_unsubmitted += 1;
+    m_head = start + size;
+    m_used += size + padding;
+    *offset = start;
+    return true;
+}
+
+void MVRender::StagingRing::release(uint64_t region) {
+    m_regions[region - m_first_region].held = false;
+}
+
+void MVRender::StagingRing::flush(VkDeviceSize offset, VkDeviceSize size) {
+    if (!m_coherent) {
+        vmaFlushAllocation(m_vma, m_allocation, offset, size);
+    }
+}
+
+void MVRender::StagingRing::invalidate(VkDeviceSize offset, VkDeviceSize size) {
+    if (!m_coherent) {
+        vmaInvalidateAllocation(m_vma, m_allocation, offset, size);
+    }
+}
+
+void MVRender::StagingRing::submit(uint64_t timeline_value) {
+    for (size_t i = m_regions.size() - m_unsubmitted; i < m_regions.size(); i++) {
+        m_regions[i].timeline_value = timeline_value;
+    }
+    m_unsubmitted = 0;
+}
+
+void MVRender::StagingRing::reclaim(uint64_t completed_value) {
+    while (m_regions.size() > m_unsubmitted && !m_regions.front().held && m_regions.front().timeline_value <= completed_value) {
+        m_tail = m_regions.front().end;
+        m_used -= m_regions.front().size;
+        m_regions.pop_front();
+        m_first_region += 1;
+    }
+}
+
+uint64_t MVRender::StagingRing::oldest_value() const {
+    if (m_regions.size() == m_unsubmitted || m_regions.front().held) {
+        return 0;
+    }
+    return m_regions.front().timeline_value;
+}
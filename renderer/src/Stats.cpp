@@ -0,0 +1,189 @@
+#define VK_NO_PROTOTYPES
+#include <volk.h>
+#include <vk_mem_alloc.h>
+#include <algorithm>
+#include <vector>
+
+#include "render/Renderer.hpp"
+#include "render/Stats.h"
+#include "render/Logging.hpp"
+
+void MVRender::Renderer::get_memory_stats(MVR_MemoryStats *stats) {
+    *stats = {};
+
+    // VMA keeps these up to date itself, with the budget extension it only asks the driver every so often
+    const VkPhysicalDeviceMemoryProperties *memory_properties;
+    vmaGetMemoryProperties(m_vma, &memory_properties);
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+    vmaGetHeapBudgets(m_vma, budgets);
+    stats->budget_supported = m_memory_budget_enabled;
+    stats->heap_count = memory_properties->memoryHeapCount < MVR_MAX_MEMORY_HEAPS ? memory_properties->memoryHeapCount : MVR_MAX_MEMORY_HEAPS;
+    for (uint32_t i = 0; i < stats->heap_count; i++) {
+        stats->heaps[i].budget = budgets[i].budget;
+        stats->heaps[i].usage = budgets[i].usage;
+        stats->heaps[i].device_local = (memory_properties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+    }
+
+    // Temp pages are all owned by the pool, whichever frame is borrowing them
+    PagePoolStats page_stats = m_page_pool->stats();
+    stats->temp_page_count = page_stats.page_count;
+    stats->temp_page_bytes = page_stats.page_bytes;
+    stats->temp_high_water_mark = page_stats.high_water_mark;
+    stats->temp_bytes_last_frame = page_stats.last_frame_bytes;
+    stats->temp_alignment_waste = page_stats.last_frame_waste;
+
+    stats->permanent_buffer_count = m_permanent_buffers.size();
+    stats->permanent_buffer_bytes = m_permanent_buffer_bytes;
+
+    // Peaks are per frame, each frame in flight places its own images
+    for (auto &frame: m_frame_res) {
+        TransientImagePoolStats transient_stats = frame.transient_images->stats();
+        stats->transient_image_bytes += transient_stats.bytes;
+        stats->transient_image_peak_bytes = std::max<uint64_t>(stats->transient_image_peak_bytes, transient_stats.peak_bytes);
+        stats->transient_image_unaliased_bytes = std::max<uint64_t>(stats->transient_image_unaliased_bytes, transient_stats.peak_unaliased_bytes);
+        stats->transient_image_lazy_bytes += transient_stats.lazy_bytes;
+    }
+}
+
+void MVRender::Renderer::record_frame_timing(std::chrono::steady_clock::time_point wait_start, std::chrono::steady_clock::time_point wait_end) {
+    using milliseconds = std::chrono::duration<double, std::milli>;
+
+    // This wait starts a new frame and ends the last one, which gets counted along with the wait it
+    // started with. The first frame after a change has nothing to measure its length against yet.
+    if (m_last_frame_start != std::chrono::steady_clock::time_point()) {
+        m_last_frame_time = milliseconds(wait_start - m_last_frame_start).count();
+        m_total_frame_time += m_last_frame_time;
+        m_total_wait_time += m_last_wait_time;
+        m_timed_frames += 1;
+    }
+    m_last_frame_start = wait_start;
+    m_last_wait_time = milliseconds(wait_end - wait_start).count();
+}
+
+void MVRender::Renderer::reset_frame_timing() {
+    m_last_frame_start = {};
+    m_timed_frames = 0;
+    m_total_frame_time = 0;
+    m_total_wait_time = 0;
+    m_last_frame_time = 0;
+    m_last_wait_time = 0;
+}
+
+void MVRender::Renderer::finish_frame_timings(uint64_t completed_value, std::chrono::steady_clock::time_point now) {
+    using milliseconds = std::chrono::duration<double, std::milli>;
+    for (; m_unfinished_timing <= completed_value; m_unfinished_timing++) {
+        FrameTimingRecord &record = m_frame_timings[m_unfinished_timing % FRAME_TIMING_HISTORY];
+        if (record.timing.frame == m_unfinished_timing && record.submit_time != std::chrono::steady_clock::time_point()) {
+            record.timing.gpu_latency = milliseconds(now - record.submit_time).count();
+            record.complete = true;
+        }
+    }
+}
+
+uint32_t MVRender::Renderer::get_frame_timings(MVR_FrameTiming *timings, uint32_t max_count) {
+    std::vector<const MVR_FrameTiming *> finished;
+    for (auto &record: m_frame_timings) {
+        if (record.complete) {
+            finished.push_back(&record.timing);
+        }
+    }
+    std::sort(finished.begin(), finished.end(), [](const MVR_FrameTiming *a, const MVR_FrameTiming *b) {
+        return a->frame < b->frame;
+    });
+
+    // Newest frames are at the back
+    const size_t count = std::min<size_t>(finished.size(), max_count);
+    for (size_t i = 0; i < count; i++) {
+        timings[i] = *finished[finished.size() - count + i];
+    }
+    return static_cast<uint32_t>(count);
+}
+
+void MVRender::Renderer::push_gpu_zone(const char *name, uint32_t order) {
+    if (name == nullptr) {
+        throw Exception(MVR_RESULT_INVALID_ARGUMENT, "GPU zones need a name");
+    }
+    m_frame_res.at(m_frame_count % m_frames_in_flight).gpu_profiler->push_zone(name, order);
+}
+
+void MVRender::Renderer::pop_gpu_zone(uint32_t order) {
+    m_frame_res.at(m_frame_count % m_frames_in_flight).gpu_profiler->pop_zone(order);
+}
+
+void MVRender::Renderer::get_gpu_frame_stats(MVR_GpuFrameStats *stats) {
+    *stats = m_gpu_frame_stats;
+    stats->supported = m_frame_res.at(0).gpu_profiler->supported();
+}
+
+void MVRender::Renderer::get_frame_stats(MVR_FrameStats *stats) {
+    *stats = {};
+    stats->frames_in_flight = m_frames_in_flight;
+    stats->frame_count = m_timed_frames;
+    stats->last_frame_time = m_last_frame_time;
+    stats->last_wait_time = m_last_wait_time;
+    if (m_timed_frames > 0) {
+        stats->average_frame_time = m_total_frame_time / static_cast<double>(m_timed_frames);
+        stats->average_wait_time = m_total_wait_time / static_cast<double>(m_timed_frames);
+    }
+}
+
+MVR_API MVR_Result mvr_GetMemoryStats(MVR_MemoryStats *stats) {
+    MVR_Result status = MVR_RESULT_SUCCESS;
+    try {
+        MVRender::Renderer::instance().get_memory_stats(stats);
+    } catch (MVRender::Exception& r) {
+        status = r.result();
+    }
+    return status;
+}
+
+MVR_API MVR_Result mvr_GetFrameStats(MVR_FrameStats *stats) {
+    MVR_Result status = MVR_RESULT_SUCCESS;
+    try {
+        MVRender::Renderer::instance().get_frame_stats(stats);
+    } catch (MVRender::Exception& r) {
+        status = r.result();
+    }
+    return status;
+}
+
+MVR_API MVR_Result mvr_GetFrameTimings(MVR_FrameTiming *timings, uint32_t max_count, uint32_t *count) {
+    MVR_Result status = MVR_RESULT_SUCCESS;
+    *count = 0;
+    try {
+        *count = MVRender::Renderer::instance().get_frame_timings(timings, max_count);
+    } catch (MVRender::Exception& r) {
+        status = r.result();
+    }
+    return status;
+}
+
+MVR_API MVR_Result mvr_PushGpuZone(const char *name, uint32_t order) {
+    MVR_Result status = MVR_RESULT_SUCCESS;
+    try {
+        MVRender::Renderer::instance().push_gpu_zone(name, order);
+    } catch (MVRender::Exception& r) {
+        status = r.result();
+    }
+    return status;
+}
+
+MVR_API MVR_Result mvr_PopGpuZone(uint32_t order) {
+    MVR_Result status = MVR_RESULT_SUCCESS;
+    try {
+        MVRender::Renderer::instance().pop_gpu_zone(order);
+    } catch (MVRender::Exception& r) {
+        status = r.result();
+    }
+    return status;
+}
+
+MVR_API MVR_Result mvr_GetGpuFrameStats(MVR_GpuFrameStats *stats) {
+    MVR_Result status = MVR_RESULT_SUCCESS;
+    try {
+        MVRender::Renderer::instance().get_gpu_frame_stats(stats);
+    } catch (MVRender::Exception& r) {
+        status = r.result();
+    }
+    return status;
+}
@@ -0,0 +1,134 @@
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "render/Trace.hpp"
+#include "render/Stats.h"
+#include "render/Logging.hpp"
+
+// Every thread's ring, rings stay around after their thread exits so dumps still see its zones
+static std::mutex g_trace_mutex;
+static std::vector<std::unique_ptr<MVRender::TraceBuffer>> g_trace_buffers;
+static thread_local MVRender::TraceBuffer *t_trace_buffer = nullptr;
+
+// A zone copied out of a ring, index is its position in everything the thread ever wrote
+struct TraceEventCopy {
+    uint64_t index;
+    const char *name;
+    uint64_t start;
+    uint64_t duration;
+};
+
+uint64_t MVRender::trace_now() {
+    static const auto trace_start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - trace_start).count();
+}
+
+void MVRender::trace_event(const char *name, uint64_t start, uint64_t end) {
+    TraceBuffer *buffer = t_trace_buffer;
+    if (buffer == nullptr) {
+        std::lock_guard lock(g_trace_mutex);
+        auto new_buffer = std::make_unique<TraceBuffer>();
+        new_buffer->thread_id = static_cast<uint32_t>(g_trace_buffers.size() + 1);
+        buffer = new_buffer.get();
+        g_trace_buffers.push_back(std::move(new_buffer));
+        t_trace_buffer = buffer;
+    }
+
+    // The fence keeps the last head store ahead of these writes, so a dump that sees them also sees
+    // that the slot's old event is being overwritten
+    const uint64_t head = buffer->head.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    TraceEvent &event = buffer->events[head % TRACE_BUFFER_EVENTS];
+    event.name.store(name, std::memory_order_relaxed);
+    event.start.store(start, std::memory_order_relaxed);
+    event.duration.store(end - start, std::memory_order_relaxed);
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+// Names are almost always literals from the renderer, but they still have to be valid JSON
+static std::string escape_json(const char *string) {
+    std::string escaped;
+    for (const char *c = string; *c != 0; c++) {
+        if (*c == '"' || *c == '\\') {
+            escaped.push_back('\\');
+            escaped.push_back(*c);
+        } else if (static_cast<unsigned char>(*c) < 0x20) {
+            escaped.append(fmt::format("\\u{:04x}", static_cast<int>(*c)));
+        } else {
+            escaped.push_back(*c);
+        }
+    }
+    return escaped;
+}
+
+void MVRender::dump_trace(const std::string &path) {
+    std::ofstream file(path, std::ios::out | std::ios::trunc);
+    if (!file.is_open()) {
+        throw Exception(MVR_RESULT_INVALID_ARGUMENT, fmt::format("Couldn't open {} to write the trace to", path));
+    }
+
+    // Complete events in the Chrome trace format, which Perfetto and chrome://tracing both open
+    std::string json = "{\"traceEvents\":[";
+    size_t event_count = 0;
+    std::vector<TraceEventCopy> events;
+    {
+        std::lock_guard lock(g_trace_mutex);
+        for (auto &buffer: g_trace_buffers) {
+            const uint64_t end = buffer->head.load(std::memory_order_acquire);
+            const uint64_t begin = end > TRACE_BUFFER_EVENTS ? end - TRACE_BUFFER_EVENTS : 0;
+            events.clear();
+            for (uint64_t i = begin; i < end; i++) {
+                TraceEvent &event = buffer->events[i % TRACE_BUFFER_EVENTS];
+                events.push_back({
+                        .index = i,
+                        .name = event.name.load(std::memory_order_relaxed),
+                        .start = event.start.load(std::memory_order_relaxed),
+                        .duration = event.duration.load(std::memory_order_relaxed),
+                });
+            }
+
+            // The thread kept going while we copied, anything it may have started overwriting is thrown out
+            std::atomic_thread_fence(std::memory_order_acquire);
+            const uint64_t head = buffer->head.load(std::memory_order_relaxed);
+            const uint64_t first_valid = head + 1 > TRACE_BUFFER_EVENTS ? head + 1 - TRACE_BUFFER_EVENTS : 0;
+            for (auto &event: events) {
+                if (event.index < first_valid) {
+                    continue;
+                }
+                json.append(fmt::format(
+                        "{}{{\"name\":\"{}\",\"ph\":\"X\",\"ts\":{:.3f},\"dur\":{:.3f},\"pid\":1,\"tid\":{}}}",
+                        event_count == 0 ? "\n" : ",\n",
+                        escape_json(event.name),
+                        static_cast<double>(event.start) / 1000.0,
+                        static_cast<double>(event.duration) / 1000.0,
+                        buffer->thread_id
+                ));
+                event_count += 1;
+            }
+        }
+    }
+    json.append("\n],\"displayTimeUnit\":\"ms\"}\n");
+
+    file << json;
+    if (!file.good()) {
+        throw Exception(MVR_RESULT_INVALID_ARGUMENT, fmt::format("Failed to write the trace to {}", path));
+    }
+    spdlog::info("Wrote {} trace events to {}.", event_count, path);
+}
+
+MVR_API MVR_Result mvr_DumpTrace(const char *path) {
+    MVR_Result status = MVR_RESULT_SUCCESS;
+    try {
+        if (path == nullptr) {
+            throw MVRender::Exception(MVR_RESULT_INVALID_ARGUMENT, "A trace needs a path to be written to");
+        }
+        MVRender::dump_trace(path);
+    } catch (MVRender::Exception& r) {
+        status = r.result();
+    }
+    return status;
+}
@@ -0,0 +1,258 @@
+#define VK_NO_PROTOTYPES
+#include <volk.h>
+#include <vk_mem_alloc.h>
+#include <vulkan/vk_enum_string_helper.h>
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <algorithm>
+
+#include "render/TransientImagePool.hpp"
+#include "render/Renderer.hpp"
+#include "render/Logging.hpp"
+
+// Usages tilers can keep entirely in tile memory
+constexpr VkImageUsageFlags LAZY_USAGE = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+MVRender::TransientImagePool::TransientImagePool(TransientImagePoolCreateInfo &create_info) {
+    m_allocator = create_info.allocator;
+    m_logical_device = create_info.logical_device;
+    m_frame_in_flight_index = create_info.frame_in_flight_index;
+
+    const VkPhysicalDeviceMemoryProperties *memory_properties;
+    vmaGetMemoryProperties(m_allocator, &memory_properties);
+    for (uint32_t i = 0; i < memory_properties->memoryTypeCount; i++) {
+        if (memory_properties->memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) {
+            m_lazy_supported = true;
+        }
+    }
+}
+
+MVRender::TransientImagePool::~TransientImagePool() {
+    destroy_images();
+    if (m_heap != VK_NULL_HANDLE) {
+        vmaFreeMemory(m_allocator, m_heap);
+    }
+}
+
+MVRender::TransientImage MVRender::TransientImagePool::create_image(const TransientImageDescription &description, const char *name) {
+    TransientImage image = {};
+    VkImageCreateInfo image_create_info = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = description.format,
+            .extent = {description.width, description.height, 1},
+            .mipLevels = description.mip_levels,
+            .arrayLayers = description.array_layers,
+            .samples = description.samples,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = description.usage,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+
+    // Lazy memory gets its own allocation, if VMA can't find a type for it the image goes in the heap instead.
+    // Views are made once every image has memory behind it.
+    VkResult result = VK_ERROR_FEATURE_NOT_PRESENT;
+    if (m_lazy_supported && (description.usage & ~LAZY_USAGE) == 0) {
+        VkImageCreateInfo lazy_create_info = image_create_info;
+        lazy_create_info.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+        VmaAllocationCreateInfo allocation_create_info = {
+                .usage = VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED,
+        };
+        VmaAllocationInfo allocation_info;
+        result = vmaCreateImage(m_allocator, &lazy_create_info, &allocation_create_info, &image.image, &image.allocation, &allocation_info);
+        if (result == VK_SUCCESS) {
+            image.size = allocation_info.size;
+            image.lazy = true;
+        }
+    }
+    if (result != VK_SUCCESS) {
+        result = vkCreateImage(m_logical_device, &image_create_info, nullptr, &image.image);
+        if (result != VK_SUCCESS) {
+            const char *string_result = string_VkResult(result);
+            throw Exception(MVR_RESULT_CRITICAL_VULKAN_ERROR, fmt::format("Failed to create transient image {}, Vulkan error {}", name, string_result));
+        }
+    }
+
+    Renderer::instance().debug_name_object(
+            reinterpret_cast<uint64_t>(image.image),
+            VK_OBJECT_TYPE_IMAGE,
+            fmt::format("{} FIF[{}]", name, m_frame_in_flight_index)
+    );
+    return image;
+}
+
+void MVRender::TransientImagePool::destroy_images() {
+    for (auto &image: m_images) {
+        if (image.view != VK_NULL_HANDLE) {
+            vkDestroyImageView(m_logical_device, image.view, nullptr);
+        }
+        if (image.allocation != VK_NULL_HANDLE) {
+            vmaDestroyImage(m_allocator, image.image, image.allocation);
+        } else if (image.image != VK_NULL_HANDLE) {
+            vkDestroyImage(m_logical_device, image.image, nullptr);
+        }
+    }
+    m_images.clear();
+    m_requests.clear();
+}
+
+const std::vector<MVRender::TransientImage> &MVRender::TransientImagePool::place(const std::vector<TransientImageRequest> &requests, const std::vector<const char *> &names) {
+    if (requests == m_requests && requests.size() == m_images.size()) {
+        return m_images;
+    }
+    destroy_images();
+
+    // Anything that goes wrong leaves the pool empty, the next frame starts over
+    try {
+        std::vector<VkMemoryRequirements> requirements(requests.size());
+        for (size_t i = 0; i < requests.size(); i++) {
+            m_images.push_back(create_image(requests[i].description, names[i]));
+            if (!m_images[i].lazy) {
+                vkGetImageMemoryRequirements(m_logical_device, m_images[i].image, &requirements[i]);
+                m_images[i].size = requirements[i].size;
+            }
+        }
+
+        // Biggest first, each image goes at the lowest offset clear of every image placed so far that it's
+        // alive at the same time as. Images whose memory types don't fit with the rest get their own allocation.
+        std::vector<uint32_t> order;
+        for (uint32_t i = 0; i < requests.size(); i++) {
+            if (!m_images[i].lazy) {
+                order.push_back(i);
+            }
+        }
+        std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return m_images[a].size > m_images[b].size; });
+        auto alive_together = [&requests](uint32_t a, uint32_t b) {
+            return requests[a].first_batch <= requests[b].last_batch && requests[b].first_batch <= requests[a].last_batch;
+        };
+        std::vector<uint32_t> placed;
+        uint32_t memory_type_bits = UINT32_MAX;
+        VkDeviceSize heap_size = 0;
+        VkDeviceSize heap_alignment = 1;
+        VkDeviceSize unaliased_bytes = 0;
+        for (uint32_t i: order) {
+            unaliased_bytes += requirements[i].size;
+            if ((memory_type_bits & requirements[i].memoryTypeBits) == 0) {
+                continue;
+            }
+            memory_type_bits &= requirements[i].memoryTypeBits;
+            heap_alignment = std::max(heap_alignment, requirements[i].alignment);
+
+            VkDeviceSize offset = 0;
+            bool moved = true;
+            while (moved) {
+                moved = false;
+                for (uint32_t other: placed) {
+                    const TransientImage &image = m_images[other];
+                    if (alive_together(i, other) && offset < image.offset + image.size && image.offset < offset + requirements[i].size) {
+                        offset = align_up(image.offset + image.size, requirements[i].alignment);
+                        moved = true;
+                    }
+                }
+            }
+            m_images[i].offset = offset;
+            m_images[i].in_heap = true;
+            heap_size = std::max(heap_size, offset + requirements[i].size);
+            placed.push_back(i);
+        }
+
+        // The heap is kept as long as it's big enough and of a type every image can live in
+        if (heap_size > 0 && (heap_size > m_heap_size || (memory_type_bits & (1u << m_heap_memory_type)) == 0)) {
+            if (m_heap != VK_NULL_HANDLE) {
+                vmaFreeMemory(m_allocator, m_heap);
+                m_heap = VK_NULL_HANDLE;
+                m_heap_size = 0;
+            }
+            VkMemoryRequirements heap_requirements = {
+                    .size = heap_size,
+                    .alignment = heap_alignment,
+                    .memoryTypeBits = memory_type_bits,
+            };
+            VmaAllocationCreateInfo allocation_create_info = {
+                    .usage = VMA_MEMORY_USAGE_UNKNOWN,
+                    .requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                    .memoryTypeBits = memory_type_bits,
+            };
+            VmaAllocationInfo allocation_info;
+            VkResult result = vmaAllocateMemory(m_allocator, &heap_requirements, &allocation_create_info, &m_heap, &allocation_info);
+            if (result != VK_SUCCESS) {
+                m_heap = VK_NULL_HANDLE;
+                throw Exception(MVR_RESULT_CRITICAL_VULKAN_ERROR, fmt::format("Failed to allocate {} bytes for transient images, Vulkan error {}", heap_size, string_VkResult(result)));
+            }
+            m_heap_size = heap_size;
+            m_heap_memory_type = allocation_info.memoryType;
+            spdlog::info("Transient image heap FIF[{}] is now {} bytes.", m_frame_in_flight_index, heap_size);
+        }
+
+        VkDeviceSize dedicated_bytes = 0;
+        for (uint32_t i: order) {
+            TransientImage &image = m_images[i];
+            if (!image.in_heap) {
+                VmaAllocationCreateInfo allocation_create_info = {
+                        .usage = VMA_MEMORY_USAGE_UNKNOWN,
+                        .requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                };
+                VkResult result = vmaAllocateMemory(m_allocator, &requirements[i], &allocation_create_info, &image.allocation, nullptr);
+                if (result != VK_SUCCESS) {
+                    image.allocation = VK_NULL_HANDLE;
+                    throw Exception(MVR_RESULT_CRITICAL_VULKAN_ERROR, fmt::format("Failed to allocate transient image {}, Vulkan error {}", names[i], string_VkResult(result)));
+                }
+                dedicated_bytes += requirements[i].size;
+            }
+            VkResult result = vmaBindImageMemory2(m_allocator, image.in_heap ? m_heap : image.allocation, image.in_heap ? image.offset : 0, image.image, nullptr);
+            if (result != VK_SUCCESS) {
+                throw Exception(MVR_RESULT_CRITICAL_VULKAN_ERROR, fmt::format("Failed to bind transient image {}, Vulkan error {}", names[i], string_VkResult(result)));
+            }
+        }
+
+        for (uint32_t i = 0; i < requests.size(); i++) {
+            const TransientImageDescription &description = requests[i].description;
+            VkImageViewCreateInfo view_create_info = {
+                    .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+                    .image = m_images[i].image,
+                    .viewType = description.array_layers > 1 ? VK_IMAGE_VIEW_TYPE_2D_ARRAY : VK_IMAGE_VIEW_TYPE_2D,
+                    .format = description.format,
+                    .subresourceRange = {
+                            .aspectMask = description.aspect,
+                            .baseMipLevel = 0, .levelCount = description.mip_levels,
+                            .baseArrayLayer = 0, .layerCount = description.array_layers,
+                    },
+            };
+            VkResult result = vkCreateImageView(m_logical_device, &view_create_info, nullptr, &m_images[i].view);
+            if (result != VK_SUCCESS) {
+                m_images[i].view = VK_NULL_HANDLE;
+                throw Exception(MVR_RESULT_CRITICAL_VULKAN_ERROR, fmt::format("Failed to create view of transient image {}, Vulkan error {}", names[i], string_VkResult(result)));
+            }
+        }
+
+        m_requests = requests;
+        m_peak_bytes = std::max(m_peak_bytes, heap_size + dedicated_bytes);
+        m_peak_unaliased_bytes = std::max(m_peak_unaliased_bytes, unaliased_bytes);
+    } catch (Exception &) {
+        destroy_images();
+        throw;
+    }
+    return m_images;
+}
+
+MVRender::TransientImagePoolStats MVRender::TransientImagePool::stats() const {
+    TransientImagePoolStats stats = {
+            .bytes = m_heap_size,
+            .peak_bytes = m_peak_bytes,
+            .peak_unaliased_bytes = m_peak_unaliased_bytes,
+    };
+    for (auto &image: m_images) {
+        if (!image.in_heap) {
+            stats.bytes += image.size;
+        }
+        if (image.lazy) {
+            stats.lazy_bytes += image.size;
+        }
+    }
+    return stats;
+}
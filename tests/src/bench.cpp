@@ -0,0 +1,66 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <render/Renderer.hpp>
+#include <render/Constants.hpp>
+#include <render/Buffers.h>
+#include <string>
+#include <vector>
+
+TEST_CASE("Temporary buffer per-frame cost by page count", "[benchmark]") {
+    auto& renderer = MVRender::Renderer::instance();
+    renderer.initialize_vulkan_headless();
+    auto &allocator = renderer.get_buffer_allocator();
+
+    // Each allocation takes up a whole chunk, so this many fill a page
+    const uint64_t allocations_per_page = MVRender::VRAM_PAGE_SIZE / MVRender::TEMP_CHUNK_SIZE;
+
+    // No command buffers, so only the flushing gets measured
+    MVRender::CopyCommandsInfo copy_commands_info = {};
+
+    for (uint64_t page_count: {1, 16, 64}) {
+        BENCHMARK("Frame with " + std::to_string(page_count) + " temp pages") {
+            void *data = nullptr;
+            allocator.begin_frame();
+            for (uint64_t i = 0; i < page_count * allocations_per_page; i++) {
+                allocator.allocate_temp_buffer(MVRender::TEMP_CHUNK_SIZE, &data);
+            }
+            allocator.record_copy_commands(copy_commands_info);
+            return data;
+        };
+    }
+
+    renderer.quit_vulkan_headless();
+}
+
+TEST_CASE("Permanent buffer create/destroy cost", "[benchmark]") {
+    auto& renderer = MVRender::Renderer::instance();
+    renderer.initialize_vulkan_headless();
+    auto &shared_buffers = renderer.get_shared_buffer_pool();
+
+    // Mesh-sized buffers, packed into shared blocks versus one VkBuffer each. Destroying only queues the
+    // buffers up for deletion, so frames run after until every frame in flight has come back around and
+    // the memory has really been given back. The uploads go out in the first of those frames, the same
+    // work either way, so the difference is what packing saves.
+    uint8_t garbage[256] = {0};
+    std::vector<MVR_Buffer> buffers(1000);
+    for (uint64_t threshold: {MVRender::SHARED_BUFFER_THRESHOLD, uint64_t(0)}) {
+        shared_buffers.set_threshold(threshold);
+        BENCHMARK(std::string(threshold != 0 ? "Shared" : "Dedicated") + " create/destroy of 1000 buffers") {
+            renderer.begin_frame();
+            for (auto &buffer: buffers) {
+                mvr_CreateBuffer(sizeof(garbage), garbage, &buffer);
+            }
+            renderer.end_frame();
+            for (auto buffer: buffers) {
+                mvr_DestroyBuffer(buffer);
+            }
+            for (uint32_t i = 0; i <= MVRender::FRAMES_IN_FLIGHT; i++) {
+                renderer.begin_frame();
+                renderer.end_frame();
+            }
+            return buffers.back();
+        };
+    }
+
+    renderer.quit_vulkan_headless();
+}
@@ -4,6 +4,27 @@
 #include <render/Logging.hpp>
 #include <render/Renderer.hpp>
 #include <render/Buffers.h>
+#include <render/Stats.h>
+#include <render/Readback.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+// Polls done until it's true or five seconds pass, returns whether it ended up true
+static bool wait_until(const std::function<bool()> &done) {
+    auto start = std::chrono::steady_clock::now();
+    while (!done() && std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return done();
+}
 
 TEST_CASE("User-facing error messages") {
     MVRender::set_error_message("123abc");
@@ -40,4 +61,1149 @@ TEST_CASE("Renderer integration test") {
     mvr_DestroyBuffer(permanent);
 
     renderer.quit_vulkan_headless();
-}
\ No newline at end of file
+}
+
+TEST_CASE("Multi-threaded temporary buffer throughput") {
+    auto& renderer = MVRender::Renderer::instance();
+    renderer.initialize_vulkan_headless();
+
+    constexpr int thread_count = 8;
+    constexpr int allocations_per_thread = 10000;
+    constexpr uint64_t allocation_size = 48;
+
+    struct Allocation {
+        MVRender::BufferDescriptor descriptor;
+        uint8_t fill;
+    };
+    std::vector<std::vector<Allocation>> allocations(thread_count);
+    std::atomic<int> failures = 0;
+
+    // Every thread hammers the allocator at once and fills its buffers with its own id
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; t++) {
+        threads.emplace_back([&renderer, &allocations, &failures, t]() {
+            allocations[t].reserve(allocations_per_thread);
+            for (int i = 0; i < allocations_per_thread; i++) {
+                void *data;
+                MVR_Buffer buffer;
+                if (mvr_AllocateTempBuffer(allocation_size, &data, &buffer) != MVR_RESULT_SUCCESS) {
+                    failures++;
+                    continue;
+                }
+                memset(data, t, allocation_size);
+                allocations[t].push_back({*renderer.resolve_buffer(buffer), static_cast<uint8_t>(t)});
+            }
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    WARN("Allocated " << thread_count * allocations_per_thread << " temp buffers on " << thread_count
+         << " threads in " << elapsed * 1000 << "ms (" << (thread_count * allocations_per_thread) / elapsed << " allocations/s)");
+    REQUIRE(failures == 0);
+
+    // No thread may have stomped on another thread's memory
+    std::vector<MVRender::BufferDescriptor> all;
+    for (auto &thread_allocations: allocations) {
+        for (auto &allocation: thread_allocations) {
+            auto *bytes = static_cast<uint8_t *>(allocation.descriptor.data);
+            REQUIRE(std::all_of(bytes, bytes + allocation_size, [&](uint8_t b) { return b == allocation.fill; }));
+            all.push_back(allocation.descriptor);
+        }
+    }
+
+    // And no two buffers may overlap in device memory
+    std::sort(all.begin(), all.end(), [](const auto &a, const auto &b) {
+        return a.buffer != b.buffer ? a.buffer < b.buffer : a.offset < b.offset;
+    });
+    for (size_t i = 1; i < all.size(); i++) {
+        if (all[i].buffer == all[i - 1].buffer) {
+            REQUIRE(all[i - 1].offset + all[i - 1].size <= all[i].offset);
+        }
+    }
+
+    renderer.quit_vulkan_headless();
+}
+
+TEST_CASE("Temp page pool trims pages after a spike") {
+    auto& renderer = MVRender::Renderer::instance();
+    renderer.initialize_vulkan_headless();
+    auto& allocator = renderer.get_buffer_allocator();
+    auto& pool = renderer.get_page_pool();
+
+    // One frame needs a whole lot of pages
+    constexpr int spike_pages = 32;
+    for (int i = 0; i < spike_pages; i++) {
+        void *data;
+        MVR_Buffer buffer;
+        REQUIRE(mvr_AllocateTempBuffer(MVRender::VRAM_PAGE_SIZE, &data, &buffer) == MVR_RESULT_SUCCESS);
+    }
+    REQUIRE(allocator.page_count() == spike_pages);
+
+    // Then goes back to barely using anything, the spare pages should go back to the pool and eventually be freed
+    for (uint64_t frame = 1; frame <= MVRender::TEMP_PAGE_TRIM_FRAMES + 2; frame++) {
+        allocator.begin_frame();
+        void *data;
+        MVR_Buffer buffer;
+        REQUIRE(mvr_AllocateTempBuffer(64, &data, &buffer) == MVR_RESULT_SUCCESS);
+        pool.trim(frame);
+    }
+    REQUIRE(allocator.page_count() == 1);
+    REQUIRE(pool.page_count() == 1);
+    REQUIRE(pool.high_water_mark() >= (spike_pages - 1) * MVRender::VRAM_PAGE_SIZE);
+
+    renderer.quit_vulkan_headless();
+}
+
+TEST_CASE("Large temp buffers get recycled dedicated pages") {
+    auto& renderer = MVRender::Renderer::instance();
+    renderer.initialize_vulkan_headless();
+    auto& allocator = renderer.get_buffer_allocator();
+    auto& pool = renderer.get_page_pool();
+
+    // A buffer bigger than a page gets a page of its own rounded up to its size class
+    void *data;
+    MVR_Buffer buffer;
+    REQUIRE(mvr_AllocateTempBuffer(3 * MVRender::VRAM_PAGE_SIZE, &data, &buffer) == MVR_RESULT_SUCCESS);
+    REQUIRE(allocator.page_count() == 1);
+    REQUIRE(pool.page_bytes() == 4 * MVRender::VRAM_PAGE_SIZE);
+
+    // Next frame the same size comes straight back out of the pool
+    allocator.begin_frame();
+    REQUIRE(allocator.page_count() == 0);
+    REQUIRE(mvr_AllocateTempBuffer(3 * MVRender::VRAM_PAGE_SIZE + 1, &data, &buffer) == MVR_RESULT_SUCCESS);
+    REQUIRE(pool.page_count() == 1);
+
+    // Small buffers still share a page
+    for (int i = 0; i < 100; i++) {
+        REQUIRE(mvr_AllocateTempBuffer(256, &data, &buffer) == MVR_RESULT_SUCCESS);
+    }
+    REQUIRE(allocator.page_count() == 2);
+
+    renderer.quit_vulkan_headless();
+}
+
+TEST_CASE("Stale temp buffer handles are caught") {
+    auto& renderer = MVRender::Renderer::instance();
+    renderer.initialize_vulkan_headless();
+    auto& allocator = renderer.get_buffer_allocator();
+
+    // Handles stay good for the whole frame no matter how many buffers come after them
+    void *data;
+    MVR_Buffer first;
+    REQUIRE(mvr_AllocateTempBuffer(64, &data, &first) == MVR_RESULT_SUCCESS);
+    for (uint32_t i = 0; i < MVRender::TEMP_DESCRIPTOR_CHUNK_SIZE * 4; i++) {
+        MVR_Buffer buffer;
+        REQUIRE(mvr_AllocateTempBuffer(64, &data, &buffer) == MVR_RESULT_SUCCESS);
+    }
+    MVRender::BufferDescriptor *descriptor = renderer.resolve_buffer(first);
+    REQUIRE(descriptor->size == 64);
+
+    // But not into the next one
+    allocator.begin_frame();
+    REQUIRE_THROWS_AS(renderer.resolve_buffer(first), MVRender::Exception);
+    MVR_Buffer fresh;
+    REQUIRE(mvr_AllocateTempBuffer(64, &data, &fresh) == MVR_RESULT_SUCCESS);
+    REQUIRE(fresh != first);
+    REQUIRE(renderer.resolve_buffer(fresh) == descriptor);
+    REQUIRE_THROWS_AS(renderer.resolve_buffer(MVR_INVALID_HANDLE), MVRender::Exception);
+
+    renderer.quit_vulkan_headless();
+}
+
+TEST_CASE("A full temp descriptor slab is out of memory until it's reset") {
+    MVRender::DescriptorSlab slab;
+    uint32_t slot;
+    bool claimed = true;
+    for (uint32_t i = 0; i < MVRender::MAX_TEMP_DESCRIPTOR_CHUNKS * MVRender::TEMP_DESCRIPTOR_CHUNK_SIZE; i++) {
+        claimed = claimed && slab.claim(&slot) != nullptr;
+    }
+    REQUIRE(claimed);
+    MVR_Result result = MVR_RESULT_SUCCESS;
+    try {
+        slab.claim(&slot);
+    } catch (MVRender::Exception &e) {
+        result = e.result();
+    }
+    REQUIRE(result == MVR_RESULT_OUT_OF_MEMORY);
+    REQUIRE(slab.size() == MVRender::MAX_TEMP_DESCRIPTOR_CHUNKS * MVRender::TEMP_DESCRIPTOR_CHUNK_SIZE);
+
+    slab.reset();
+    REQUIRE(slab.claim(&slot) != nullptr);
+    REQUIRE(slot == 0);
+}
+
+TEST_CASE("Temp buffers are packed by usage") {
+    auto& renderer = MVRender::Renderer::instance();
+    renderer.initialize_vulkan_headless();
+    auto& allocator = renderer.get_buffer_allocator();
+
+    // Uniform buffers land on the uniform alignment
+    void *data;
+    MVR_Buffer uniform_a, uniform_b;
+    MVR_AllocateTempBufferWithUsageParams uniform_params = {.size = 20, .usage = MVR_BUFFER_USAGE_UNIFORM};
+    REQUIRE(mvr_AllocateTempBufferWithUsage(&uniform_params, &data, &uniform_a) == MVR_RESULT_SUCCESS);
+    REQUIRE(mvr_AllocateTempBufferWithUsage(&uniform_params, &data, &uniform_b) == MVR_RESULT_SUCCESS);
+    auto *uniform_a_descriptor = renderer.resolve_buffer(uniform_a);
+    auto *uniform_b_descriptor = renderer.resolve_buffer(uniform_b);
+    REQUIRE(uniform_b_descriptor->offset % allocator.alignment(MVR_BUFFER_USAGE_UNIFORM) == 0);
+    REQUIRE(uniform_b_descriptor->offset - uniform_a_descriptor->offset == std::max<VkDeviceSize>(20, allocator.alignment(MVR_BUFFER_USAGE_UNIFORM)));
+
+    // Small vertex uploads are no longer padded out to storage alignment
+    MVR_Buffer vertex_a, vertex_b;
+    uint8_t vertices[12] = {0};
+    MVR_CreateTempBufferWithUsageParams vertex_params = {.size = 12, .data = vertices, .usage = MVR_BUFFER_USAGE_VERTEX};
+    REQUIRE(mvr_CreateTempBufferWithUsage(&vertex_params, &vertex_a) == MVR_RESULT_SUCCESS);
+    REQUIRE(mvr_CreateTempBufferWithUsage(&vertex_params, &vertex_b) == MVR_RESULT_SUCCESS);
+    auto *vertex_a_descriptor = renderer.resolve_buffer(vertex_a);
+    auto *vertex_b_descriptor = renderer.resolve_buffer(vertex_b);
+    REQUIRE(vertex_b_descriptor->offset - vertex_a_descriptor->offset == 12);
+
+    // Each usage gets its own pages
+    REQUIRE(vertex_a_descriptor->buffer != uniform_a_descriptor->buffer);
+    REQUIRE(allocator.page_count() == 2);
+
+    // Garbage usages are rejected
+    MVR_AllocateTempBufferWithUsageParams bad_params = {.size = 20, .usage = MVR_BUFFER_USAGE_COUNT};
+    MVR_Buffer bad;
+    REQUIRE(mvr_AllocateTempBufferWithUsage(&bad_params, &data, &bad) == MVR_RESULT_INVALID_ARGUMENT);
+    REQUIRE(bad == MVR_INVALID_HANDLE);
+
+    renderer.quit_vulkan_headless();
+}
+
+TEST_CASE("Memory stats track temp and permanent buffers") {
+    auto& renderer = MVRender::Renderer::instance();
+    renderer.initialize_vulkan_headless();
+
+    uint8_t garbage[100] = {0};
+    MVR_Buffer permanent;
+    REQUIRE(mvr_CreateBuffer(100, garbage, &permanent) == MVR_RESULT_SUCCESS);
+    void *data;
+    MVR_Buffer temp;
+    REQUIRE(mvr_AllocateTempBuffer(100, &data, &temp) == MVR_RESULT_SUCCESS);
+    renderer.get_buffer_allocator().begin_frame();
+
+    MVR_MemoryStats stats;
+    REQUIRE(mvr_GetMemoryStats(&stats) == MVR_RESULT_SUCCESS);
+    REQUIRE(stats.heap_count > 0);
+    REQUIRE(stats.heaps[0].budget > 0);
+    REQUIRE(stats.permanent_buffer_count == 1);
+    REQUIRE(stats.permanent_buffer_bytes == 100);
+    REQUIRE(stats.temp_page_count == 1);
+    REQUIRE(stats.temp_page_bytes == MVRender::VRAM_PAGE_SIZE);
+
+    // The temp buffer was carved out of a whole chunk, everything past its 100 bytes is slack
+    REQUIRE(stats.temp_bytes_last_frame == MVRender::TEMP_CHUNK_SIZE);
+    REQUIRE(stats.temp_alignment_waste == MVRender::TEMP_CHUNK_SIZE - 100);
+    REQUIRE(stats.temp_high_water_mark >= stats.temp_bytes_last_frame);
+
+    mvr_DestroyBuffer(permanent);
+    REQUIRE(mvr_GetMemoryStats(&stats) == MVR_RESULT_SUCCESS);
+    REQUIRE(stats.permanent_buffer_count == 0);
+
+    renderer.quit_vulkan_headless();
+}
+
+TEST_CASE("Permanent buffers upload without blocking") {
+    auto& renderer = MVRender::Renderer::instance();
+    renderer.initialize_vulkan_headless();
+
+    // Creating buffers only queues their uploads
+    constexpr int buffer_count = 500;
+    uint8_t garbage[256] = {0};
+    std::vector<MVR_Buffer> buffers(buffer_count);
+    for (auto &buffer: buffers) {
+        REQUIRE(mvr_CreateBuffer(sizeof(garbage), garbage, &buffer) == MVR_RESULT_SUCCESS);
+        REQUIRE(!mvr_IsBufferReady(buffer));
+    }
+
+    // They all go out with one frame
+    renderer.begin_frame();
+    renderer.end_frame();
+    REQUIRE(wait_until([&] { return mvr_IsBufferReady(buffers.back()); }));
+    REQUIRE(std::all_of(buffers.begin(), buffers.end(), mvr_IsBufferReady));
+    REQUIRE(!mvr_IsBufferReady(MVR_INVALID_HANDLE));
+
+    for (auto buffer: buffers) {
+        mvr_DestroyBuffer(buffer);
+    }
+    renderer.quit_vulkan_headless();
+}
+
+TEST_CASE("Big permanent uploads stream through the staging ring") {
+    auto& renderer = MVRender::Renderer::instance();
+    renderer.initialize_vulkan_headless();
+    auto &ring = renderer.get_staging_ring();
+
+    // Three and a bit rings worth of data has to be split up and flushed along the way
+    std::vector<uint8_t> garbage(ring.capacity() * 3 + 100, 7);
+    MVR_Buffer buffer;
+    REQUIRE(mvr_CreateBuffer(garbage.size(), garbage.data(), &buffer) == MVR_RESULT_SUCCESS);
+    REQUIRE(ring.used() <= ring.capacity());
+
+    renderer.begin_frame();
+    renderer.end_frame();
+    REQUIRE(wait_until([&] { return mvr_IsBufferReady(buffer); }));
+
+    // Once the copies are done the space is handed back
+    renderer.begin_frame();
+    REQUIRE(ring.used() == 0);
+    renderer.end_frame();
+
+    mvr_DestroyBuffer(buffer);
+    renderer.quit_vulkan_headless();
+}
+
+TEST_CASE("Small permanent buffers share blocks") {
+    auto& renderer = MVRender::Renderer::instance();
+    renderer.initialize_vulkan_headless();
+    auto &shared_buffers = renderer.get_shared_buffer_pool();
+
+    // Lots of tiny buffers all land in one block without overlapping
+    uint8_t garbage[100] = {0};
+    std::vector<MVR_Buffer> buffers(100);
+    for (auto &buffer: buffers) {
+        REQUIRE(mvr_CreateBuffer(sizeof(garbage), garbage, &buffer) == MVR_RESULT_SUCCESS);
+    }
+    REQUIRE(shared_buffers.block_count() == 1);
+    std::vector<MVRender::BufferDescriptor *> descriptors;
+    for (auto buffer: buffers) {
+        descriptors.push_back(renderer.resolve_buffer(buffer));
+    }
+    std::sort(descriptors.begin(), descriptors.end(), [](auto *a, auto *b) { return a->offset < b->offset; });
+    for (size_t i = 1; i < descriptors.size(); i++) {
+        REQUIRE(descriptors[i]->buffer == descriptors[0]->buffer);
+        REQUIRE(descriptors[i]->offset >= descriptors[i - 1]->offset + descriptors[i - 1]->size);
+    }
+
+    // Anything over the threshold still gets its own buffer
+    std::vector<uint8_t> big(MVRender::SHARED_BUFFER_THRESHOLD + 1);
+    MVR_Buffer big_buffer;
+    REQUIRE(mvr_CreateBuffer(big.size(), big.data(), &big_buffer) == MVR_RESULT_SUCCESS);
+    REQUIRE(renderer.resolve_buffer(big_buffer)->buffer != descriptors[0]->buffer);
+    REQUIRE(renderer.resolve_buffer(big_buffer)->offset == 0);
+
+    // Empty buffers are turned away before they reach a block
+    MVR_Buffer empty;
+    REQUIRE(mvr_CreateBuffer(0, garbage, &empty) == MVR_RESULT_INVALID_ARGUMENT);
+    REQUIRE(empty == MVR_INVALID_HANDLE);
+
+    renderer.begin_frame();
+    renderer.end_frame();
+    mvr_DestroyBuffer(big_buffer);
+    for (auto buffer: buffers) {
+        mvr_DestroyBuffer(buffer);
+    }
+    renderer.quit_vulkan_headless();
+}
+
+TEST_CASE("Destroyed permanent buffer handles are caught") {
+    auto& renderer = MVRender::Renderer::instance();
+    renderer.initialize_vulkan_headless();
+
+    uint8_t garbage[100] = {0};
+    MVR_Buffer first;
+    REQUIRE(mvr_CreateBuffer(sizeof(garbage), garbage, &first) == MVR_RESULT_SUCCESS);
+    REQUIRE(!MVRender::is_temp_handle(first));
+    mvr_DestroyBuffer(first);
+
+    // The new buffer reuses the slot but the old handle stays dead
+    MVR_Buffer second;
+    REQUIRE(mvr_CreateBuffer(sizeof(garbage), garbage, &second) == MVR_RESULT_SUCCESS);
+    REQUIRE(second != first);
+    REQUIRE_THROWS_AS(renderer.resolve_buffer(first), MVRender::Exception);
+    REQUIRE(!mvr_IsBufferReady(first));
+
+    // Destroying twice must not take the new buffer with it
+    mvr_DestroyBuffer(first);
+    REQUIRE(renderer.resolve_buffer(second)->size == sizeof(garbage));
+
+    MVR_MemoryStats stats;
+    REQUIRE(mvr_GetMemoryStats(&stats) == MVR_RESULT_SUCCESS);
+    REQUIRE(stats.permanent_buffer_count == 1);
+
+    mvr_DestroyBuffer(second);
+    renderer.quit_vulkan_headless();
+}
+
+TEST_CASE("Permanent buffer updates are merged") {
+    auto& renderer = MVRender::Renderer::instance();
+    renderer.initialize_vulkan_headless();
+
+    uint8_t garbage[1024] = {0};
+    MVR_Buffer buffer, neighbour;
+    REQUIRE(mvr_CreateBuffer(sizeof(garbage), garbage, &buffer) == MVR_RESULT_SUCCESS);
+    REQUIRE(mvr_CreateBuffer(sizeof(garbage), garbage, &neighbour) == MVR_RESULT_SUCCESS);
+    renderer.begin_frame();
+
+    // Touching and overlapping writes collapse into one range, a distant one stays separate
+    uint8_t data[16] = {1};
+    MVR_UpdateBufferParams params = {.buffer = buffer, .offset = 0, .size = sizeof(data), .data = data};
+    REQUIRE(mvr_UpdateBuffer(&params) == MVR_RESULT_SUCCESS);
+    params.offset = 16;
+    REQUIRE(mvr_UpdateBuffer(&params) == MVR_RESULT_SUCCESS);
+    params.offset = 8;
+    REQUIRE(mvr_UpdateBuffer(&params) == MVR_RESULT_SUCCESS);
+    REQUIRE(renderer.pending_update_count() == 1);
+    params.offset = 512;
+    REQUIRE(mvr_UpdateBuffer(&params) == MVR_RESULT_SUCCESS);
+    REQUIRE(renderer.pending_update_count() == 2);
+
+    // Buffers sharing a block never merge with each other
+    params.buffer = neighbour;
+    params.offset = 0;
+    REQUIRE(mvr_UpdateBuffer(&params) == MVR_RESULT_SUCCESS);
+    REQUIRE(renderer.pending_update_count() == 3);
+
+    // Out of range, temp and stale buffers are all rejected
+    params.offset = sizeof(garbage) - 8;
+    REQUIRE(mvr_UpdateBuffer(&params) == MVR_RESULT_INVALID_ARGUMENT);
+    MVR_Buffer temp;
+    REQUIRE(mvr_CreateTempBuffer(sizeof(data), data, &temp) == MVR_RESULT_SUCCESS);
+    params.buffer = temp;
+    params.offset = 0;
+    REQUIRE(mvr_UpdateBuffer(&params) == MVR_RESULT_INVALID_ARGUMENT);
+    mvr_DestroyBuffer(neighbour);
+    REQUIRE(renderer.pending_update_count() == 2);
+    params.buffer = neighbour;
+    REQUIRE(mvr_UpdateBuffer(&params) == MVR_RESULT_INVALID_HANDLE);
+
+    // Updates land with the frame
+    REQUIRE(!mvr_IsBufferReady(buffer));
+    renderer.end_frame();
+    REQUIRE(renderer.pending_update_count() == 0);
+    REQUIRE(wait_until([&] { return mvr_IsBufferReady(buffer); }));
+
+    mvr_DestroyBuffer(buffer);
+    renderer.quit_vulkan_headless();
+}
+
+TEST_CASE("Destroyed buffers wait for the GPU before being freed") {
+    auto& renderer = MVRender::Renderer::instance();
+    renderer.initialize_vulkan_headless();
+    auto &deletion_queue = renderer.get_deletion_queue();
+
+    // A whole level's worth of buffers goes away without waiting on anything
+    uint8_t garbage[256] = {0};
+    std::vector<MVR_Buffer> buffers(1000);
+    for (auto &buffer: buffers) {
+        REQUIRE(mvr_CreateBuffer(sizeof(garbage), garbage, &buffer) == MVR_RESULT_SUCCESS);
+    }
+    std::vector<uint8_t> big(MVRender::SHARED_BUFFER_THRESHOLD * 2);
+    MVR_Buffer big_buffer;
+    REQUIRE(mvr_CreateBuffer(big.size(), big.data(), &big_buffer) == MVR_RESULT_SUCCESS);
+    renderer.begin_frame();
+    for (auto buffer: buffers) {
+        mvr_DestroyBuffer(buffer);
+    }
+    mvr_DestroyBuffer(big_buffer);
+    REQUIRE(deletion_queue.size() == buffers.size() + 1);
+    REQUIRE_THROWS_AS(renderer.resolve_buffer(big_buffer), MVRender::Exception);
+    renderer.end_frame();
+
+    // Once that frame is done the next ones free everything
+    for (uint32_t i = 0; i <= MVRender::FRAMES_IN_FLIGHT && deletion_queue.size() > 0; i++) {
+        renderer.begin_frame();
+        renderer.end_frame();
+    }
+    REQUIRE(deletion_queue.size() == 0);
+    renderer.quit_vulkan_headless();
+}
+
+TEST_CASE("Buffers can be read back asynchronously") {
+    auto& renderer = MVRender::Renderer::instance();
+    renderer.initialize_vulkan_headless();
+
+    // One buffer packed into a shared block and one with its own VkBuffer
+    std::vector<uint8_t> small(1024), big(1024 * 1024);
+    for (size_t i = 0; i < big.size(); i++) {
+        big[i] = static_cast<uint8_t>(i % 251);
+        if (i < small.size()) {
+            small[i] = static_cast<uint8_t>(255 - i % 256);
+        }
+    }
+    MVR_Buffer small_buffer, big_buffer;
+    REQUIRE(mvr_CreateBuffer(small.size(), small.data(), &small_buffer) == MVR_RESULT_SUCCESS);
+    REQUIRE(mvr_CreateBuffer(big.size(), big.data(), &big_buffer) == MVR_RESULT_SUCCESS);
+    renderer.begin_frame();
+    renderer.end_frame();
+    renderer.begin_frame();
+
+    // An update in the same frame shows up in the readback, and so does a temp buffer's data
+    uint8_t patch[4] = {0xAB, 0xAB, 0xAB, 0xAB};
+    MVR_UpdateBufferParams update_params = {.buffer = small_buffer, .offset = 100, .size = sizeof(patch), .data = patch};
+    REQUIRE(mvr_UpdateBuffer(&update_params) == MVR_RESULT_SUCCESS);
+    std::memcpy(small.data() + 100, patch, sizeof(patch));
+    uint8_t temp_data[64];
+    for (uint8_t i = 0; i < sizeof(temp_data); i++) {
+        temp_data[i] = i * 3;
+    }
+    MVR_Buffer temp;
+    REQUIRE(mvr_CreateTempBuffer(sizeof(temp_data), temp_data, &temp) == MVR_RESULT_SUCCESS);
+
+    MVR_Readback small_readback, big_readback, temp_readback;
+    MVR_ReadBufferAsyncParams params = {.buffer = small_buffer, .offset = 64, .size = 128};
+    REQUIRE(mvr_ReadBufferAsync(&params, &small_readback) == MVR_RESULT_SUCCESS);
+    params = {.buffer = big_buffer, .offset = 1000, .size = 4000};
+    REQUIRE(mvr_ReadBufferAsync(&params, &big_readback) == MVR_RESULT_SUCCESS);
+    params = {.buffer = temp, .offset = 0, .size = sizeof(temp_data)};
+    REQUIRE(mvr_ReadBufferAsync(&params, &temp_readback) == MVR_RESULT_SUCCESS);
+    params = {.buffer = small_buffer, .offset = 1000, .size = 100};
+    MVR_Readback out_of_range;
+    REQUIRE(mvr_ReadBufferAsync(&params, &out_of_range) == MVR_RESULT_INVALID_ARGUMENT);
+
+    const void *data;
+    REQUIRE(mvr_GetReadbackData(small_readback, &data) == MVR_RESULT_NOT_READY);
+    renderer.end_frame();
+    REQUIRE(wait_until([&] { return mvr_IsReadbackReady(temp_readback); }));
+    REQUIRE(mvr_IsReadbackReady(small_readback));
+    REQUIRE(mvr_IsReadbackReady(big_readback));
+
+    REQUIRE(mvr_GetReadbackData(small_readback, &data) == MVR_RESULT_SUCCESS);
+    REQUIRE(std::memcmp(data, small.data() + 64, 128) == 0);
+    REQUIRE(mvr_GetReadbackData(big_readback, &data) == MVR_RESULT_SUCCESS);
+    REQUIRE(std::memcmp(data, big.data() + 1000, 4000) == 0);
+    REQUIRE(mvr_GetReadbackData(temp_readback, &data) == MVR_RESULT_SUCCESS);
+    REQUIRE(std::memcmp(data, temp_data, sizeof(temp_data)) == 0);
+
+    // Released readbacks are gone, releasing twice is harmless
+    mvr_ReleaseReadback(small_readback);
+    mvr_ReleaseReadback(small_readback);
+    REQUIRE(mvr_GetReadbackData(small_readback, &data) == MVR_RESULT_INVALID_HANDLE);
+    mvr_ReleaseReadback(big_readback);
+    mvr_ReleaseReadback(temp_readback);
+
+    // Holding on to readbacks eventually runs the ring dry
+    renderer.begin_frame();
+    std::vector<MVR_Readback> held;
+    params = {.buffer = big_buffer, .offset = 0, .size = big.size()};
+    MVR_Result result = MVR_RESULT_SUCCESS;
+    for (uint64_t i = 0; i <= MVRender::READBACK_RING_SIZE / big.size() && result == MVR_RESULT_SUCCESS; i++) {
+        MVR_Readback readback;
+        result = mvr_ReadBufferAsync(&params, &readback);
+        if (result == MVR_RESULT_SUCCESS) {
+            held.push_back(readback);
+        }
+    }
+    REQUIRE(result == MVR_RESULT_OUT_OF_MEMORY);
+    for (auto readback: held) {
+        mvr_ReleaseReadback(readback);
+    }
+    renderer.end_frame();
+
+    mvr_DestroyBuffer(small_buffer);
+    mvr_DestroyBuffer(big_buffer);
+    renderer.quit_vulkan_headless();
+}
+
+TEST_CASE("Frames in flight can change between frames") {
+    auto& renderer = MVRender::Renderer::instance();
+    renderer.initialize_vulkan_headless();
+    REQUIRE(renderer.get_frames_in_flight() == MVRender::FRAMES_IN_FLIGHT);
+    REQUIRE(mvr_SetFramesInFlight(0) == MVR_RESULT_INVALID_ARGUMENT);
+    REQUIRE(mvr_SetFramesInFlight(MVRender::MAX_FRAMES_IN_FLIGHT + 1) == MVR_RESULT_INVALID_ARGUMENT);
+
+    // Every setting gets its own timings, and temp buffers keep working across the switch
+    uint8_t garbage[100] = {0};
+    for (uint32_t count: {1u, 3u, 2u}) {
+        REQUIRE(mvr_SetFramesInFlight(count) == MVR_RESULT_SUCCESS);
+        for (int i = 0; i < 5; i++) {
+            renderer.begin_frame();
+            MVR_Buffer temp;
+            REQUIRE(mvr_CreateTempBuffer(sizeof(garbage), garbage, &temp) == MVR_RESULT_SUCCESS);
+            renderer.end_frame();
+        }
+        REQUIRE(renderer.get_frames_in_flight() == count);
+
+        MVR_FrameStats stats;
+        REQUIRE(mvr_GetFrameStats(&stats) == MVR_RESULT_SUCCESS);
+        REQUIRE(stats.frames_in_flight == count);
+        REQUIRE(stats.frame_count == 4);
+        REQUIRE(stats.average_frame_time > 0);
+        REQUIRE(stats.average_wait_time <= stats.average_frame_time);
+    }
+
+    renderer.quit_vulkan_headless();
+}
+
+TEST_CASE("Frames complete with or without an async compute queue") {
+    auto& renderer = MVRender::Renderer::instance();
+    renderer.initialize_vulkan_headless();
+    INFO("Async compute " << (renderer.has_async_compute() ? "enabled" : "unavailable"));
+
+    // Copies, compute and drawing are chained through their timelines either way, so a readback
+    // recorded at the end of drawing sees the frame's copies
+    uint8_t data[256];
+    for (int i = 0; i < 256; i++) {
+        data[i] = static_cast<uint8_t>(i);
+    }
+    for (int i = 0; i < 4; i++) {
+        renderer.begin_frame();
+        MVR_Buffer temp;
+        REQUIRE(mvr_CreateTempBuffer(sizeof(data), data, &temp) == MVR_RESULT_SUCCESS);
+        MVR_ReadBufferAsyncParams params = {.buffer = temp, .offset = 0, .size = sizeof(data)};
+        MVR_Readback readback;
+        REQUIRE(mvr_ReadBufferAsync(&params, &readback) == MVR_RESULT_SUCCESS);
+        renderer.end_frame();
+
+        REQUIRE(wait_until([&] { return mvr_IsReadbackReady(readback); }));
+        const void *result;
+        REQUIRE(mvr_GetReadbackData(readback, &result) == MVR_RESULT_SUCCESS);
+        REQUIRE(std::memcmp(result, data, sizeof(data)) == 0);
+        mvr_ReleaseReadback(readback);
+    }
+
+    renderer.quit_vulkan_headless();
+}
+
+TEST_CASE("Secondary command buffers from worker threads run in order") {
+    auto& renderer = MVRender::Renderer::instance();
+    renderer.initialize_vulkan_headless();
+
+    uint32_t zeroes[64] = {0};
+    MVR_Buffer buffer;
+    REQUIRE(mvr_CreateBuffer(sizeof(zeroes), zeroes, &buffer) == MVR_RESULT_SUCCESS);
+    renderer.begin_frame();
+    renderer.end_frame();
+
+    for (int frame = 0; frame < 3; frame++) {
+        renderer.begin_frame();
+        MVRender::BufferDescriptor *descriptor = renderer.resolve_buffer(buffer);
+
+        // Every thread fills the same buffer, so whatever is left is from the secondary that ran last,
+        // which is thread 0's second one since it asked for the highest order
+        constexpr uint32_t thread_count = 4;
+        std::vector<std::thread> threads;
+        for (uint32_t t = 0; t < thread_count; t++) {
+            threads.emplace_back([&renderer, descriptor, t, frame]() {
+                for (uint32_t i = 0; i < 2; i++) {
+                    VkCommandBuffer commands = renderer.begin_secondary_commands((thread_count - t) * 2 + i);
+                    VkMemoryBarrier2 barrier = {
+                            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+                            .srcStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+                            .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                            .dstStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+                            .dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                    };
+                    VkDependencyInfo dependency_info = {
+                            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+                            .memoryBarrierCount = 1,
+                            .pMemoryBarriers = &barrier,
+                    };
+                    vkCmdPipelineBarrier2(commands, &dependency_info);
+                    vkCmdFillBuffer(commands, descriptor->buffer, descriptor->offset, descriptor->size, frame * 100 + t * 10 + i);
+                }
+            });
+        }
+        for (auto &thread: threads) {
+            thread.join();
+        }
+
+        MVR_ReadBufferAsyncParams params = {.buffer = buffer, .offset = 0, .size = sizeof(zeroes)};
+        MVR_Readback readback;
+        REQUIRE(mvr_ReadBufferAsync(&params, &readback) == MVR_RESULT_SUCCESS);
+        renderer.end_frame();
+
+        REQUIRE(wait_until([&] { return mvr_IsReadbackReady(readback); }));
+        const void *data;
+        REQUIRE(mvr_GetReadbackData(readback, &data) == MVR_RESULT_SUCCESS);
+        auto values = static_cast<const uint32_t *>(data);
+        REQUIRE(std::all_of(values, values + 64, [frame](uint32_t value) { return value == static_cast<uint32_t>(frame * 100 + 1); }));
+        mvr_ReleaseReadback(readback);
+    }
+
+    mvr_DestroyBuffer(buffer);
+    renderer.quit_vulkan_headless();
+}
+
+TEST_CASE("Present mode can change after initialization") {
+    auto& renderer = MVRender::Renderer::instance();
+    renderer.initialize_vulkan_headless();
+
+    REQUIRE(mvr_SetPresentMode(static_cast<MVR_PresentMode>(-1)) == MVR_RESULT_INVALID_ARGUMENT);
+    REQUIRE(mvr_SetPresentMode(static_cast<MVR_PresentMode>(MVR_PRESENT_MODE_IMMEDIATE + 1)) == MVR_RESULT_INVALID_ARGUMENT);
+
+    // Headless there's no swapchain to rebuild, frames just keep going
+    for (MVR_PresentMode mode: {MVR_PRESENT_MODE_IMMEDIATE, MVR_PRESENT_MODE_VSYNC, MVR_PRESENT_MODE_TRIPLE_BUFFER}) {
+        REQUIRE(mvr_SetPresentMode(mode) == MVR_RESULT_SUCCESS);
+        renderer.begin_frame();
+        renderer.end_frame();
+    }
+
+    renderer.quit_vulkan_headless();
+}
+
+TEST_CASE("Frame rate limit paces frames and timings are recorded") {
+    auto& renderer = MVRender::Renderer::instance();
+    renderer.initialize_vulkan_headless();
+
+    REQUIRE(mvr_SetFrameRateLimit(-1) == MVR_RESULT_INVALID_ARGUMENT);
+    REQUIRE(mvr_SetFrameRateLimit(1e-12) == MVR_RESULT_INVALID_ARGUMENT);
+    REQUIRE(mvr_SetFrameRateLimit(std::numeric_limits<double>::infinity()) == MVR_RESULT_INVALID_ARGUMENT);
+    REQUIRE(mvr_SetFrameRateLimit(std::numeric_limits<double>::quiet_NaN()) == MVR_RESULT_INVALID_ARGUMENT);
+    REQUIRE(mvr_SetFrameRateLimit(100) == MVR_RESULT_SUCCESS);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 10; i++) {
+        renderer.begin_frame();
+        renderer.end_frame();
+    }
+
+    // The first frame goes out right away, the other nine wait out 10ms each
+    REQUIRE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(85));
+
+    // Finished frames show up oldest first once a later frame has started
+    MVR_FrameTiming timings[16];
+    uint32_t count;
+    REQUIRE(mvr_GetFrameTimings(timings, 16, &count) == MVR_RESULT_SUCCESS);
+    REQUIRE(count > 0);
+    for (uint32_t i = 0; i < count; i++) {
+        REQUIRE(timings[i].gpu_latency >= 0);
+        REQUIRE(timings[i].record_time >= 0);
+        if (i > 0) {
+            REQUIRE(timings[i].frame > timings[i - 1].frame);
+        }
+    }
+    REQUIRE(mvr_GetFrameTimings(timings, 1, &count) == MVR_RESULT_SUCCESS);
+    REQUIRE(count == 1);
+
+    REQUIRE(mvr_SetFrameRateLimit(0) == MVR_RESULT_SUCCESS);
+    renderer.quit_vulkan_headless();
+}
+
+TEST_CASE("GPU timestamps are measured around frames and zones") {
+    auto& renderer = MVRender::Renderer::instance();
+    renderer.initialize_vulkan_headless();
+
+    // Zones only go in a frame that's being recorded
+    REQUIRE(mvr_PushGpuZone("outside", 0) == MVR_RESULT_INVALID_ARGUMENT);
+    REQUIRE(mvr_PopGpuZone(0) == MVR_RESULT_INVALID_ARGUMENT);
+    renderer.begin_frame();
+    REQUIRE(mvr_PushGpuZone(nullptr, 0) == MVR_RESULT_INVALID_ARGUMENT);
+    REQUIRE(mvr_PopGpuZone(0) == MVR_RESULT_INVALID_ARGUMENT);
+    REQUIRE(mvr_PushGpuZone("backwards", 2) == MVR_RESULT_SUCCESS);
+    REQUIRE(mvr_PopGpuZone(1) == MVR_RESULT_INVALID_ARGUMENT);
+    REQUIRE(mvr_PopGpuZone(2) == MVR_RESULT_SUCCESS);
+    renderer.end_frame();
+    REQUIRE(mvr_PushGpuZone("outside", 0) == MVR_RESULT_INVALID_ARGUMENT);
+
+    std::vector<uint8_t> zeroes(4 * 1024 * 1024);
+    MVR_Buffer buffer;
+    REQUIRE(mvr_CreateBuffer(zeroes.size(), zeroes.data(), &buffer) == MVR_RESULT_SUCCESS);
+    renderer.begin_frame();
+    renderer.end_frame();
+
+    // The outer zone wraps real work in a secondary, pushed before it was recorded. The empty zone
+    // sits at an order with no secondaries. Then more zones than fit, which still have to be popped.
+    renderer.begin_frame();
+    REQUIRE(mvr_PushGpuZone("outer", 1) == MVR_RESULT_SUCCESS);
+    REQUIRE(mvr_PushGpuZone("inner", 1) == MVR_RESULT_SUCCESS);
+    MVRender::BufferDescriptor *descriptor = renderer.resolve_buffer(buffer);
+    VkCommandBuffer commands = renderer.begin_secondary_commands(1);
+    for (uint32_t i = 0; i < 16; i++) {
+        VkMemoryBarrier2 barrier = {
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+                .srcStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+                .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                .dstStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+                .dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        };
+        VkDependencyInfo dependency_info = {
+                .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+                .memoryBarrierCount = 1,
+                .pMemoryBarriers = &barrier,
+        };
+        vkCmdPipelineBarrier2(commands, &dependency_info);
+        vkCmdFillBuffer(commands, descriptor->buffer, descriptor->offset, descriptor->size, i);
+    }
+    REQUIRE(mvr_PopGpuZone(1) == MVR_RESULT_SUCCESS);
+    REQUIRE(mvr_PopGpuZone(1) == MVR_RESULT_SUCCESS);
+    REQUIRE(mvr_PushGpuZone("empty", 5) == MVR_RESULT_SUCCESS);
+    REQUIRE(mvr_PopGpuZone(5) == MVR_RESULT_SUCCESS);
+    for (int i = 0; i < MVR_MAX_GPU_ZONES; i++) {
+        REQUIRE(mvr_PushGpuZone("filler", 6) == MVR_RESULT_SUCCESS);
+        REQUIRE(mvr_PopGpuZone(6) == MVR_RESULT_SUCCESS);
+    }
+    renderer.end_frame();
+
+    // Stamps come back once the frame in flight comes back around, only that frame had zones
+    MVR_GpuFrameStats stats = {};
+    for (uint32_t i = 0; i <= renderer.get_frames_in_flight() && stats.zone_count == 0; i++) {
+        renderer.begin_frame();
+        REQUIRE(mvr_GetGpuFrameStats(&stats) == MVR_RESULT_SUCCESS);
+        renderer.end_frame();
+    }
+    if (stats.supported) {
+        REQUIRE(stats.frame != 0);
+        REQUIRE(stats.total_time >= stats.draw_time);
+        REQUIRE(stats.copy_time >= 0);
+        REQUIRE(stats.compute_time >= 0);
+        REQUIRE(stats.zone_count == MVR_MAX_GPU_ZONES);
+        REQUIRE(stats.dropped_zones == 3);
+        REQUIRE(std::string(stats.zones[0].name) == "outer");
+        REQUIRE(std::string(stats.zones[1].name) == "inner");
+        REQUIRE(std::string(stats.zones[2].name) == "empty");
+        REQUIRE(stats.zones[0].depth == 0);
+        REQUIRE(stats.zones[1].depth == 1);
+        REQUIRE(stats.zones[1].start >= stats.zones[0].start);
+        REQUIRE(stats.zones[1].duration > 0);
+        REQUIRE(stats.zones[0].duration >= stats.zones[1].duration);
+        REQUIRE(stats.zones[2].start >= stats.zones[1].start + stats.zones[1].duration);
+    }
+
+    mvr_DestroyBuffer(buffer);
+    renderer.quit_vulkan_headless();
+}
+
+TEST_CASE("CPU trace zones can be dumped to a Chrome trace") {
+    auto& renderer = MVRender::Renderer::instance();
+    renderer.initialize_vulkan_headless();
+    for (int i = 0; i < 3; i++) {
+        renderer.begin_frame();
+        renderer.end_frame();
+    }
+
+    REQUIRE(mvr_DumpTrace(nullptr) == MVR_RESULT_INVALID_ARGUMENT);
+    const std::string path = (std::filesystem::temp_directory_path() / "mvr_trace_test.json").string();
+    REQUIRE(mvr_DumpTrace(path.c_str()) == MVR_RESULT_SUCCESS);
+    std::ifstream file(path);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    REQUIRE(contents.str().rfind("{\"traceEvents\":[", 0) == 0);
+#ifdef MVR_TRACING
+    REQUIRE(contents.str().find("\"name\":\"Renderer::begin_frame\",\"ph\":\"X\"") != std::string::npos);
+    REQUIRE(contents.str().find("\"name\":\"Renderer::end_frame\",\"ph\":\"X\"") != std::string::npos);
+#endif
+    file.close();
+    std::filesystem::remove(path);
+
+    renderer.quit_vulkan_headless();
+}
+
+TEST_CASE("Frame graph culls, orders and batches barriers between passes") {
+    MVRender::FrameGraph graph;
+    graph.reset();
+    VkBuffer vertices = reinterpret_cast<VkBuffer>(uintptr_t(0x10));
+    VkBuffer particles = reinterpret_cast<VkBuffer>(uintptr_t(0x20));
+    VkBuffer scratch = reinterpret_cast<VkBuffer>(uintptr_t(0x30));
+    MVRender::FrameGraphImageInfo image_info = {
+            .image = reinterpret_cast<VkImage>(uintptr_t(0x40)),
+            .range = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .levelCount = 1, .layerCount = 1},
+            .initial_layout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .initial_stage = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+            .final_layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+            .output = true,
+            .name = "target",
+    };
+    auto vertex_resource = graph.import_buffer(vertices, "vertices");
+    auto particle_resource = graph.import_buffer(particles, "particles");
+    auto scratch_resource = graph.import_buffer(scratch, "scratch", false);
+    auto target = graph.import_image(image_info);
+    REQUIRE(graph.import_buffer(vertices, "vertices") == vertex_resource);
+
+    // Re-imports can leave the final layout alone or agree with it, but not move it somewhere else
+    MVRender::FrameGraphImageInfo reimport_info = image_info;
+    reimport_info.final_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    reimport_info.output = false;
+    REQUIRE(graph.import_image(reimport_info) == target);
+    reimport_info.final_layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    REQUIRE(graph.import_image(reimport_info) == target);
+    reimport_info.final_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    REQUIRE_THROWS_AS(graph.import_image(reimport_info), MVRender::Exception);
+
+    // Two independent writes, then a pass that uses both, then one nothing reads
+    auto simulate = graph.add_pass("simulate", MVRender::FRAME_PASS_COMPUTE, nullptr);
+    graph.write(simulate, particle_resource, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+    auto skin = graph.add_pass("skin", MVRender::FRAME_PASS_COMPUTE, nullptr);
+    graph.read(skin, vertex_resource, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+    graph.write(skin, scratch_resource, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+    auto draw = graph.add_pass("draw", MVRender::FRAME_PASS_GRAPHICS, nullptr);
+    graph.read(draw, particle_resource, VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT, VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT);
+    graph.write(draw, target, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    auto overlay = graph.add_pass("overlay", MVRender::FRAME_PASS_GRAPHICS, nullptr);
+    graph.read(overlay, vertex_resource, VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT, VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT);
+    graph.write(overlay, target, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+
+    graph.compile(false);
+    REQUIRE(graph.is_culled(skin));
+    REQUIRE(!graph.is_culled(simulate));
+    REQUIRE(!graph.is_culled(draw));
+    REQUIRE(!graph.is_culled(overlay));
+
+    // Simulate waits on uploads, then draw and overlay go one after the other since both write the target
+    auto &batches = graph.batches();
+    REQUIRE(batches.size() == 3);
+    REQUIRE(batches[0].queue == MVRender::FRAME_PASS_COMPUTE);
+    REQUIRE(batches[1].passes == std::vector<MVRender::FramePass>{draw});
+    REQUIRE(batches[1].barrier.images.size() == 1);
+    REQUIRE(batches[1].barrier.images[0].newLayout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    REQUIRE(batches[1].barrier.images[0].srcStageMask == VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT); // chains to the acquire
+    REQUIRE((batches[1].barrier.memory.srcStageMask & VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT) != 0);
+    REQUIRE(batches[2].passes == std::vector<MVRender::FramePass>{overlay});
+    REQUIRE((batches[2].barrier.memory.srcStageMask & VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT) != 0);
+    REQUIRE(graph.final_barrier().images.size() == 1);
+    REQUIRE(graph.final_barrier().images[0].newLayout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+    // An image nothing draws to still waits on its initial stage before going to its final layout
+    graph.reset();
+    graph.import_image(image_info);
+    graph.compile(false);
+    REQUIRE(graph.batches().empty());
+    REQUIRE(graph.final_barrier().images.size() == 1);
+    REQUIRE(graph.final_barrier().images[0].srcStageMask == VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT);
+    REQUIRE(graph.final_barrier().images[0].oldLayout == VK_IMAGE_LAYOUT_UNDEFINED);
+
+    // Independent passes in one command buffer share a batch
+    graph.reset();
+    particle_resource = graph.import_buffer(particles, "particles");
+    vertex_resource = graph.import_buffer(vertices, "vertices");
+    for (auto resource: {particle_resource, vertex_resource}) {
+        auto pass = graph.add_pass("fill", MVRender::FRAME_PASS_GRAPHICS, nullptr);
+        graph.write(pass, resource, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+    }
+    graph.compile(false);
+    REQUIRE(graph.batches().size() == 1);
+    REQUIRE(graph.batches()[0].passes.size() == 2);
+
+    // With async compute, compute waits on the graphics queue's copies through a semaphore instead
+    graph.reset();
+    particle_resource = graph.import_buffer(particles, "particles");
+    auto upload = graph.add_pass("upload", MVRender::FRAME_PASS_COPY, nullptr);
+    graph.write(upload, particle_resource, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+    simulate = graph.add_pass("simulate", MVRender::FRAME_PASS_COMPUTE, nullptr);
+    graph.read(simulate, particle_resource, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+    graph.set_side_effects(simulate);
+    graph.compile(true);
+    REQUIRE(graph.batches().size() == 2);
+    REQUIRE(graph.batches()[1].barrier.empty());
+    graph.compile(false);
+    REQUIRE(!graph.batches()[1].barrier.empty());
+
+    // With compute on a family of its own, uploads are released to it at the end of the copy commands, and
+    // whatever compute had goes back to graphics either before drawing uses it or at the end of the frame
+    graph.set_queue_families(0, 1);
+    graph.reset();
+    particle_resource = graph.import_buffer(particles, "particles");
+    target = graph.import_image(image_info);
+    upload = graph.add_pass("upload", MVRender::FRAME_PASS_COPY, nullptr);
+    graph.write(upload, particle_resource, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+    simulate = graph.add_pass("simulate", MVRender::FRAME_PASS_COMPUTE, nullptr);
+    graph.write(simulate, particle_resource, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+    auto blur = graph.add_pass("blur", MVRender::FRAME_PASS_COMPUTE, nullptr);
+    graph.write(blur, target, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL);
+    draw = graph.add_pass("draw", MVRender::FRAME_PASS_GRAPHICS, nullptr);
+    graph.read(draw, particle_resource, VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT, VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT);
+    graph.set_side_effects(draw);
+    graph.compile(true);
+    REQUIRE(graph.batches().size() == 3);
+
+    auto &copy_release = graph.release_barrier(MVRender::FRAME_PASS_COPY);
+    REQUIRE(copy_release.buffers.size() == 1);
+    REQUIRE(copy_release.images.empty());
+    REQUIRE(copy_release.buffers[0].srcQueueFamilyIndex == 0);
+    REQUIRE(copy_release.buffers[0].dstQueueFamilyIndex == 1);
+    REQUIRE((copy_release.buffers[0].srcStageMask & VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT) != 0);
+    auto &compute_barrier = graph.batches()[1].barrier;
+    REQUIRE(compute_barrier.buffers.size() == 1);
+    REQUIRE(compute_barrier.buffers[0].srcQueueFamilyIndex == 0);
+    REQUIRE(compute_barrier.buffers[0].dstQueueFamilyIndex == 1);
+    REQUIRE(compute_barrier.buffers[0].dstStageMask == VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+    REQUIRE(compute_barrier.images.size() == 1); // the target starts out undefined so there's nothing to acquire
+    REQUIRE(compute_barrier.images[0].srcQueueFamilyIndex == compute_barrier.images[0].dstQueueFamilyIndex);
+
+    auto &compute_release = graph.release_barrier(MVRender::FRAME_PASS_COMPUTE);
+    REQUIRE(compute_release.buffers.size() == 1);
+    REQUIRE(compute_release.buffers[0].srcQueueFamilyIndex == 1);
+    REQUIRE(compute_release.buffers[0].dstQueueFamilyIndex == 0);
+    REQUIRE(compute_release.buffers[0].srcStageMask == VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+    REQUIRE(compute_release.buffers[0].srcAccessMask == VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+    REQUIRE(compute_release.images.size() == 1);
+    REQUIRE(compute_release.images[0].oldLayout == VK_IMAGE_LAYOUT_GENERAL);
+    REQUIRE(compute_release.images[0].newLayout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+    auto &draw_barrier = graph.batches()[2].barrier;
+    REQUIRE(draw_barrier.buffers.size() == 1);
+    REQUIRE(draw_barrier.buffers[0].srcQueueFamilyIndex == 1);
+    REQUIRE(draw_barrier.buffers[0].dstQueueFamilyIndex == 0);
+    REQUIRE(graph.final_barrier().images.size() == 1);
+    REQUIRE(graph.final_barrier().images[0].srcQueueFamilyIndex == 1);
+    REQUIRE(graph.final_barrier().images[0].dstQueueFamilyIndex == 0);
+    REQUIRE(graph.final_barrier().images[0].oldLayout == VK_IMAGE_LAYOUT_GENERAL);
+    REQUIRE(graph.final_barrier().images[0].newLayout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+    REQUIRE(graph.release_barrier(MVRender::FRAME_PASS_GRAPHICS).empty());
+
+    // Without async compute, or on one family, nothing changes hands
+    graph.compile(false);
+    REQUIRE(graph.release_barrier(MVRender::FRAME_PASS_COPY).empty());
+    REQUIRE(graph.release_barrier(MVRender::FRAME_PASS_COMPUTE).empty());
+    REQUIRE(graph.final_barrier().images[0].srcQueueFamilyIndex == graph.final_barrier().images[0].dstQueueFamilyIndex);
+    graph.set_queue_families(0, 0);
+    graph.compile(true);
+    REQUIRE(graph.release_barrier(MVRender::FRAME_PASS_COPY).empty());
+
+    // Copies are submitted before drawing, so they can't use what drawing made
+    graph.reset();
+    particle_resource = graph.import_buffer(particles, "particles");
+    draw = graph.add_pass("draw", MVRender::FRAME_PASS_GRAPHICS, nullptr);
+    graph.write(draw, particle_resource, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+    upload = graph.add_pass("copy back", MVRender::FRAME_PASS_COPY, nullptr);
+    graph.read(upload, particle_resource, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT);
+    graph.set_side_effects(upload);
+    REQUIRE_THROWS_AS(graph.compile(false), MVRender::Exception);
+}
+
+TEST_CASE("Frame graph passes run in the frame's command buffers") {
+    auto& renderer = MVRender::Renderer::instance();
+    renderer.initialize_vulkan_headless();
+
+    uint32_t zeroes[64] = {0};
+    MVR_Buffer buffer;
+    REQUIRE(mvr_CreateBuffer(sizeof(zeroes), zeroes, &buffer) == MVR_RESULT_SUCCESS);
+    MVR_Buffer scratch;
+    REQUIRE(mvr_CreateBuffer(sizeof(zeroes), zeroes, &scratch) == MVR_RESULT_SUCCESS);
+    renderer.begin_frame();
+    renderer.end_frame();
+
+    // Each pass fills the buffer, the one that wrote it last in graph order wins and the culled one never runs
+    renderer.begin_frame();
+    MVRender::BufferDescriptor *descriptor = renderer.resolve_buffer(buffer);
+    MVRender::BufferDescriptor *scratch_descriptor = renderer.resolve_buffer(scratch);
+    auto &graph = renderer.get_frame_graph();
+    auto resource = graph.import_buffer(descriptor->buffer, "buffer");
+    auto scratch_resource = graph.import_buffer(scratch_descriptor->buffer, "scratch", false);
+    auto fill = [descriptor](uint32_t value) {
+        return [descriptor, value](VkCommandBuffer commands) {
+            vkCmdFillBuffer(commands, descriptor->buffer, descriptor->offset, descriptor->size, value);
+        };
+    };
+    for (uint32_t value: {1u, 2u, 3u}) {
+        auto queue = value == 1 ? MVRender::FRAME_PASS_COPY : value == 2 ? MVRender::FRAME_PASS_COMPUTE : MVRender::FRAME_PASS_GRAPHICS;
+        auto pass = graph.add_pass("fill", queue, fill(value));
+        graph.write(pass, resource, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+    }
+    auto culled = graph.add_pass("unused", MVRender::FRAME_PASS_GRAPHICS, fill(99));
+    graph.write(culled, scratch_resource, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+
+    MVR_ReadBufferAsyncParams params = {.buffer = buffer, .offset = 0, .size = sizeof(zeroes)};
+    MVR_Readback readback;
+    REQUIRE(mvr_ReadBufferAsync(&params, &readback) == MVR_RESULT_SUCCESS);
+    renderer.end_frame();
+    REQUIRE(graph.is_culled(culled));
+
+    REQUIRE(wait_until([&] { return mvr_IsReadbackReady(readback); }));
+    const void *data;
+    REQUIRE(mvr_GetReadbackData(readback, &data) == MVR_RESULT_SUCCESS);
+    auto values = static_cast<const uint32_t *>(data);
+    REQUIRE(std::all_of(values, values + 64, [](uint32_t value) { return value == 3; }));
+    mvr_ReleaseReadback(readback);
+
+    mvr_DestroyBuffer(buffer);
+    mvr_DestroyBuffer(scratch);
+    renderer.quit_vulkan_headless();
+}
+
+TEST_CASE("Frame graph transient images share memory when their lifetimes don't overlap") {
+    auto& renderer = MVRender::Renderer::instance();
+    renderer.initialize_vulkan_headless();
+
+    uint32_t zeroes[64] = {0};
+    MVR_Buffer buffer;
+    REQUIRE(mvr_CreateBuffer(sizeof(zeroes), zeroes, &buffer) == MVR_RESULT_SUCCESS);
+    renderer.begin_frame();
+    renderer.end_frame();
+
+    // Each image is cleared then copied out, the second clear has to wait for the first copy so
+    // the two are never alive in the same batch
+    renderer.begin_frame();
+    MVRender::BufferDescriptor *descriptor = renderer.resolve_buffer(buffer);
+    auto &graph = renderer.get_frame_graph();
+    auto resource = graph.import_buffer(descriptor->buffer, "buffer");
+    MVRender::FrameGraphTransientImageInfo image_info = {
+            .format = VK_FORMAT_R32_UINT,
+            .width = 8, .height = 8,
+            .mip_levels = 1, .array_layers = 1,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+            .aspect = VK_IMAGE_ASPECT_COLOR_BIT,
+            .name = "first",
+    };
+    auto first = graph.create_image(image_info);
+    image_info.name = "second";
+    image_info.mip_levels = 0; // same as 1
+    image_info.array_layers = 0;
+    auto second = graph.create_image(image_info);
+    image_info.name = "unused";
+    auto unused = graph.create_image(image_info);
+
+    auto clear = [&graph](MVRender::FrameGraphResource image, uint32_t value) {
+        return [&graph, image, value](VkCommandBuffer commands) {
+            VkClearColorValue color = {.uint32 = {value, value, value, value}};
+            VkImageSubresourceRange range = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+            vkCmdClearColorImage(commands, graph.image(image), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color, 1, &range);
+        };
+    };
+    auto copy = [&graph, descriptor](MVRender::FrameGraphResource image) {
+        return [&graph, descriptor, image](VkCommandBuffer commands) {
+            VkBufferImageCopy region = {
+                    .bufferOffset = descriptor->offset,
+                    .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+                    .imageExtent = {8, 8, 1},
+            };
+            vkCmdCopyImageToBuffer(commands, graph.image(image), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, descriptor->buffer, 1, &region);
+        };
+    };
+    for (auto [image, value]: {std::pair{first, 1u}, std::pair{second, 2u}}) {
+        auto clear_pass = graph.add_pass("clear", MVRender::FRAME_PASS_GRAPHICS, clear(image, value));
+        graph.write(clear_pass, image, VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        graph.read(clear_pass, resource, VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_NONE);
+        auto copy_pass = graph.add_pass("copy", MVRender::FRAME_PASS_GRAPHICS, copy(image));
+        graph.read(copy_pass, image, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+        graph.write(copy_pass, resource, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+    }
+    auto culled = graph.add_pass("unused", MVRender::FRAME_PASS_GRAPHICS, clear(unused, 99));
+    graph.write(culled, unused, VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+    MVR_ReadBufferAsyncParams params = {.buffer = buffer, .offset = 0, .size = sizeof(zeroes)};
+    MVR_Readback readback;
+    REQUIRE(mvr_ReadBufferAsync(&params, &readback) == MVR_RESULT_SUCCESS);
+    renderer.end_frame();
+    REQUIRE(graph.batches().size() == 4);
+    REQUIRE(graph.image(first) != VK_NULL_HANDLE);
+    REQUIRE(graph.image(second) != VK_NULL_HANDLE);
+    REQUIRE(graph.image_view(first) != VK_NULL_HANDLE);
+    REQUIRE(graph.image(unused) == VK_NULL_HANDLE);
+
+    // Both images fit in the space of one
+    MVR_MemoryStats stats;
+    REQUIRE(mvr_GetMemoryStats(&stats) == MVR_RESULT_SUCCESS);
+    REQUIRE(stats.transient_image_unaliased_bytes > 0);
+    REQUIRE(stats.transient_image_peak_bytes * 2 == stats.transient_image_unaliased_bytes);
+    REQUIRE(stats.transient_image_bytes >= stats.transient_image_peak_bytes);
+
+    REQUIRE(wait_until([&] { return mvr_IsReadbackReady(readback); }));
+    const void *data;
+    REQUIRE(mvr_GetReadbackData(readback, &data) == MVR_RESULT_SUCCESS);
+    auto values = static_cast<const uint32_t *>(data);
+    REQUIRE(std::all_of(values, values + 64, [](uint32_t value) { return value == 2; }));
+    mvr_ReleaseReadback(readback);
+
+    // Without a pool to put them in, graphs with transient images can't be compiled
+    MVRender::FrameGraph standalone;
+    standalone.reset();
+    standalone.create_image(image_info);
+    REQUIRE_THROWS_AS(standalone.compile(false), MVRender::Exception);
+
+    // Images with nothing in them or no usage aren't images
+    image_info.width = 0;
+    REQUIRE_THROWS_AS(standalone.create_image(image_info), MVRender::Exception);
+    image_info.width = 8;
+    image_info.height = 0;
+    REQUIRE_THROWS_AS(standalone.create_image(image_info), MVRender::Exception);
+    image_info.height = 8;
+    image_info.usage = 0;
+    REQUIRE_THROWS_AS(standalone.create_image(image_info), MVRender::Exception);
+
+    mvr_DestroyBuffer(buffer);
+    renderer.quit_vulkan_headless();
+}